@@ -0,0 +1,205 @@
+/**
+ * @file admission_control.cpp - Implementation of query admission and memory budgets.
+ * MemoryManager
+ * MemoryBudget
+ * AdmissionController
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include "admission_control.h"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// Begin Memory Manager Functions
+
+const std::size_t MemoryManager::MIN_GRANT;
+
+MemoryManager::MemoryManager(std::size_t capacity, double max_share)
+    : capacity(capacity), max_grant(std::max(MIN_GRANT, (std::size_t)(capacity * max_share))), granted(0), spills(0)
+{}
+
+std::size_t MemoryManager::acquire(std::size_t requested) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::size_t available = this->granted < this->capacity ? this->capacity - this->granted : 0;
+    std::size_t grant = std::min(requested, std::min(available, this->max_grant));
+    grant = std::max(grant, std::min(requested, MIN_GRANT));
+    this->granted += grant;
+    return grant;
+}
+
+void MemoryManager::release(std::size_t granted) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->granted -= std::min(granted, this->granted);
+}
+
+std::size_t MemoryManager::get_granted() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->granted;
+}
+
+u_int64_t MemoryManager::get_spills() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->spills;
+}
+
+void MemoryManager::count_spill() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->spills++;
+}
+
+// End Memory Manager Functions
+
+// Begin Memory Budget Functions
+
+MemoryBudget::MemoryBudget(MemoryManager& manager, std::size_t requested)
+    : manager(manager), limit(manager.acquire(requested)), used(0), spilled(false)
+{}
+
+MemoryBudget::~MemoryBudget() {
+    this->manager.release(this->limit);
+}
+
+bool MemoryBudget::reserve(std::size_t bytes) {
+    if (this->used + bytes > this->limit) {
+        if (!this->spilled) {
+            this->spilled = true;
+            this->manager.count_spill();
+        }
+        return false;
+    }
+    this->used += bytes;
+    return true;
+}
+
+void MemoryBudget::release(std::size_t bytes) {
+    this->used -= std::min(bytes, this->used);
+}
+
+// End Memory Budget Functions
+
+// Begin Admission Controller Functions
+
+AdmissionController::AdmissionController(unsigned max_heavy)
+    : max_heavy(max_heavy ? max_heavy : 1), running(0), waiting(0), next_ticket(0), serving_ticket(0),
+      admitted_heavy(0), admitted_light(0)
+{}
+
+void AdmissionController::admit(bool heavy) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (!heavy) {
+        this->admitted_light++;
+        return;
+    }
+    u_int64_t ticket = this->next_ticket++;
+    this->waiting++;
+    this->slots.wait(lock, [this, ticket] {
+        return ticket == this->serving_ticket && this->running < this->max_heavy;
+    });
+    this->waiting--;
+    this->serving_ticket++;
+    this->running++;
+    this->admitted_heavy++;
+    // the next ticket in line may also fit
+    this->slots.notify_all();
+}
+
+void AdmissionController::finish(bool heavy) {
+    if (!heavy) return;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->running--;
+    }
+    this->slots.notify_all();
+}
+
+unsigned AdmissionController::get_queue_depth() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->waiting;
+}
+
+unsigned AdmissionController::get_running() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->running;
+}
+
+u_int64_t AdmissionController::get_admitted(bool heavy) const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return heavy ? this->admitted_heavy : this->admitted_light;
+}
+
+// End Admission Controller Functions
+
+std::string admission_stats(const AdmissionController& controller, const MemoryManager& manager) {
+    std::stringstream out;
+    out << "admission: " << controller.get_running() << " heavy running, "
+        << controller.get_queue_depth() << " queued, "
+        << controller.get_admitted(true) << " heavy and " << controller.get_admitted(false) << " light admitted; "
+        << "memory: " << manager.get_granted() << "/" << manager.get_capacity() << " bytes granted, "
+        << manager.get_spills() << " spills";
+    return out.str();
+}
+
+bool test_admission_control() {
+    // polls (a bounded time) until another thread has reached a point
+    auto await = [](std::function<bool()> reached) {
+        for (int i = 0; i < 5000 && !reached(); i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return reached();
+    };
+
+    // heavy queries past the limit wait; light ones go straight through
+    AdmissionController limited(2);
+    limited.admit(true);
+    limited.admit(true);
+    bool admitted = false;
+    std::thread third([&] {
+        limited.admit(true);
+        admitted = true;
+        limited.finish(true);
+    });
+    bool limit_ok = await([&] { return limited.get_queue_depth() == 1; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    limit_ok = limit_ok && limited.get_running() == 2;
+    limited.admit(false);
+    limited.finish(false);
+    bool light_ok = limited.get_admitted(false) == 1 && limited.get_queue_depth() == 1;
+    limited.finish(true);
+    third.join();
+    limit_ok = limit_ok && admitted && limited.get_admitted(true) == 3 && limited.get_running() == 1;
+    limited.finish(true);
+    std::cout << "admission limit ok" << std::endl;
+    std::cout << "admission light bypass ok" << std::endl;
+
+    // waiting heavy queries are admitted in arrival order
+    AdmissionController serial(1);
+    serial.admit(true);
+    std::mutex mutex;
+    std::vector<unsigned> order;
+    std::vector<std::thread> queued;
+    bool fifo_ok = true;
+    for (unsigned i = 0; i < 3; i++) {
+        queued.push_back(std::thread([&, i] {
+            serial.admit(true);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                order.push_back(i);
+            }
+            serial.finish(true);
+        }));
+        fifo_ok = fifo_ok && await([&] { return serial.get_queue_depth() == i + 1; });
+    }
+    serial.finish(true);
+    for (std::thread& thread : queued)
+        thread.join();
+    fifo_ok = fifo_ok && order == std::vector<unsigned>({0, 1, 2});
+    std::cout << "admission fifo ok" << std::endl;
+
+    return limit_ok && light_ok && fifo_ok;
+}
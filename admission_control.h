@@ -0,0 +1,244 @@
+/**
+ * @file admission_control.h - Query admission and operator memory budgets.
+ * MemoryManager
+ * MemoryBudget
+ * AdmissionController
+ * AdmissionTicket
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+
+/**
+ * @class MemoryManager - global pool that memory-hungry operators draw from
+ *
+ * Operators such as sorts and hash tables ask for a budget up front and are
+ * granted what the pool can spare, capped at a fraction of the pool so one
+ * query cannot starve the rest. When an operator's working set outgrows its
+ * grant it must spill to disk rather than allocate more.
+ */
+class MemoryManager {
+public:
+    static const std::size_t MIN_GRANT = 64 * 1024;
+
+    /**
+     * @param capacity The total bytes operators may hold at once
+     * @param max_share The largest fraction of capacity one grant may take
+     */
+    MemoryManager(std::size_t capacity, double max_share = 0.25);
+
+    virtual ~MemoryManager() {}
+
+    MemoryManager(const MemoryManager& other) = delete;
+
+    MemoryManager(MemoryManager&& temp) = delete;
+
+    MemoryManager& operator=(const MemoryManager& other) = delete;
+
+    MemoryManager& operator=(MemoryManager&& temp) = delete;
+
+    /**
+     * Grants up to the requested number of bytes. Never blocks: when the pool
+     * is exhausted the grant is MIN_GRANT, so the operator can still make
+     * progress by spilling.
+     * @param requested The bytes the operator would like
+     * @return The bytes granted
+     */
+    virtual std::size_t acquire(std::size_t requested);
+
+    /**
+     * Returns a grant to the pool
+     * @param granted The bytes previously granted
+     */
+    virtual void release(std::size_t granted);
+
+    /**
+     * Retrieves the bytes currently granted to operators
+     */
+    virtual std::size_t get_granted() const;
+
+    /**
+     * Retrieves the pool size
+     */
+    virtual std::size_t get_capacity() const { return this->capacity; }
+
+    /**
+     * Retrieves the number of operators that were told to spill
+     */
+    virtual u_int64_t get_spills() const;
+
+    /**
+     * Records that an operator spilled
+     */
+    virtual void count_spill();
+
+protected:
+    std::size_t capacity;
+    std::size_t max_grant;
+    std::size_t granted;
+    u_int64_t spills;
+    mutable std::mutex mutex;
+};
+
+/**
+ * @class MemoryBudget - one operator's grant from a MemoryManager
+ *
+ * The operator reserves bytes as its working set grows; a failed reserve()
+ * means the operator is over budget and must spill, then release() what it
+ * wrote out. The grant is returned to the pool on destruction.
+ */
+class MemoryBudget {
+public:
+    /**
+     * @param manager The pool to draw from
+     * @param requested The bytes the operator would like
+     */
+    MemoryBudget(MemoryManager& manager, std::size_t requested);
+
+    virtual ~MemoryBudget();
+
+    MemoryBudget(const MemoryBudget& other) = delete;
+
+    MemoryBudget(MemoryBudget&& temp) = delete;
+
+    MemoryBudget& operator=(const MemoryBudget& other) = delete;
+
+    MemoryBudget& operator=(MemoryBudget&& temp) = delete;
+
+    /**
+     * Accounts for more of the operator's working set
+     * @param bytes The bytes about to be held
+     * @return False if they would exceed the grant (nothing is reserved; spill)
+     */
+    virtual bool reserve(std::size_t bytes);
+
+    /**
+     * Accounts for working set the operator has freed or spilled
+     * @param bytes The bytes no longer held
+     */
+    virtual void release(std::size_t bytes);
+
+    /**
+     * Retrieves the bytes granted to the operator
+     */
+    virtual std::size_t get_limit() const { return this->limit; }
+
+    /**
+     * Retrieves the bytes the operator currently holds
+     */
+    virtual std::size_t get_used() const { return this->used; }
+
+protected:
+    MemoryManager& manager;
+    std::size_t limit;
+    std::size_t used;
+    bool spilled;
+};
+
+/**
+ * @class AdmissionController - limits how many heavy queries run at once
+ *
+ * Heavy queries (scans, joins, sorts) wait in a FIFO queue for one of a fixed
+ * number of slots. Light queries such as point lookups are never queued, so
+ * they are not stuck behind a backlog of heavy work.
+ */
+class AdmissionController {
+public:
+    /**
+     * @param max_heavy The number of heavy queries allowed to run at once
+     */
+    AdmissionController(unsigned max_heavy);
+
+    virtual ~AdmissionController() {}
+
+    AdmissionController(const AdmissionController& other) = delete;
+
+    AdmissionController(AdmissionController&& temp) = delete;
+
+    AdmissionController& operator=(const AdmissionController& other) = delete;
+
+    AdmissionController& operator=(AdmissionController&& temp) = delete;
+
+    /**
+     * Blocks until the query may run
+     * @param heavy True for heavy queries, false for ones that bypass the queue
+     */
+    virtual void admit(bool heavy);
+
+    /**
+     * Marks an admitted query as finished
+     * @param heavy True if the query was admitted as heavy
+     */
+    virtual void finish(bool heavy);
+
+    /**
+     * Retrieves the number of heavy queries waiting to run
+     */
+    virtual unsigned get_queue_depth() const;
+
+    /**
+     * Retrieves the number of heavy queries running
+     */
+    virtual unsigned get_running() const;
+
+    /**
+     * Retrieves the number of queries admitted so far
+     * @param heavy True to count heavy queries, false for light ones
+     */
+    virtual u_int64_t get_admitted(bool heavy) const;
+
+protected:
+    unsigned max_heavy;
+    unsigned running;
+    unsigned waiting;
+    u_int64_t next_ticket;     // handed out in arrival order
+    u_int64_t serving_ticket;  // the oldest waiting ticket may go next
+    u_int64_t admitted_heavy;
+    u_int64_t admitted_light;
+    mutable std::mutex mutex;
+    std::condition_variable slots;
+};
+
+/**
+ * @class AdmissionTicket - holds an admission for the lifetime of a query
+ */
+class AdmissionTicket {
+public:
+    AdmissionTicket(AdmissionController& controller, bool heavy) : controller(controller), heavy(heavy) {
+        controller.admit(heavy);
+    }
+
+    virtual ~AdmissionTicket() { this->controller.finish(this->heavy); }
+
+    AdmissionTicket(const AdmissionTicket& other) = delete;
+
+    AdmissionTicket(AdmissionTicket&& temp) = delete;
+
+    AdmissionTicket& operator=(const AdmissionTicket& other) = delete;
+
+    AdmissionTicket& operator=(AdmissionTicket&& temp) = delete;
+
+protected:
+    AdmissionController& controller;
+    bool heavy;
+};
+
+/**
+ * Summarizes admission queue depth and memory granted for the shell
+ * @param controller The admission controller
+ * @param manager The memory manager
+ * @return A one-line report
+ */
+std::string admission_stats(const AdmissionController& controller, const MemoryManager& manager);
+
+/**
+ * Admission control test function. Returns true if all tests pass.
+ */
+bool test_admission_control();
@@ -0,0 +1,589 @@
+/**
+ * @file btree_storage.cpp - Implementation of the B+tree storage engine and indexes.
+ * ClusteredTable: DbRelation
+ * BTreeIndex
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include "btree_storage.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+
+using u32 = u_int32_t;
+
+/**
+ * Compares an encoded key returned by Berkeley DB with another encoded key,
+ * the same way Berkeley DB's default B+tree comparison does
+ */
+static int compare_keys(const Dbt& a, const std::string& b) {
+    std::size_t n = std::min<std::size_t>(a.get_size(), b.size());
+    int cmp = std::memcmp(a.get_data(), b.data(), n);
+    if (cmp)
+        return cmp;
+    return a.get_size() < b.size() ? -1 : a.get_size() > b.size() ? 1 : 0;
+}
+
+/**
+ * Checks whether a row satisfies equality predicates
+ */
+static bool matches(const ValueDict* row, const ValueDict* where) {
+    for (auto const& predicate : *where) {
+        ValueDict::const_iterator column = row->find(predicate.first);
+        if (column == row->end())
+            throw DbRelationError("unknown column " + predicate.first);
+        const Value& value = column->second;
+        if (value.data_type != predicate.second.data_type)
+            return false;
+        if (value.data_type == ColumnAttribute::INT ? value.n != predicate.second.n : value.s != predicate.second.s)
+            return false;
+    }
+    return true;
+}
+
+// Begin Dbt Buffer Functions
+
+DbtBuffer::DbtBuffer() {
+    this->set_flags(DB_DBT_REALLOC);
+}
+
+DbtBuffer::DbtBuffer(const void* bytes, u_int32_t size) : DbtBuffer() {
+    this->assign(bytes, size);
+}
+
+DbtBuffer::~DbtBuffer() {
+    std::free(this->get_data());
+}
+
+void DbtBuffer::assign(const void* bytes, u_int32_t size) {
+    void* data = std::realloc(this->get_data(), size ? size : 1);
+    if (!data)
+        throw std::bad_alloc();
+    std::memcpy(data, bytes, size);
+    this->set_data(data);
+    this->set_size(size);
+}
+
+// End Dbt Buffer Functions
+
+// Begin Clustered Table Functions
+
+ClusteredTable::ClusteredTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                               Identifier key_column)
+    : DbRelation(table_name, column_names, column_attributes), key_column(key_column), dbfilename(""),
+      closed(true), db(_DB_ENV, 0), handle_keys(), handle_ids()
+{
+    if (std::find(this->column_names.begin(), this->column_names.end(), key_column) == this->column_names.end())
+        throw DbRelationError("unknown primary key column " + key_column);
+}
+
+void ClusteredTable::create() {
+    this->db_open(DB_CREATE | DB_EXCL);
+    HeapTable::bump_version(this->table_name);
+}
+
+void ClusteredTable::create_if_not_exists() {
+    if (this->exists())
+        this->open();
+    else
+        this->create();
+}
+
+void ClusteredTable::drop() {
+    this->close();
+    const char* home;
+    _DB_ENV->get_home(&home);
+    std::string dbfilepath = std::string(home) + "/" + this->dbfilename;
+    if (std::remove(dbfilepath.c_str()))
+        std::cerr << "could not remove DB file" << std::endl;
+    HeapTable::bump_version(this->table_name);
+}
+
+void ClusteredTable::open() {
+    this->db_open();
+}
+
+void ClusteredTable::close() {
+    this->db.close(0);
+    this->closed = true;
+}
+
+Handle ClusteredTable::insert(const ValueDict* row) {
+    this->open();
+    ValueDict* full_row = this->validate(row);
+    std::string key = encode_key((*full_row)[this->key_column]);
+    Dbt* data = marshal_row(full_row, this->column_names, this->column_attributes);
+    Dbt dbkey((void*)key.data(), key.size());
+    int ret = this->db.put(nullptr, &dbkey, data, DB_NOOVERWRITE);
+    delete[] (char*)data->get_data();
+    delete data;
+    delete full_row;
+    if (ret == DB_KEYEXIST)
+        throw DbRelationError("duplicate primary key in " + this->table_name);
+    HeapTable::bump_version(this->table_name);
+    return this->locate(key);
+}
+
+void ClusteredTable::update(const Handle handle, const ValueDict* new_values) {
+    ValueDict* row = this->project(handle);
+    for (auto const& new_value : *new_values)
+        (*row)[new_value.first] = new_value.second;
+    ValueDict* full_row = this->validate(row);
+    delete row;
+
+    DbtBuffer data;
+    std::string old_key_bytes = this->seek(handle, data);
+
+    std::string key = encode_key((*full_row)[this->key_column]);
+    Dbt* new_data = marshal_row(full_row, this->column_names, this->column_attributes);
+    Dbt dbkey((void*)key.data(), key.size());
+    int ret = this->db.put(nullptr, &dbkey, new_data, key == old_key_bytes ? 0 : DB_NOOVERWRITE);
+    delete[] (char*)new_data->get_data();
+    delete new_data;
+    delete full_row;
+    if (ret == DB_KEYEXIST)
+        throw DbRelationError("duplicate primary key in " + this->table_name);
+    if (key != old_key_bytes) {
+        Dbt dbold_key((void*)old_key_bytes.data(), old_key_bytes.size());
+        this->db.del(nullptr, &dbold_key, 0);
+        // the handle follows the row to its new key
+        this->handle_ids.erase(old_key_bytes);
+        this->handle_keys[handle.first - 1] = key;
+        this->handle_ids[key] = handle.first;
+    }
+    HeapTable::bump_version(this->table_name);
+}
+
+void ClusteredTable::del(const Handle handle) {
+    DbtBuffer data;
+    std::string key_bytes = this->seek(handle, data);
+    Dbt dbkey((void*)key_bytes.data(), key_bytes.size());
+    this->db.del(nullptr, &dbkey, 0);
+    HeapTable::bump_version(this->table_name);
+}
+
+Handles* ClusteredTable::select() {
+    return this->select((const Predicate*)nullptr);
+}
+
+Handles* ClusteredTable::select(const ValueDict* where) {
+    this->open();
+    Handles* handles = new Handles();
+    if (where) {
+        ValueDict::const_iterator key = where->find(this->key_column);
+        if (key != where->end()) {
+            ValueDict* row = this->lookup(key->second);
+            if (row && matches(row, where))
+                handles->push_back(this->locate(encode_key(key->second)));
+            delete row;
+            return handles;
+        }
+    }
+    this->scan_records([&](const Handle& handle, const Dbt& record) {
+        if (where) {
+            ValueDict* row = unmarshal_row(&record, this->column_names, this->column_attributes);
+            bool match = matches(row, where);
+            delete row;
+            if (!match)
+                return;
+        }
+        handles->push_back(handle);
+    });
+    return handles;
+}
+
+Handles* ClusteredTable::select(const Predicate* where) {
+    this->open();
+    Handles* handles = new Handles();
+    const Value* low = nullptr;
+    const Value* high = nullptr;
+    RecordFilter filter;
+    if (where) {
+        where->get_bounds(this->key_column, low, high);
+        filter = where->compile(this->column_names, this->column_attributes);
+    }
+    this->scan_range(low, high, [&](const Handle& handle, const Dbt& record) {
+        if (!filter || filter((const char*)record.get_data()))
+            handles->push_back(handle);
+    });
+    return handles;
+}
+
+ValueDict* ClusteredTable::project(Handle handle) {
+    return this->project(handle, nullptr);
+}
+
+ValueDict* ClusteredTable::project(Handle handle, const ColumnNames* column_names) {
+    DbtBuffer data;
+    this->seek(handle, data);
+    ValueDict* row = unmarshal_row(&data, this->column_names, this->column_attributes);
+    if (column_names) {
+        ValueDict* temp_row = new ValueDict();
+        for (const Identifier& column_name : *column_names)
+            (*temp_row)[column_name] = (*row)[column_name];
+        delete row;
+        row = temp_row;
+    }
+    return row;
+}
+
+ValueDict* ClusteredTable::lookup(const Value& key) {
+    this->open();
+    std::string key_bytes = encode_key(key);
+    Dbt dbkey((void*)key_bytes.data(), key_bytes.size());
+    DbtBuffer data;
+    if (this->db.get(nullptr, &dbkey, &data, 0) == DB_NOTFOUND)
+        return nullptr;
+    return unmarshal_row(&data, this->column_names, this->column_attributes);
+}
+
+void ClusteredTable::scan_range(const Value* low, const Value* high, const RecordVisitor& visitor) {
+    this->open();
+    std::string low_key = low ? encode_key(*low) : "";
+    std::string high_key = high ? encode_key(*high) : "";
+    Dbc* cursor;
+    this->db.cursor(nullptr, &cursor, 0);
+    DbtBuffer key(low_key.data(), low_key.size()), data;
+    int ret = cursor->get(&key, &data, low ? DB_SET_RANGE : DB_FIRST);
+    while (!ret) {
+        if (high && compare_keys(key, high_key) > 0)
+            break;
+        visitor(this->locate(std::string((const char*)key.get_data(), key.get_size())), data);
+        ret = cursor->get(&key, &data, DB_NEXT);
+    }
+    cursor->close();
+}
+
+void ClusteredTable::scan_records(const RecordVisitor& visitor) {
+    this->scan_range(nullptr, nullptr, visitor);
+}
+
+void ClusteredTable::db_open(uint flags) {
+    if (!this->closed) return;
+    this->db.set_message_stream(_DB_ENV->get_message_stream());
+    this->db.set_error_stream(_DB_ENV->get_error_stream());
+    this->dbfilename = this->table_name + ".db";
+    if (this->db.open(NULL, this->dbfilename.c_str(), NULL, DB_BTREE, flags, 0)) {
+        this->close();
+        return;
+    }
+    this->closed = false;
+}
+
+bool ClusteredTable::exists() {
+    const char* home;
+    _DB_ENV->get_home(&home);
+    std::string dbfilepath = std::string(home) + "/" + this->table_name + ".db";
+    return access(dbfilepath.c_str(), F_OK) == 0;
+}
+
+ValueDict* ClusteredTable::validate(const ValueDict* row) {
+    ValueDict* full_row = new ValueDict();
+    for (Identifier& column_name : this->column_names) {
+        ValueDict::const_iterator column = row->find(column_name);
+        if (column == row->end()) {
+            delete full_row;
+            throw DbRelationError("missing column name");
+        }
+        (*full_row)[column_name] = column->second;
+    }
+    return full_row;
+}
+
+std::string ClusteredTable::seek(Handle handle, DbtBuffer& data) {
+    this->open();
+    if (handle.second || handle.first < 1 || handle.first > this->handle_keys.size())
+        throw DbRelationError("unknown handle for " + this->table_name);
+    const std::string& key = this->handle_keys[handle.first - 1];
+    Dbt dbkey((void*)key.data(), key.size());
+    if (this->db.get(nullptr, &dbkey, &data, 0) == DB_NOTFOUND)
+        throw DbRelationError("no such row in " + this->table_name);
+    return key;
+}
+
+Handle ClusteredTable::locate(const std::string& key) {
+    std::unordered_map<std::string, BlockID>::iterator found = this->handle_ids.find(key);
+    if (found != this->handle_ids.end())
+        return Handle(found->second, 0);
+    this->handle_keys.push_back(key);
+    BlockID id = this->handle_keys.size();
+    this->handle_ids[key] = id;
+    return Handle(id, 0);
+}
+
+// End Clustered Table Functions
+
+// Begin BTree Index Functions
+
+BTreeIndex::BTreeIndex(Identifier table_name, ColumnNames key_columns, ColumnNames covered_columns,
+                       ColumnAttributes covered_attributes)
+    : name(table_name), key_columns(key_columns), covered_columns(covered_columns),
+      covered_attributes(covered_attributes), dbfilename(""), closed(true), db(_DB_ENV, 0)
+{
+    for (const Identifier& column_name : key_columns)
+        this->name += "-" + column_name;
+}
+
+void BTreeIndex::create() {
+    this->db_open(DB_CREATE | DB_EXCL);
+}
+
+void BTreeIndex::drop() {
+    this->close();
+    const char* home;
+    _DB_ENV->get_home(&home);
+    std::string dbfilepath = std::string(home) + "/" + this->name + ".db";
+    if (std::remove(dbfilepath.c_str()))
+        std::cerr << "could not remove DB file" << std::endl;
+}
+
+void BTreeIndex::open() {
+    this->db_open();
+}
+
+void BTreeIndex::close() {
+    this->db.close(0);
+    this->closed = true;
+}
+
+bool BTreeIndex::exists() {
+    const char* home;
+    _DB_ENV->get_home(&home);
+    std::string dbfilepath = std::string(home) + "/" + this->name + ".db";
+    return access(dbfilepath.c_str(), F_OK) == 0;
+}
+
+std::string BTreeIndex::get_key(const ValueDict* row) const {
+    std::string key;
+    for (std::size_t i = 0; i < this->key_columns.size(); i++) {
+        ValueDict::const_iterator column = row->find(this->key_columns[i]);
+        if (column == row->end())
+            throw DbRelationError("missing key column " + this->key_columns[i]);
+        std::string part = encode_key(column->second);
+        if (column->second.data_type != ColumnAttribute::TEXT || i + 1 == this->key_columns.size()) {
+            key += part;
+            continue;
+        }
+        // escape embedded zeros and terminate, so a shorter string sorts before its extensions
+        for (char c : part) {
+            key.push_back(c);
+            if (!c)
+                key.push_back('\xff');
+        }
+        key.append(2, '\0');
+    }
+    return key;
+}
+
+bool BTreeIndex::insert(const std::string& key, Handle handle, const ValueDict* row) {
+    // an entry is the handle, padded, followed by the covered columns' record
+    std::string bytes(BTreeIndex::ENTRY_HEADER_SZ, '\0');
+    std::memcpy(&bytes[0], &handle.first, sizeof(BlockID));
+    std::memcpy(&bytes[sizeof(BlockID)], &handle.second, sizeof(RecordID));
+    if (!this->covered_columns.empty()) {
+        Dbt* record = marshal_row(row, this->covered_columns, this->covered_attributes);
+        bytes.append((const char*)record->get_data(), record->get_size());
+        delete[] (char*)record->get_data();
+        delete record;
+    }
+    Dbt dbkey((void*)key.data(), key.size()), data((void*)bytes.data(), bytes.size());
+    return this->db.put(nullptr, &dbkey, &data, DB_NOOVERWRITE) != DB_KEYEXIST;
+}
+
+void BTreeIndex::del(const std::string& key) {
+    Dbt dbkey((void*)key.data(), key.size());
+    this->db.del(nullptr, &dbkey, 0);
+}
+
+bool BTreeIndex::lookup(const std::string& key, Handle& handle) {
+    Dbt dbkey((void*)key.data(), key.size());
+    DbtBuffer data;
+    if (this->db.get(nullptr, &dbkey, &data, 0) == DB_NOTFOUND)
+        return false;
+    const char* bytes = (const char*)data.get_data();
+    std::memcpy(&handle.first, bytes, sizeof(BlockID));
+    std::memcpy(&handle.second, bytes + sizeof(BlockID), sizeof(RecordID));
+    return true;
+}
+
+Handles* BTreeIndex::lookup_range(const std::string* low, const std::string* high) {
+    Handles* handles = new Handles();
+    this->scan_range(low, high, [&](const Handle& handle, const Dbt&) {
+        handles->push_back(handle);
+    });
+    return handles;
+}
+
+void BTreeIndex::scan_range(const std::string* low, const std::string* high, const RecordVisitor& visitor) {
+    Dbc* cursor;
+    this->db.cursor(nullptr, &cursor, 0);
+    DbtBuffer key, data;
+    int ret;
+    if (low) {
+        key.assign(low->data(), low->size());
+        ret = cursor->get(&key, &data, DB_SET_RANGE);
+    } else {
+        ret = cursor->get(&key, &data, DB_FIRST);
+    }
+    for (; !ret; ret = cursor->get(&key, &data, DB_NEXT)) {
+        if (high && compare_keys(key, *high) > 0)
+            break;
+        Handle handle;
+        char* bytes = (char*)data.get_data();
+        std::memcpy(&handle.first, bytes, sizeof(BlockID));
+        std::memcpy(&handle.second, bytes + sizeof(BlockID), sizeof(RecordID));
+        Dbt record(bytes + BTreeIndex::ENTRY_HEADER_SZ, data.get_size() - BTreeIndex::ENTRY_HEADER_SZ);
+        visitor(handle, record);
+    }
+    cursor->close();
+}
+
+bool BTreeIndex::covers(const ColumnNames& column_names) const {
+    for (const Identifier& column_name : column_names)
+        if (std::find(this->covered_columns.begin(), this->covered_columns.end(), column_name) ==
+            this->covered_columns.end())
+            return false;
+    return !this->covered_columns.empty();
+}
+
+bool BTreeIndex::contains_any(const std::vector<std::string>& keys) {
+    if (keys.empty())
+        return false;
+    Dbc* cursor;
+    this->db.cursor(nullptr, &cursor, 0);
+    DbtBuffer key(keys[0].data(), keys[0].size()), data;
+    int ret = cursor->get(&key, &data, DB_SET_RANGE);
+    bool found = false;
+    // walk the batch and the leaves together; seek again only when the next
+    // key is beyond the current leaf entry
+    for (std::size_t i = 0; i < keys.size() && !ret && !found; ) {
+        int cmp = compare_keys(key, keys[i]);
+        if (!cmp) {
+            found = true;
+        } else if (cmp > 0) {
+            i++;
+        } else {
+            key.assign(keys[i].data(), keys[i].size());
+            ret = cursor->get(&key, &data, DB_SET_RANGE);
+        }
+    }
+    cursor->close();
+    return found;
+}
+
+void BTreeIndex::db_open(uint flags) {
+    if (!this->closed) return;
+    this->db.set_message_stream(_DB_ENV->get_message_stream());
+    this->db.set_error_stream(_DB_ENV->get_error_stream());
+    this->dbfilename = this->name + ".db";
+    if (this->db.open(NULL, this->dbfilename.c_str(), NULL, DB_BTREE, flags, 0)) {
+        this->close();
+        return;
+    }
+    this->closed = false;
+}
+
+// End BTree Index Functions
+
+std::string encode_key(const Value& value) {
+    if (value.data_type == ColumnAttribute::TEXT)
+        return value.s;
+    // big-endian with the sign bit flipped, so negative numbers sort first
+    u32 n = (u32)value.n ^ 0x80000000u;
+    char bytes[sizeof(n)] = {(char)(n >> 24), (char)(n >> 16), (char)(n >> 8), (char)n};
+    return std::string(bytes, sizeof(bytes));
+}
+
+bool test_btree_storage() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+
+    ClusteredTable table("_test_clustered_cpp", column_names, column_attributes, "a");
+    table.create_if_not_exists();
+    std::cout << "clustered create ok" << std::endl;
+
+    // Insert out of key order, including a negative key
+    ValueDict row;
+    for (int32_t a : {5, -2, 3, 1}) {
+        row["a"] = Value(a);
+        row["b"] = Value("row " + std::to_string(a));
+        table.insert(&row);
+    }
+    bool duplicate_rejected = false;
+    try {
+        table.insert(&row);
+    } catch (DbRelationError& e) {
+        duplicate_rejected = true;
+    }
+    std::cout << "clustered insert ok" << std::endl;
+
+    // Range scan visits keys 1..3 in order
+    std::vector<int32_t> keys;
+    Value low(1), high(3);
+    table.scan_range(&low, &high, [&](const Handle& handle, const Dbt& record) {
+        keys.push_back(*(int32_t*)record.get_data());
+    });
+    std::cout << "clustered range scan ok " << keys.size() << std::endl;
+
+    // Point lookup, projection by handle, update and delete
+    ValueDict* found = table.lookup(Value(5));
+    bool lookup_ok = found && (*found)["b"].s == "row 5";
+    delete found;
+    Handles* handles = table.select();
+    ValueDict* first = table.project((*handles)[0]);
+    bool project_ok = handles->size() == 4 && (*first)["a"].n == -2;
+    delete first;
+    ValueDict new_values;
+    new_values["a"] = Value(7);
+    table.update((*handles)[0], &new_values);
+    delete handles;
+    found = table.lookup(Value(7));
+    ValueDict* moved = table.lookup(Value(-2));
+    bool update_ok = found && (*found)["b"].s == "row -2" && !moved;
+    delete found;
+    delete moved;
+    ValueDict where;
+    where["a"] = Value(3);
+    handles = table.select(&where);
+    table.del((*handles)[0]);
+    delete handles;
+    handles = table.select();
+    bool delete_ok = handles->size() == 3;
+    delete handles;
+    std::cout << "clustered update/delete ok" << std::endl;
+
+    // handles stay on their row as other rows come and go, follow it to a new key, and die with it
+    handles = table.select();
+    Handle one = (*handles)[0], five = (*handles)[1];
+    delete handles;
+    row["a"] = Value(-9);
+    row["b"] = Value("row -9");
+    table.insert(&row);
+    new_values["a"] = Value(9);
+    table.update(one, &new_values);
+    ValueDict* one_row = table.project(one);
+    ValueDict* five_row = table.project(five);
+    bool stable_ok = (*one_row)["a"].n == 9 && (*one_row)["b"].s == "row 1" && (*five_row)["b"].s == "row 5";
+    delete one_row;
+    delete five_row;
+    table.del(five);
+    try {
+        delete table.project(five);
+        stable_ok = false;
+    } catch (DbRelationError& e) {
+    }
+    std::cout << "clustered stable handles ok" << std::endl;
+
+    table.drop();
+    return duplicate_rejected && keys == std::vector<int32_t>({1, 3}) && lookup_ok && project_ok && update_ok
+           && delete_ok && stable_ok;
+}
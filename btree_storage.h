@@ -0,0 +1,410 @@
+/**
+ * @file btree_storage.h - Implementation of storage_engine with B+trees.
+ * ClusteredTable: DbRelation
+ * BTreeIndex
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "db_cxx.h"
+#include "heap_storage.h"
+#include "record_layout.h"
+#include "storage_engine.h"
+
+/**
+ * @class DbtBuffer - a Dbt that Berkeley DB returns keys and data into with realloc()
+ *
+ * The environment is opened with DB_THREAD, under which Berkeley DB has no
+ * handle-owned buffer to return into, so every Dbt a get fills must bring its
+ * own memory. The buffer is reused by later gets and freed with the Dbt.
+ */
+class DbtBuffer : public Dbt {
+public:
+    DbtBuffer();
+
+    /**
+     * Starts out holding a copy of some bytes, e.g. a search key the get replaces
+     * @param bytes The bytes to copy
+     * @param size The number of bytes
+     */
+    DbtBuffer(const void* bytes, u_int32_t size);
+
+    virtual ~DbtBuffer();
+
+    DbtBuffer(const DbtBuffer& other) = delete;
+
+    DbtBuffer(DbtBuffer&& temp) = delete;
+
+    DbtBuffer& operator=(const DbtBuffer& other) = delete;
+
+    DbtBuffer& operator=(DbtBuffer&& temp) = delete;
+
+    /**
+     * Replaces the contents with a copy of some bytes
+     * @param bytes The bytes to copy
+     * @param size The number of bytes
+     */
+    virtual void assign(const void* bytes, u_int32_t size);
+};
+
+/**
+ * @class ClusteredTable - index-organized storage engine (implementation of DbRelation)
+ *
+ * Rows live in the leaf pages of a Berkeley DB B+tree keyed by a primary key
+ * column, rather than in a heap file plus a separate index. A point lookup is
+ * one descent of the tree, and a range scan reads leaf pages that hold
+ * neighbouring keys. Records use the same format as HeapTable's.
+ *
+ * A handle names a row by its primary key: Handle(n, 0) is the nth distinct
+ * key this table object has handed out a handle for. Handles stay on their
+ * row while other rows are inserted or deleted, follow it through an update
+ * that changes its key, and are rejected once it is deleted. The mapping is
+ * kept in memory, so handles are only good for the object that issued them.
+ */
+class ClusteredTable : public DbRelation {
+public:
+    /**
+     * @param table_name The name of the table
+     * @param column_names The table's column names
+     * @param column_attributes The table's column attributes
+     * @param key_column The primary key column rows are clustered on
+     */
+    ClusteredTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                   Identifier key_column);
+
+    virtual ~ClusteredTable() {}
+
+    ClusteredTable(const ClusteredTable& other) = delete;
+
+    ClusteredTable(ClusteredTable&& temp) = delete;
+
+    ClusteredTable& operator=(const ClusteredTable& other) = delete;
+
+    ClusteredTable& operator=(ClusteredTable&& temp) = delete;
+
+    /**
+     * Creates the ClusteredTable relation
+     */
+    virtual void create();
+
+    /**
+     * Creates the ClusteredTable relation if it doesn't already exist
+     */
+    virtual void create_if_not_exists();
+
+    /**
+     * Drops the ClusteredTable relation
+     */
+    virtual void drop();
+
+    /**
+     * Opens the ClusteredTable relation
+     */
+    virtual void open();
+
+    /**
+     * Closes the ClusteredTable relation
+     */
+    virtual void close();
+
+    /**
+     * Inserts a data tuple into the table
+     * @param row The data tuple to insert
+     * @return A handle locating the inserted tuple
+     * @throws DbRelationError if a row with the same primary key exists
+     */
+    virtual Handle insert(const ValueDict* row);
+
+    /**
+     * Updates a row, moving it if its primary key changes
+     * @param handle The handle of the row
+     * @param new_values The new fields to replace the existing fields with
+     * @throws DbRelationError if the new primary key belongs to another row
+     */
+    virtual void update(const Handle handle, const ValueDict* new_values);
+
+    /**
+     * Deletes a row from the table
+     * @param handle The handle of the row
+     */
+    virtual void del(const Handle handle);
+
+    /**
+     * Select all data tuples (rows) from the table, in primary key order
+     */
+    virtual Handles* select();
+
+    /**
+     * Selects rows matching equality predicates. A predicate on the primary key
+     * is answered with a single descent instead of a scan.
+     * @param where The where-clause predicates
+     * @return Handles of the matching rows, in primary key order
+     */
+    virtual Handles* select(const ValueDict* where);
+
+    /**
+     * Selects rows matching a predicate. Bounds the predicate places on the
+     * primary key narrow the scan to a key range.
+     * @param where The predicate (nullptr for all rows)
+     * @return Handles of the matching rows, in primary key order
+     */
+    virtual Handles* select(const Predicate* where);
+
+    /**
+     * Return a sequence of all values for handle (SELECT *).
+     * @param handle The handle of the row
+     * @returns Dictionary of values from row (keyed by all column names)
+     */
+    virtual ValueDict* project(Handle handle);
+
+    /**
+     * Return a sequence of values for handle given by column_names
+     * @param handle The handle of the row
+     * @param column_names List of column names to project
+     * @returns Dictionary of values from row (keyed by column_names)
+     */
+    virtual ValueDict* project(Handle handle, const ColumnNames* column_names);
+
+    /**
+     * Finds a row by primary key
+     * @param key The primary key value
+     * @return The row (freed by caller), or nullptr if there is none
+     */
+    virtual ValueDict* lookup(const Value& key);
+
+    /**
+     * Visits the marshaled bytes of every row whose primary key is within a range
+     * @param low The smallest key to visit, or nullptr for no lower bound
+     * @param high The largest key to visit, or nullptr for no upper bound
+     * @param visitor Called for each record in primary key order
+     */
+    virtual void scan_range(const Value* low, const Value* high, const RecordVisitor& visitor);
+
+    /**
+     * Visits the marshaled bytes of every row in the table
+     * @param visitor Called for each record in primary key order
+     */
+    virtual void scan_records(const RecordVisitor& visitor);
+
+    /**
+     * Retrieves the name of the primary key column
+     */
+    virtual const Identifier& get_key_column() const { return this->key_column; }
+
+protected:
+    Identifier key_column;
+    std::string dbfilename;
+    bool closed;
+    Db db;
+    std::vector<std::string> handle_keys;                // encoded primary key of handle n at n - 1
+    std::unordered_map<std::string, BlockID> handle_ids; // inverse of handle_keys
+
+    /**
+     * Open the Berkeley DB database file
+     * @param flags Flags to provide the Berkeley DB database file
+     */
+    virtual void db_open(uint flags = 0);
+
+    /**
+     * Checks whether the physical database file exists
+     */
+    virtual bool exists();
+
+    /**
+     * Checks if a row is valid to the table
+     * @param row The data tuple to validate
+     * @return The fully validated data tuple
+     */
+    virtual ValueDict* validate(const ValueDict* row);
+
+    /**
+     * Reads a row by handle
+     * @param handle The handle of the row
+     * @param data Set to the row's record
+     * @return The row's encoded primary key
+     * @throws DbRelationError if the handle was not issued by this table or its row was deleted
+     */
+    virtual std::string seek(Handle handle, DbtBuffer& data);
+
+    /**
+     * Finds the handle for a primary key, issuing a new one the first time
+     * @param key The encoded primary key
+     * @return The handle of the row
+     */
+    virtual Handle locate(const std::string& key);
+};
+
+/**
+ * @class BTreeIndex - unique index from key columns to row handles
+ *
+ * A Berkeley DB B+tree mapping the encoded key columns of each row to the
+ * row's Handle. Used to enforce PRIMARY KEY and UNIQUE constraints with one
+ * probe instead of a table scan.
+ *
+ * A covering index also stores the values of some columns (its key columns
+ * and any included ones) in each entry, marshaled as HeapTable records are,
+ * so queries reading only those columns never touch the table. The handle
+ * takes up ENTRY_HEADER_SZ bytes of each entry, so the record after it starts
+ * aligned.
+ */
+class BTreeIndex {
+public:
+    static const std::size_t ENTRY_HEADER_SZ = 2 * RecordLayout::ALIGNMENT;
+
+    /**
+     * @param table_name The name of the indexed table
+     * @param key_columns The columns making up the key, in key order
+     * @param covered_columns The columns stored with each entry (none unless covering)
+     * @param covered_attributes The attributes of the covered columns
+     */
+    BTreeIndex(Identifier table_name, ColumnNames key_columns, ColumnNames covered_columns = ColumnNames(),
+               ColumnAttributes covered_attributes = ColumnAttributes());
+
+    virtual ~BTreeIndex() {}
+
+    BTreeIndex(const BTreeIndex& other) = delete;
+
+    BTreeIndex(BTreeIndex&& temp) = delete;
+
+    BTreeIndex& operator=(const BTreeIndex& other) = delete;
+
+    BTreeIndex& operator=(BTreeIndex&& temp) = delete;
+
+    /**
+     * Creates the physical index file
+     */
+    virtual void create();
+
+    /**
+     * Removes the physical index file
+     */
+    virtual void drop();
+
+    /**
+     * Opens the index file
+     */
+    virtual void open();
+
+    /**
+     * Closes the index file
+     */
+    virtual void close();
+
+    /**
+     * Checks whether the physical index file exists
+     */
+    virtual bool exists();
+
+    /**
+     * Checks whether the index file is open
+     */
+    virtual bool is_open() const { return !this->closed; }
+
+    /**
+     * Encodes a row's key columns as an index key
+     * @param row The row, containing at least the key columns
+     * @return The encoded key
+     */
+    virtual std::string get_key(const ValueDict* row) const;
+
+    /**
+     * Adds an entry unless the key is already present
+     * @param key The encoded key
+     * @param handle The handle of the row
+     * @param row The row, containing at least the covered columns (needed only if covering)
+     * @return False if the key was already present (nothing is added)
+     */
+    virtual bool insert(const std::string& key, Handle handle, const ValueDict* row = nullptr);
+
+    /**
+     * Removes an entry
+     * @param key The encoded key
+     */
+    virtual void del(const std::string& key);
+
+    /**
+     * Finds the row with a key
+     * @param key The encoded key
+     * @param handle Set to the handle of the row, if found
+     * @return True if the key is present
+     */
+    virtual bool lookup(const std::string& key, Handle& handle);
+
+    /**
+     * Finds the rows with keys within a range
+     * @param low The smallest encoded key to find, or nullptr for no lower bound
+     * @param high The largest encoded key to find, or nullptr for no upper bound
+     * @return The handles of the rows (freed by caller), in key order
+     */
+    virtual Handles* lookup_range(const std::string* low, const std::string* high);
+
+    /**
+     * Visits the entries with keys within a range, without touching the table
+     * @param low The smallest encoded key to visit, or nullptr for no lower bound
+     * @param high The largest encoded key to visit, or nullptr for no upper bound
+     * @param visitor Called in key order with each row's handle and its covered
+     *        columns, marshaled (empty unless covering)
+     */
+    virtual void scan_range(const std::string* low, const std::string* high, const RecordVisitor& visitor);
+
+    /**
+     * Checks whether every one of some columns is stored with the entries
+     * @param column_names The columns
+     */
+    virtual bool covers(const ColumnNames& column_names) const;
+
+    /**
+     * Checks a batch of keys against the index in one pass over its leaves
+     * @param keys The encoded keys, sorted
+     * @return True if any of the keys is present
+     */
+    virtual bool contains_any(const std::vector<std::string>& keys);
+
+    /**
+     * Retrieves the key columns
+     */
+    virtual const ColumnNames& get_key_columns() const { return this->key_columns; }
+
+    /**
+     * Retrieves the columns stored with each entry
+     */
+    virtual const ColumnNames& get_covered_columns() const { return this->covered_columns; }
+
+    /**
+     * Retrieves the attributes of the columns stored with each entry
+     */
+    virtual const ColumnAttributes& get_covered_attributes() const { return this->covered_attributes; }
+
+protected:
+    Identifier name;
+    ColumnNames key_columns;
+    ColumnNames covered_columns;
+    ColumnAttributes covered_attributes;
+    std::string dbfilename;
+    bool closed;
+    Db db;
+
+    /**
+     * Open the Berkeley DB database file
+     * @param flags Flags to provide the Berkeley DB database file
+     */
+    virtual void db_open(uint flags = 0);
+};
+
+/**
+ * Encodes a value so that comparing encodings byte by byte (Berkeley DB's
+ * default B+tree ordering) orders them as the values themselves are ordered
+ * @param value The value to encode
+ * @return The encoded key
+ */
+std::string encode_key(const Value& value);
+
+/**
+ * Clustered storage test function. Returns true if all tests pass.
+ */
+bool test_btree_storage();
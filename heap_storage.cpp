@@ -2,6 +2,7 @@
  * @file heap_storage.cpp - Implementation of the heap storage storage engine.
  * SlottedPage: DbBlock
  * HeapFile: DbFile
+ * HandleBitmap
  * HeapTable: DbRelation
  *
  * @authors Justin Thoreson & Mason Adsero
@@ -9,8 +10,22 @@
  */
 
 #include "heap_storage.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unistd.h>
 #include "db_cxx.h"
+#include "btree_storage.h"
+#include "io_scheduler.h"
+#include "record_layout.h"
+#include "scan_kernels.h"
+#include "text_kernels.h"
 
 using u16 = u_int16_t;
 using u32 = u_int32_t;
@@ -27,6 +42,11 @@ SlottedPage::SlottedPage(Dbt& block, BlockID block_id, bool is_new) : DbBlock(bl
     }
 }
 
+SlottedPage::~SlottedPage() {
+    if (this->block.get_flags() & DB_DBT_MALLOC)
+        std::free(this->block.get_data());
+}
+
 RecordID SlottedPage::add(const Dbt* data) {
     if (!has_room(data->get_size()))
         throw DbBlockNoRoomError("not enough room for new record");
@@ -47,15 +67,24 @@ Dbt* SlottedPage::get(RecordID record_id) {
     return new Dbt(this->address(loc), size);
 }
 
+bool SlottedPage::get(RecordID record_id, Dbt& record) {
+    u16 size, loc;
+    this->get_header(size, loc, record_id);
+    if (!loc) return false; // Tombstone
+    record.set_data(this->address(loc));
+    record.set_size(size);
+    return true;
+}
+
 void SlottedPage::put(RecordID record_id, const Dbt& data) {
     u16 size, loc;
     this->get_header(size, loc, record_id);
-    u16 new_size = sizeof(data);
+    u16 new_size = (u16)data.get_size();
     if (new_size > size) {
         u16 extra = new_size - size;
         if (!this->has_room(extra))
             throw DbBlockNoRoomError("not enough room in block");
-        this->slide(loc + new_size, loc + size);
+        this->slide(loc, loc - extra);
         std::memcpy(this->address(loc - extra), data.get_data(), new_size);
     } else {
         std::memcpy(this->address(loc), data.get_data(), new_size);
@@ -103,7 +132,7 @@ bool SlottedPage::has_room(u16 size){
 }
 
 void SlottedPage::slide(u16 start, u16 end) {
-    u16 shift = end - start;
+    int shift = (int)end - (int)start; // negative to make room
     if (!shift) return;
     
     // Slide data
@@ -181,16 +210,45 @@ SlottedPage* HeapFile::get_new(void) {
     // write out an empty block and read it back in so Berkeley DB is managing the memory
     SlottedPage* page = new SlottedPage(data, this->last, true);
     this->db.put(nullptr, &key, &data, 0); // write it out with initialization applied
-    this->db.get(nullptr, &key, &data, 0);
-    return page;
+    delete page;
+    return this->get(this->last);
 }
 
 SlottedPage* HeapFile::get(BlockID block_id) {
+    // under DB_THREAD the block needs memory of its own, which the page frees
     Dbt key(&block_id, sizeof(block_id)), block;
+    block.set_flags(DB_DBT_MALLOC);
     this->db.get(NULL, &key, &block, 0);
     return new SlottedPage(block, block_id);
 }
 
+void HeapFile::get_many(BlockID first, BlockID last, const BlockVisitor& visitor) {
+    if (first > last)
+        return;
+    std::vector<char> buffer(HeapFile::BULK_BUFFER_SZ);
+    Dbt key(&first, sizeof(first)), data(buffer.data(), buffer.size());
+    data.set_ulen(buffer.size());
+    data.set_flags(DB_DBT_USERMEM);
+    Dbc* cursor;
+    this->db.cursor(nullptr, &cursor, 0);
+    // position on the first block, then take a buffer's worth of blocks per call
+    bool done = false;
+    for (int ret = cursor->get(&key, &data, DB_SET | DB_MULTIPLE_KEY); !ret && !done;
+         ret = cursor->get(&key, &data, DB_NEXT | DB_MULTIPLE_KEY)) {
+        DbMultipleRecnoDataIterator blocks(data);
+        db_recno_t block_id;
+        Dbt block;
+        while (!done && blocks.next(block_id, block)) {
+            done = block_id >= last;
+            if (block_id > last)
+                break;
+            SlottedPage page(block, block_id);
+            visitor(&page);
+        }
+    }
+    cursor->close();
+}
+
 void HeapFile::put(DbBlock* block) {
     BlockID block_id = block->get_block_id();
     Dbt key(&block_id, sizeof(block_id));
@@ -198,6 +256,42 @@ void HeapFile::put(DbBlock* block) {
     this->db.put(NULL, &key, data, 0);
 }
 
+u_int32_t HeapFile::get_page_size() {
+    u_int32_t page_size;
+    this->db.get_pagesize(&page_size);
+    return page_size;
+}
+
+bool HeapFile::migrate() {
+    this->open();
+    if (this->get_page_size() >= HeapFile::PAGE_SZ) {
+        this->close();
+        return false;
+    }
+    // copy every block, under its own ID, into a new file with full-sized pages
+    HeapFile copy(this->name + "_migrating", HeapFile::PAGE_SZ, this->access_method);
+    copy.create();
+    this->get_many(1, this->last, [&](SlottedPage* block) {
+        copy.put(block);
+    });
+    copy.close();
+    this->close();
+
+    // swap the files through Berkeley DB so the environment forgets the old one
+    Db old_file(_DB_ENV, 0), new_file(_DB_ENV, 0);
+    if (old_file.remove(this->dbfilename.c_str(), nullptr, 0) ||
+        new_file.rename(copy.dbfilename.c_str(), nullptr, this->dbfilename.c_str(), 0))
+        throw std::logic_error("could not replace DB file");
+    return true;
+}
+
+bool HeapFile::exists(void) {
+    const char* home;
+    _DB_ENV->get_home(&home);
+    std::string dbfilepath = std::string(home) + "/" + this->name + ".db";
+    return access(dbfilepath.c_str(), F_OK) == 0;
+}
+
 BlockIDs* HeapFile::block_ids() {
     BlockIDs* block_ids = new BlockIDs();
     for (BlockID block_id = 1; block_id <= this->last; block_id++)
@@ -210,40 +304,100 @@ void HeapFile::db_open(uint flags) {
     this->db.set_message_stream(_DB_ENV->get_message_stream());
     this->db.set_error_stream(_DB_ENV->get_error_stream());
     this->db.set_re_len(DbBlock::BLOCK_SZ);
+    if (this->page_size)
+        this->db.set_pagesize(this->page_size); // only takes effect when the file is created
     this->dbfilename = this->name + ".db";
-    if (this->db.open(NULL, this->dbfilename.c_str(), NULL, DB_RECNO, flags, 0))
+    // a new file gets the requested access method; an existing one keeps its own
+    DBTYPE type = DB_UNKNOWN;
+    if (flags & DB_CREATE)
+        type = this->access_method == QUEUE ? DB_QUEUE : DB_RECNO;
+    if (this->db.open(NULL, this->dbfilename.c_str(), NULL, type, flags, 0)) {
         this->close();
-    else
-        this->closed = false;
+        return;
+    }
+    this->db.get_type(&type);
+    this->access_method = type == DB_QUEUE ? QUEUE : RECNO;
+
+    // an existing file already has blocks; pick up numbering where it left off
+    if (this->access_method == QUEUE) {
+        DB_QUEUE_STAT* stat;
+        this->db.stat(nullptr, &stat, DB_FAST_STAT);
+        this->last = flags ? 0 : stat->qs_cur_recno - 1;
+        free(stat);
+    } else {
+        DB_BTREE_STAT* stat;
+        this->db.stat(nullptr, &stat, DB_FAST_STAT);
+        this->last = flags ? 0 : stat->bt_ndata;
+        free(stat);
+    }
+    this->closed = false;
 }
 
 // End Heap File Functions
 
+// Begin Handle Bitmap Functions
+
+void HandleBitmap::add(const Handle& handle) {
+    std::vector<bool>& records = this->blocks[handle.first];
+    if (records.size() <= handle.second)
+        records.resize(handle.second + 1);
+    if (!records[handle.second]) {
+        records[handle.second] = true;
+        this->count++;
+    }
+}
+
+bool HandleBitmap::contains(const Handle& handle) const {
+    std::map<BlockID, std::vector<bool>>::const_iterator records = this->blocks.find(handle.first);
+    return records != this->blocks.end() && handle.second < records->second.size() &&
+           records->second[handle.second];
+}
+
+// End Handle Bitmap Functions
+
 // Begin heap table Functions
 
-HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes)
-    : DbRelation(table_name, column_names, column_attributes), file(table_name)
+// modification counters for each table, keyed by table name
+static std::map<Identifier, u_int64_t> table_versions;
+static std::mutex table_versions_mutex;
+
+HeapTable::HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                     HeapFile::AccessMethod access_method)
+    : DbRelation(table_name, column_names, column_attributes), file(table_name, HeapFile::PAGE_SZ, access_method),
+      primary_key(), unique_indexes(), kernel(nullptr)
 {}
 
+HeapTable::~HeapTable() {
+    for (BTreeIndex* index : this->unique_indexes)
+        delete index;
+    delete this->kernel;
+}
+
 void HeapTable::create() {
     try {
         this->file.create();
+        for (BTreeIndex* index : this->unique_indexes)
+            index->create();
+        HeapTable::bump_version(this->table_name);
     } catch (DbRelationError& e) {
         std::cerr << e.what() << std::endl;
     }
 }
 
 void HeapTable::create_if_not_exists() {
-    try {
-        this->create();
-    } catch (DbRelationError& e) {
+    if (this->file.exists())
         this->open();
-    }
+    else
+        this->create();
 }
 
 void HeapTable::drop() {
     try {
         this->file.drop();
+        for (BTreeIndex* index : this->unique_indexes)
+            if (index->exists())
+                index->drop();
+        HeapTable::bump_version(this->table_name);
     } catch (std::logic_error& e) {
         std::cerr << e.what() << std::endl;
     }
@@ -251,69 +405,407 @@ void HeapTable::drop() {
 
 void HeapTable::open() {
     this->file.open();
+    if (!this->kernel)
+        this->kernel = ScanKernel::create(this->column_attributes);
+    for (BTreeIndex* index : this->unique_indexes) {
+        if (index->is_open())
+            continue;
+        if (index->exists())
+            index->open();
+        else
+            this->build_index(index);
+    }
 }
 
 void HeapTable::close() {
     this->file.close();
+    for (BTreeIndex* index : this->unique_indexes)
+        index->close();
+}
+
+void HeapTable::add_unique(const ColumnNames& key_columns, bool primary_key, const ColumnNames& include_columns) {
+    ColumnNames covered_columns;
+    ColumnAttributes covered_attributes;
+    for (const Identifier& column_name : key_columns)
+        if (std::find(this->column_names.begin(), this->column_names.end(), column_name) == this->column_names.end())
+            throw DbRelationError("unknown column " + column_name);
+    if (!include_columns.empty()) {
+        covered_columns = key_columns;
+        for (const Identifier& column_name : include_columns)
+            if (std::find(covered_columns.begin(), covered_columns.end(), column_name) == covered_columns.end())
+                covered_columns.push_back(column_name);
+        for (const Identifier& column_name : covered_columns) {
+            ColumnNames::const_iterator column =
+                std::find(this->column_names.begin(), this->column_names.end(), column_name);
+            if (column == this->column_names.end())
+                throw DbRelationError("unknown column " + column_name);
+            covered_attributes.push_back(this->column_attributes[column - this->column_names.begin()]);
+        }
+    }
+    if (primary_key) {
+        if (!this->primary_key.empty())
+            throw DbRelationError("multiple primary keys for table " + this->table_name);
+        this->primary_key = key_columns;
+    }
+    this->unique_indexes.push_back(new BTreeIndex(this->table_name, key_columns, covered_columns, covered_attributes));
 }
 
 Handle HeapTable::insert(const ValueDict* row) {
     this->open();
     ValueDict* full_row = this->validate(row);
     Handle handle = this->append(full_row);
+    try {
+        this->index(full_row, handle);
+    } catch (DbRelationError& e) {
+        this->remove(handle);
+        delete full_row;
+        throw;
+    }
     delete full_row;
+    HeapTable::bump_version(this->table_name);
     return handle;
 }
 
+Handles* HeapTable::insert_batch(const std::vector<const ValueDict*>& rows) {
+    this->open();
+    std::vector<ValueDict*> full_rows;
+    try {
+        for (const ValueDict* row : rows)
+            full_rows.push_back(this->validate(row));
+        for (BTreeIndex* index : this->unique_indexes) {
+            std::vector<std::string> keys;
+            for (ValueDict* full_row : full_rows)
+                keys.push_back(index->get_key(full_row));
+            std::sort(keys.begin(), keys.end());
+            if (std::adjacent_find(keys.begin(), keys.end()) != keys.end() || index->contains_any(keys))
+                throw DbRelationError("duplicate key for unique constraint on " + this->table_name);
+        }
+    } catch (DbRelationError& e) {
+        for (ValueDict* full_row : full_rows)
+            delete full_row;
+        throw;
+    }
+
+    Handles* handles = new Handles();
+    for (ValueDict* full_row : full_rows)
+        handles->push_back(this->append(full_row));
+    for (BTreeIndex* index : this->unique_indexes) {
+        // add entries in key order so consecutive puts land on the same leaf
+        std::vector<std::pair<std::string, std::size_t>> entries;
+        for (std::size_t i = 0; i < full_rows.size(); i++)
+            entries.push_back(std::make_pair(index->get_key(full_rows[i]), i));
+        std::sort(entries.begin(), entries.end());
+        for (auto const& entry : entries)
+            index->insert(entry.first, (*handles)[entry.second], full_rows[entry.second]);
+    }
+    for (ValueDict* full_row : full_rows)
+        delete full_row;
+    HeapTable::bump_version(this->table_name);
+    return handles;
+}
+
 void HeapTable::update(const Handle handle, const ValueDict* new_values) {
-    // FIXME
-    throw DbRelationError("could not update record");
-    
-    BlockID block_id = handle.first;
-    RecordID record_id = handle.second;
-    SlottedPage* block = this->file.get(block_id);
+    this->open();
     ValueDict* row = this->project(handle);
-    for(ValueDict::const_iterator it = new_values->begin(); it != new_values->end(); it++)
-        (*row)[it->first] = it->second;
-    ValueDict* full_row = this->validate(row);
-    block->put(record_id, *this->marshal(full_row));
-    this->file.put(block);
+    ValueDict* full_row = new ValueDict(*row);
+    for (ValueDict::const_iterator it = new_values->begin(); it != new_values->end(); it++)
+        (*full_row)[it->first] = it->second;
+
+    // claim the new keys first so a violation leaves the record untouched
+    std::vector<std::pair<BTreeIndex*, std::string>> old_keys, new_keys;
+    for (BTreeIndex* index : this->unique_indexes) {
+        std::string old_key = index->get_key(row), new_key = index->get_key(full_row);
+        if (old_key == new_key)
+            continue;
+        if (!index->insert(new_key, handle, full_row)) {
+            for (auto const& claimed : new_keys)
+                claimed.first->del(claimed.second);
+            delete row;
+            delete full_row;
+            throw DbRelationError("duplicate key for unique constraint on " + this->table_name);
+        }
+        old_keys.push_back(std::make_pair(index, old_key));
+        new_keys.push_back(std::make_pair(index, new_key));
+    }
+
+    Dbt* data = this->marshal(full_row);
+    SlottedPage* block = this->file.get(handle.first);
+    bool fits = true;
+    try {
+        block->put(handle.second, *data);
+    } catch (DbBlockNoRoomError& e) {
+        fits = false;
+    }
+    Handle moved = handle;
+    if (fits) {
+        this->file.put(block);
+    } else {
+        // the row outgrew its block: append it where there is room, then drop the old record
+        try {
+            moved = this->append(full_row);
+        } catch (DbBlockNoRoomError& e) {
+            for (auto const& claimed : new_keys)
+                claimed.first->del(claimed.second);
+            delete[] (char*)data->get_data();
+            delete data;
+            delete block;
+            delete row;
+            delete full_row;
+            throw;
+        }
+        this->remove(handle);
+    }
+    for (auto const& released : old_keys)
+        released.first->del(released.second);
+    // entries of a moved row point at its old handle; entries kept under the same key hold the old covered values
+    for (BTreeIndex* index : this->unique_indexes) {
+        std::string key = index->get_key(full_row);
+        if (moved == handle && (index->get_covered_columns().empty() || key != index->get_key(row)))
+            continue;
+        index->del(key);
+        index->insert(key, moved, full_row);
+    }
+    delete[] (char*)data->get_data();
+    delete data;
     delete block;
+    delete row;
+    delete full_row;
+    HeapTable::bump_version(this->table_name);
 }
 
 void HeapTable::del(const Handle handle) {
-    // FIXME
-    throw DbRelationError("could not delete record");
-
-    BlockID block_id = handle.first;
-    RecordID record_id = handle.second;
-    SlottedPage* block = this->file.get(block_id);
-    block->del(record_id);
-    this->file.put(block);
-    delete block;
+    this->open();
+    if (!this->unique_indexes.empty()) {
+        ValueDict* row = this->project(handle);
+        for (BTreeIndex* index : this->unique_indexes)
+            index->del(index->get_key(row));
+        delete row;
+    }
+    this->remove(handle);
+    HeapTable::bump_version(this->table_name);
 }
 
 Handles* HeapTable::select() {
-    return this->select(nullptr);
+    return this->select((const Predicate*)nullptr);
 }
 
 Handles* HeapTable::select(const ValueDict* where) {
-    // FIXME: ignoring where, limit, order, and group
-    if (where)
-        throw DbRelationError("cannot handle where clauses yet");
-    
+    Predicate* predicate = Predicate::from_where(where);
+    try {
+        Handles* handles = this->select(predicate);
+        delete predicate;
+        return handles;
+    } catch (PredicateError& e) {
+        delete predicate;
+        throw DbRelationError(e.what());
+    }
+}
+
+Handles* HeapTable::select(const Predicate* where) {
+    // FIXME: ignoring limit, order, and group
+    this->open();
     Handles* handles = new Handles();
-    BlockIDs* block_ids = file.block_ids();
-    for (auto const& block_id: *block_ids) {
-        SlottedPage* block = file.get(block_id);
+    if (where) {
+        RecordFilter filter = where->compile(this->column_names, this->column_attributes);
+        this->scan_candidates(where, [&](const Handle& handle, const Dbt& record) {
+            if (filter((const char*)record.get_data()))
+                handles->push_back(handle);
+        });
+        return handles;
+    }
+
+    this->file.get_many(1, this->file.get_last_block_id(), [&](SlottedPage* block) {
         RecordIDs* record_ids = block->ids();
         for (auto const& record_id: *record_ids)
-            handles->push_back(Handle(block_id, record_id));
+            handles->push_back(Handle(block->get_block_id(), record_id));
+        delete record_ids;
+    });
+    return handles;
+}
+
+std::string HeapTable::explain_analyze(const Predicate* where) {
+    typedef std::chrono::steady_clock Clock;
+    this->open();
+    FilterProfile profile;
+    RecordFilter filter;
+    if (where)
+        filter = where->compile(this->column_names, this->column_attributes, &profile);
+    u_int64_t n_scanned = 0, n_matched = 0;
+    RecordVisitor visitor = [&](const Handle& handle, const Dbt& record) {
+        n_scanned++;
+        if (!filter || filter((const char*)record.get_data()))
+            n_matched++;
+    };
+    Clock::time_point start = Clock::now();
+    BTreeIndex* index = nullptr;
+    if (where)
+        index = this->scan_candidates(where, visitor);
+    else
+        this->scan_records(visitor);
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    std::ostringstream report;
+    if (index)
+        report << "Bitmap Heap Scan on " << this->table_name << " using index on " << index->get_key_columns()[0];
+    else
+        report << "Seq Scan on " << this->table_name;
+    report << " (rows " << n_matched << " of " << n_scanned << " scanned, " << ms << "ms)" << std::endl;
+    if (where)
+        report << "  Filter: " << where->to_string() << std::endl;
+    return report.str() + profile.report();
+}
+
+BTreeIndex* HeapTable::scan_candidates(const Predicate* where, const RecordVisitor& visitor) {
+    const Value* low = nullptr;
+    const Value* high = nullptr;
+    BTreeIndex* index = this->choose_index(where, low, high);
+    if (!index) {
+        this->scan_records(visitor);
+        return nullptr;
+    }
+    // index order is key order; fetch in block order instead
+    std::string low_key = low ? encode_key(*low) : "", high_key = high ? encode_key(*high) : "";
+    Handles* found = index->lookup_range(low ? &low_key : nullptr, high ? &high_key : nullptr);
+    HandleBitmap bitmap;
+    for (Handle& handle : *found)
+        bitmap.add(handle);
+    delete found;
+    this->scan_bitmap(bitmap, visitor);
+    return index;
+}
+
+void HeapTable::scan_records(const RecordVisitor& visitor) {
+    this->file.get_many(1, this->file.get_last_block_id(), [&](SlottedPage* block) {
+        RecordIDs* record_ids = block->ids();
+        Dbt record;
+        for (auto const& record_id: *record_ids) {
+            block->get(record_id, record);
+            visitor(Handle(block->get_block_id(), record_id), record);
+        }
         delete record_ids;
+    });
+}
+
+void HeapTable::scan_bitmap(const HandleBitmap& bitmap, const RecordVisitor& visitor) {
+    this->open();
+    for (auto const& entry : bitmap.get_blocks()) {
+        SlottedPage* block = this->file.get(entry.first);
+        Dbt record;
+        for (RecordID record_id = 1; record_id < entry.second.size(); record_id++)
+            if (entry.second[record_id] && block->get(record_id, record))
+                visitor(Handle(entry.first, record_id), record);
         delete block;
     }
-    delete block_ids;
-    return handles;
+}
+
+BTreeIndex* HeapTable::get_index(const Identifier& column_name) {
+    this->open();
+    for (BTreeIndex* index : this->unique_indexes)
+        if (index->get_key_columns() == ColumnNames(1, column_name))
+            return index;
+    return nullptr;
+}
+
+BTreeIndex* HeapTable::choose_index(const Predicate* where, const Value*& low, const Value*& high) {
+    for (BTreeIndex* index : this->unique_indexes) {
+        if (index->get_key_columns().size() != 1)
+            continue;
+        low = high = nullptr;
+        where->get_bounds(index->get_key_columns()[0], low, high);
+        if (low || high)
+            return index;
+    }
+    return nullptr;
+}
+
+BTreeIndex* HeapTable::covering_index(const ColumnNames& column_names, const Predicate* where) {
+    BTreeIndex* covering = nullptr;
+    for (BTreeIndex* index : this->unique_indexes) {
+        if (!index->covers(column_names))
+            continue;
+        if (!covering)
+            covering = index;
+        const Value* low = nullptr;
+        const Value* high = nullptr;
+        if (where && index->get_key_columns().size() == 1)
+            where->get_bounds(index->get_key_columns()[0], low, high);
+        if (low || high)
+            return index;
+    }
+    return covering;
+}
+
+void HeapTable::scan_selected(const Predicate* where,
+                              const std::function<void(SlottedPage*, const SelectionVector&)>& visitor) {
+    RecordFilter filter;
+    if (where)
+        filter = where->compile(this->column_names, this->column_attributes);
+    SelectionVector selection;
+    this->file.get_many(1, this->file.get_last_block_id(), [&](SlottedPage* block) {
+        ScanKernel::select(block, filter, selection);
+        if (!selection.empty())
+            visitor(block, selection);
+    });
+}
+
+AsyncScan* HeapTable::scan_async(IOScheduler& scheduler, const RecordVisitor& visitor) {
+    this->open();
+    AsyncScan* scan = new AsyncScan(scheduler, this->file, visitor);
+    scan->start();
+    return scan;
+}
+
+/**
+ * Creates an empty batch for some of a record's columns
+ * @param column_names The batch's columns
+ * @param record_names The record's columns, in order
+ * @param record_attributes The record's column attributes, in order
+ * @param positions Set to the batch column of each record column (-1 if not in the batch)
+ * @return The batch (freed by caller)
+ * @throws DbRelationError if a column is not in the record
+ */
+static ColumnBatch* new_batch(const ColumnNames& column_names, const ColumnNames& record_names,
+                              const ColumnAttributes& record_attributes, std::vector<int>& positions) {
+    ColumnAttributes column_attributes;
+    positions.assign(record_names.size(), -1);
+    for (const Identifier& column_name : column_names) {
+        ColumnNames::const_iterator column = std::find(record_names.begin(), record_names.end(), column_name);
+        if (column == record_names.end())
+            throw DbRelationError("unknown column " + column_name);
+        int& position = positions[column - record_names.begin()];
+        if (position < 0) {
+            position = column_attributes.size();
+            column_attributes.push_back(record_attributes[column - record_names.begin()]);
+        }
+    }
+    return new ColumnBatch(column_attributes);
+}
+
+void HeapTable::scan_batches(const Predicate* where, const BatchVisitor& visitor, const ColumnNames* column_names) {
+    this->open();
+    if (column_names) {
+        std::vector<int> positions;
+        std::unique_ptr<ColumnBatch> batch(new_batch(*column_names, this->column_names, this->column_attributes,
+                                                     positions));
+        RecordLayout layout(this->column_attributes);
+        this->scan_selected(where, [&](SlottedPage* block, const SelectionVector& selection) {
+            batch->append(block, selection, layout, positions);
+            if (batch->size())
+                visitor(*batch);
+            batch->clear();
+        });
+        return;
+    }
+    RecordFilter filter;
+    if (where)
+        filter = where->compile(this->column_names, this->column_attributes);
+    ColumnBatch batch(this->column_attributes);
+    this->file.get_many(1, this->file.get_last_block_id(), [&](SlottedPage* block) {
+        this->kernel->scan(block, filter, batch);
+        if (batch.size())
+            visitor(batch);
+        batch.clear();
+    });
 }
 
 ValueDict* HeapTable::project(Handle handle) {
@@ -338,6 +830,99 @@ ValueDict* HeapTable::project(Handle handle, const ColumnNames* column_names) {
     return row;
 }
 
+ColumnBatch* HeapTable::project_batch(const Handles* handles, const ColumnNames* column_names) {
+    this->open();
+    std::vector<int> positions;
+    ColumnBatch* batch = new_batch(column_names ? *column_names : this->column_names, this->column_names,
+                                   this->column_attributes, positions);
+    RecordLayout layout(this->column_attributes);
+    Handles sorted(*handles);
+    std::sort(sorted.begin(), sorted.end());
+    SlottedPage* block = nullptr;
+    Dbt record;
+    for (Handle& handle : sorted) {
+        if (!block || block->get_block_id() != handle.first) {
+            delete block;
+            block = this->file.get(handle.first);
+        }
+        if (!block->get(handle.second, record)) {
+            delete block;
+            delete batch;
+            throw DbRelationError("no row at handle");
+        }
+        batch->append(handle, (const char*)record.get_data(), layout, positions);
+    }
+    delete block;
+    return batch;
+}
+
+ColumnBatch* HeapTable::select_columns(const Predicate* where, const ColumnNames* column_names) {
+    this->open();
+    if (!column_names)
+        column_names = &this->column_names;
+    ColumnNames needed(*column_names);
+    if (where)
+        where->get_columns(needed);
+    BTreeIndex* index = this->covering_index(needed, where);
+    const Value* low = nullptr;
+    const Value* high = nullptr;
+    if (!index && (!where || !this->choose_index(where, low, high))) {
+        // late materialization: decode the projected columns of matching records only
+        std::vector<int> positions;
+        std::unique_ptr<ColumnBatch> batch(new_batch(*column_names, this->column_names, this->column_attributes,
+                                                     positions));
+        RecordLayout layout(this->column_attributes);
+        this->scan_selected(where, [&](SlottedPage* block, const SelectionVector& selection) {
+            batch->append(block, selection, layout, positions);
+        });
+        return batch.release();
+    }
+    if (!index) {
+        Handles* handles = this->select(where);
+        ColumnBatch* batch;
+        try {
+            batch = this->project_batch(handles, column_names);
+        } catch (DbRelationError& e) {
+            delete handles;
+            throw;
+        }
+        delete handles;
+        return batch;
+    }
+
+    // index-only: filter and decode the records stored in the index entries
+    const ColumnNames& covered_columns = index->get_covered_columns();
+    const ColumnAttributes& covered_attributes = index->get_covered_attributes();
+    RecordFilter filter;
+    if (where)
+        filter = where->compile(covered_columns, covered_attributes);
+    low = high = nullptr;
+    if (where && index->get_key_columns().size() == 1)
+        where->get_bounds(index->get_key_columns()[0], low, high);
+    std::string low_key = low ? encode_key(*low) : "", high_key = high ? encode_key(*high) : "";
+    std::vector<int> positions;
+    ColumnBatch* batch = new_batch(*column_names, covered_columns, covered_attributes, positions);
+    RecordLayout layout(covered_attributes);
+    RecordVisitor visitor = [&](const Handle& handle, const Dbt& record) {
+        const char* bytes = (const char*)record.get_data();
+        if (!filter || filter(bytes))
+            batch->append(handle, bytes, layout, positions);
+    };
+    index->scan_range(low ? &low_key : nullptr, high ? &high_key : nullptr, visitor);
+    return batch;
+}
+
+u_int64_t HeapTable::get_version(Identifier table_name) {
+    std::lock_guard<std::mutex> lock(table_versions_mutex);
+    std::map<Identifier, u_int64_t>::const_iterator version = table_versions.find(table_name);
+    return version == table_versions.end() ? 0 : version->second;
+}
+
+void HeapTable::bump_version(Identifier table_name) {
+    std::lock_guard<std::mutex> lock(table_versions_mutex);
+    table_versions[table_name]++;
+}
+
 ValueDict* HeapTable::validate(const ValueDict* row) {
     ValueDict* full_row = new ValueDict();
     for (Identifier& column_name : this->column_names) {
@@ -356,6 +941,7 @@ Handle HeapTable::append(const ValueDict* row) {
     try {
         record_id = block->add(data);
     } catch (DbBlockNoRoomError& e) {
+        delete block;
         block = this->file.get_new();
         record_id = block->add(data);
     }
@@ -366,59 +952,301 @@ Handle HeapTable::append(const ValueDict* row) {
     return Handle(this->file.get_last_block_id(), record_id);
 }
 
+void HeapTable::remove(const Handle handle) {
+    SlottedPage* block = this->file.get(handle.first);
+    block->del(handle.second);
+    this->file.put(block);
+    delete block;
+}
+
+void HeapTable::index(const ValueDict* row, const Handle handle) {
+    for (std::size_t i = 0; i < this->unique_indexes.size(); i++) {
+        if (this->unique_indexes[i]->insert(this->unique_indexes[i]->get_key(row), handle, row))
+            continue;
+        for (std::size_t j = 0; j < i; j++)
+            this->unique_indexes[j]->del(this->unique_indexes[j]->get_key(row));
+        throw DbRelationError("duplicate key for unique constraint on " + this->table_name);
+    }
+}
+
+void HeapTable::build_index(BTreeIndex* index) {
+    // rows are kept only if the index stores their values
+    bool covering = !index->get_covered_columns().empty();
+    std::vector<std::pair<std::string, std::size_t>> entries;
+    Handles handles;
+    std::vector<ValueDict*> rows;
+    this->scan_records([&](const Handle& handle, const Dbt& record) {
+        ValueDict* row = unmarshal_row(&record, this->column_names, this->column_attributes);
+        entries.push_back(std::make_pair(index->get_key(row), handles.size()));
+        handles.push_back(handle);
+        if (covering)
+            rows.push_back(row);
+        else
+            delete row;
+    });
+    std::sort(entries.begin(), entries.end());
+    bool violated = false;
+    for (std::size_t i = 1; i < entries.size(); i++)
+        violated = violated || entries[i].first == entries[i - 1].first;
+    if (!violated) {
+        index->create();
+        for (auto const& entry : entries)
+            index->insert(entry.first, handles[entry.second], covering ? rows[entry.second] : nullptr);
+    }
+    for (ValueDict* row : rows)
+        delete row;
+    if (violated)
+        throw DbRelationError("existing rows violate unique constraint on " + this->table_name);
+}
+
 Dbt* HeapTable::marshal(const ValueDict* row) {
-    char* bytes = new char[DbBlock::BLOCK_SZ]; // more than we need (we insist that one row fits into DbBlock::BLOCK_SZ)
-    uint offset = 0;
-    uint col_num = 0;
-    for (auto const& column_name: this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
+    return marshal_row(row, this->column_names, this->column_attributes);
+}
+
+ValueDict* HeapTable::unmarshal(Dbt* data) {
+    return unmarshal_row(data, this->column_names, this->column_attributes);
+}
+
+// End Heap Table Functions
+
+// Begin Record Format Functions
+
+Dbt* marshal_row(const ValueDict* row, const ColumnNames& column_names, const ColumnAttributes& column_attributes) {
+    std::vector<Value> values;
+    for (const Identifier& column_name : column_names) {
         ValueDict::const_iterator column = row->find(column_name);
-        Value value = column->second;
-        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-            *(int32_t*)(bytes + offset) = value.n;
-            offset += sizeof(int32_t);
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
-            uint size = value.s.length();
-            *(u16*)(bytes + offset) = size;
-            offset += sizeof(u16);
-            std::memcpy(bytes+offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
-        } else {
-            throw DbRelationError("Only know how to marshal INT and TEXT");
-        }
+        if (column == row->end())
+            throw DbRelationError("missing column " + column_name);
+        values.push_back(column->second);
     }
-    char* right_size_bytes = new char[offset];
-    std::memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt* data = new Dbt(right_size_bytes, offset);
-    return data;
+    std::string bytes = RecordLayout(column_attributes).marshal(values);
+    char* right_size_bytes = new char[bytes.size()];
+    std::memcpy(right_size_bytes, bytes.data(), bytes.size());
+    return new Dbt(right_size_bytes, bytes.size());
 }
 
-ValueDict* HeapTable::unmarshal(Dbt* data) {
+ValueDict* unmarshal_row(const Dbt* data, const ColumnNames& column_names, const ColumnAttributes& column_attributes) {
+    std::vector<Value> values;
+    RecordLayout(column_attributes).unmarshal((const char*)data->get_data(), values);
     ValueDict* row = new ValueDict();
-    char* bytes = (char*)data->get_data();
-    uint offset = 0;
-    uint col_num = 0;
-    for (Identifier& column_name : this->column_names) {
-        ColumnAttribute ca = this->column_attributes[col_num++];
-        if (ca.get_data_type() == ColumnAttribute::DataType::INT) {
-            Value value = Value(*(u32*)(bytes + offset));
-            (*row)[column_name] = value;
-            offset += sizeof(u32);
-        } else if (ca.get_data_type() == ColumnAttribute::DataType::TEXT) {
-            u16 size = *(u16*)(bytes + offset);
-            offset += sizeof(u16);
-            Value value(std::string(bytes + offset, size));
-            (*row)[column_name] = value;
-            offset += size;
-        } else {
-            throw DbRelationError("Only know how to unmarshal INT and TEXT");
-        }
-    }
+    for (std::size_t col_num = 0; col_num < column_names.size(); col_num++)
+        (*row)[column_names[col_num]] = values[col_num];
     return row;
 }
 
-// End Heap Table Functions
+// End Record Format Functions
+
+/**
+ * Times filling a new file with blocks, then reading as many at random
+ * @return The average put and get latencies
+ */
+static std::string time_blocks(HeapFile& file, std::size_t n_blocks) {
+    typedef std::chrono::steady_clock Clock;
+    if (file.exists())
+        file.drop();
+    file.create();
+
+    Clock::time_point start = Clock::now();
+    for (std::size_t i = 1; i < n_blocks; i++) {
+        SlottedPage* block = file.get_new();
+        file.put(block);
+        delete block;
+    }
+    double put_us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / n_blocks;
+
+    std::srand(5300);
+    start = Clock::now();
+    for (std::size_t i = 0; i < n_blocks; i++)
+        delete file.get(1 + std::rand() % file.get_last_block_id());
+    double get_us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / n_blocks;
+
+    std::ostringstream report;
+    report << "put " << put_us << "us, get " << get_us << "us per block";
+    return report.str();
+}
+
+std::string benchmark_page_size(std::size_t n_blocks) {
+    std::ostringstream report;
+    for (u_int32_t page_size : {(u_int32_t)0, HeapFile::PAGE_SZ}) {
+        HeapFile file(page_size ? "_bench_pages_sized" : "_bench_pages_default", page_size);
+        std::string times = time_blocks(file, n_blocks);
+        report << "page size " << file.get_page_size() << (page_size ? "" : " (default)") << ": " << times
+               << std::endl;
+        file.drop();
+    }
+    return report.str();
+}
+
+std::string benchmark_access_methods(std::size_t n_blocks) {
+    std::ostringstream report;
+    for (HeapFile::AccessMethod access_method : {HeapFile::RECNO, HeapFile::QUEUE}) {
+        bool queue = access_method == HeapFile::QUEUE;
+        HeapFile file(queue ? "_bench_queue" : "_bench_recno", HeapFile::PAGE_SZ, access_method);
+        report << (queue ? "queue" : "recno") << ": " << time_blocks(file, n_blocks) << std::endl;
+        file.drop();
+    }
+    return report.str();
+}
+
+std::string benchmark_late_materialization(std::size_t n_rows) {
+    typedef std::chrono::steady_clock Clock;
+    // a wide table: eight INT columns, then eight TEXT columns
+    ColumnNames column_names;
+    ColumnAttributes column_attributes;
+    for (int i = 0; i < 16; i++) {
+        column_names.push_back((i < 8 ? "n" : "s") + std::to_string(i % 8));
+        column_attributes.push_back(ColumnAttribute(i < 8 ? ColumnAttribute::INT : ColumnAttribute::TEXT));
+    }
+    HeapFile stale("_bench_late");
+    if (stale.exists())
+        stale.drop();
+    HeapTable table("_bench_late", column_names, column_attributes);
+    table.create();
+    std::vector<const ValueDict*> rows;
+    for (std::size_t i = 0; i < n_rows; i++) {
+        ValueDict* row = new ValueDict();
+        for (std::size_t col_num = 0; col_num < column_names.size(); col_num++)
+            (*row)[column_names[col_num]] = col_num < 8 ? Value((int32_t)(i * 8 + col_num))
+                                                        : Value("column " + column_names[col_num] + " of row " +
+                                                                std::to_string(i));
+        rows.push_back(row);
+    }
+    delete table.insert_batch(rows);
+    for (const ValueDict* row : rows)
+        delete row;
+
+    // about 1% of rows pass; project one INT and one TEXT column
+    Predicate where(Predicate::LT, "n0", std::vector<Value>(1, Value((int32_t)(n_rows * 8 / 100))));
+    ColumnNames projected = {"n1", "s7"};
+    std::ostringstream report;
+
+    Clock::time_point start = Clock::now();
+    Handles* handles = table.select(&where);
+    ColumnBatch* early = table.project_batch(handles, &projected);
+    double early_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    report << "select + project_batch: " << early->size() << " rows in " << early_ms << "ms" << std::endl;
+    delete early;
+    delete handles;
+
+    start = Clock::now();
+    std::size_t n_decoded = 0;
+    table.scan_batches(&where, [&](const ColumnBatch& batch) { n_decoded += batch.size(); });
+    double all_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    report << "scan_batches, every column: " << n_decoded << " rows in " << all_ms << "ms" << std::endl;
+
+    start = Clock::now();
+    ColumnBatch* late = table.select_columns(&where, &projected);
+    double late_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    report << "select_columns, late materialization: " << late->size() << " rows in " << late_ms << "ms"
+           << std::endl;
+    delete late;
+    table.drop();
+    return report.str();
+}
+
+std::string benchmark_text_filters(std::size_t n_rows) {
+    typedef std::chrono::steady_clock Clock;
+    ColumnNames column_names = {"a", "b"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::TEXT)};
+    HeapFile stale("_bench_text");
+    if (stale.exists())
+        stale.drop();
+    HeapTable table("_bench_text", column_names, column_attributes);
+    table.create();
+    // 200-byte values that differ only near their ends, so every filter reads most of each value
+    std::vector<const ValueDict*> rows;
+    std::size_t n_text_bytes = 0;
+    for (std::size_t i = 0; i < n_rows; i++) {
+        ValueDict* row = new ValueDict();
+        std::string b = std::string(180, 'x') + "row " + std::to_string(i);
+        b += std::string(200 - b.size(), 'y');
+        n_text_bytes += b.size();
+        (*row)["a"] = Value((int32_t)i);
+        (*row)["b"] = Value(b);
+        rows.push_back(row);
+    }
+    delete table.insert_batch(rows);
+    for (const ValueDict* row : rows)
+        delete row;
+
+    std::string target = std::string(180, 'x') + "row 7";
+    target += std::string(200 - target.size(), 'y');
+    std::unique_ptr<Predicate> filters[] = {
+        std::unique_ptr<Predicate>(new Predicate(Predicate::EQ, "b", std::vector<Value>(1, Value(target)))),
+        std::unique_ptr<Predicate>(
+            new Predicate(Predicate::LIKE_PREFIX, "b", std::vector<Value>(1, Value(target.substr(0, 185))))),
+        std::unique_ptr<Predicate>(
+            new Predicate(Predicate::LIKE_CONTAINS, "b", std::vector<Value>(1, Value("row 7y"))))};
+    std::function<bool(const std::string&)> baselines[] = {
+        [&](const std::string& b) { return b == target; },
+        [&](const std::string& b) { return b.compare(0, 185, target, 0, 185) == 0; },
+        [](const std::string& b) { return b.find("row 7y") != std::string::npos; }};
+
+    std::function<bool(const char*, std::size_t)> kernels[] = {
+        [&](const char* text, std::size_t size) { return text_equals(text, size, target.data(), target.size()); },
+        [&](const char* text, std::size_t size) { return text_starts_with(text, size, target.data(), 185); },
+        [](const char* text, std::size_t size) { return text_contains(text, size, "row 7y", 6); }};
+
+    // copy the records out of the table once, end to end as in a block, so the in-memory timings
+    // measure only the comparisons
+    u16 offset = RecordLayout(column_attributes).get_offset(1);
+    std::string records;
+    std::vector<std::size_t> starts;
+    table.scan_records([&](const Handle&, const Dbt& record) {
+        starts.push_back(records.size());
+        records.append((const char*)record.get_data(), record.get_size());
+    });
+
+    // reference: one pass summing the records eight bytes at a time
+    Clock::time_point start = Clock::now();
+    u_int64_t checksum = 0;
+    for (std::size_t i = 0; i + sizeof(checksum) <= records.size(); i += sizeof(checksum)) {
+        u_int64_t word;
+        std::memcpy(&word, records.data() + i, sizeof(word));
+        checksum += word;
+    }
+    double sum_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    std::ostringstream report;
+    report << "text kernels: " << text_kernel_isa() << ", " << n_text_bytes / 1000000.0 << "MB of TEXT" << std::endl
+           << "summing the records (" << checksum % 10 << "): " << sum_ms << "ms, "
+           << records.size() / sum_ms / 1000000 << "GB/s" << std::endl;
+    for (int i = 0; i < 3; i++) {
+        start = Clock::now();
+        Handles* handles = table.select(filters[i].get());
+        double select_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        start = Clock::now();
+        std::size_t n_kernel = 0;
+        for (std::size_t record_start : starts) {
+            u16 size;
+            const char* text = RecordLayout::get_text(records.data() + record_start, offset, size);
+            n_kernel += kernels[i](text, size);
+        }
+        double kernel_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        // the same test, copying each value into a std::string first
+        start = Clock::now();
+        std::size_t n_baseline = 0;
+        for (std::size_t record_start : starts) {
+            u16 size;
+            const char* text = RecordLayout::get_text(records.data() + record_start, offset, size);
+            n_baseline += baselines[i](std::string(text, size));
+        }
+        double baseline_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        report << filters[i]->to_string().substr(0, 40) << "...: " << handles->size() << " rows, select() "
+               << select_ms << "ms" << std::endl
+               << "  in place: " << n_kernel << " rows in " << kernel_ms << "ms, "
+               << n_text_bytes / kernel_ms / 1000000 << "GB/s" << std::endl
+               << "  std::string: " << n_baseline << " rows in " << baseline_ms << "ms, "
+               << n_text_bytes / baseline_ms / 1000000 << "GB/s" << std::endl;
+        delete handles;
+    }
+    table.drop();
+    return report.str();
+}
 
 bool test_heap_storage() {
     // Set table column names and attributes
@@ -438,8 +1266,9 @@ bool test_heap_storage() {
     table1.drop();  // drop makes the object unusable because of BerkeleyDB restriction -- maybe want to fix this some day
     std::cout << "drop ok" << std::endl;
 
-    // Create table if not exists
+    // Create table if not exists, with a primary key covering both columns
     HeapTable table("_test_data_cpp", column_names, column_attributes);
+    table.add_unique(ColumnNames(1, "a"), true, ColumnNames(1, "b"));
     table.create_if_not_exists();
     std::cout << "create_if_not_exists ok" << std::endl;
 
@@ -450,31 +1279,286 @@ bool test_heap_storage() {
     table.insert(&row);
     std::cout << "insert ok" << std::endl;
 
+    // Duplicate primary keys are rejected, singly and in batches
+    bool unique_ok = false;
+    try {
+        table.insert(&row);
+    } catch (DbRelationError& e) {
+        unique_ok = true;
+    }
+    ValueDict row2;
+    row2["a"] = Value(13);
+    row2["b"] = Value("World!");
+    std::vector<const ValueDict*> batch = {&row2, &row2};
+    try {
+        delete table.insert_batch(batch);
+        unique_ok = false;
+    } catch (DbRelationError& e) {}
+    batch.pop_back();
+    Handles* batch_handles = table.insert_batch(batch);
+    std::cout << "unique ok" << std::endl;
+
     // Select and project rows from table
     Handles* handles = table.select();
     std::cout << "select ok " << handles->size() << std::endl;
     ValueDict* result = table.project((*handles)[0]);
     Value value_a = (*result)["a"], value_b = (*result)["b"];
     std::cout << "project ok" << std::endl;
-    
-    // Update and delete (expect exceptions thrown)
-    try {
-        table.update((*handles)[0], nullptr);
-    } catch (DbRelationError &e) {
-        std::cout << "update ok" << std::endl;
-    }
+
+    // Update: a longer value, then a key taken by another row (rejected)
+    ValueDict new_values;
+    new_values["b"] = Value("Hello again!");
+    table.update((*handles)[0], &new_values);
+    ValueDict* updated = table.project((*handles)[0]);
+    bool update_ok = (*updated)["b"].s == "Hello again!";
+    delete updated;
+    new_values["a"] = Value(13);
     try {
-        table.del((*handles)[0]);
-    } catch (DbRelationError &e) {
-        std::cout << "delete ok" << std::endl;
+        table.update((*handles)[0], &new_values);
+        update_ok = false;
+    } catch (DbRelationError& e) {}
+    std::cout << "update ok" << std::endl;
+
+    // A row that outgrows its block moves to one with room, taking its index entries along
+    HeapTable relocating("_test_relocate_cpp", column_names, column_attributes);
+    relocating.add_unique(ColumnNames(1, "a"), true, ColumnNames(1, "b"));
+    relocating.create_if_not_exists();
+    ValueDict filler;
+    Handle first;
+    for (int32_t a = 0; a < 30; a++) {  // about 3.3KB of the first block
+        filler["a"] = Value(a);
+        filler["b"] = Value(std::string(100, 'x'));
+        Handle inserted = relocating.insert(&filler);
+        if (a == 0)
+            first = inserted;
     }
+    ValueDict grown;
+    grown["b"] = Value(std::string(2000, 'y'));
+    relocating.update(first, &grown);
+    ValueDict zero;
+    zero["a"] = Value(0);
+    Handle relocated_handle;
+    bool relocate_ok =
+        relocating.get_index("a")->lookup(relocating.get_index("a")->get_key(&zero), relocated_handle) &&
+        relocated_handle.first != first.first;
+    ValueDict* relocated = relocate_ok ? relocating.project(relocated_handle) : nullptr;
+    relocate_ok = relocated && (*relocated)["b"].s == std::string(2000, 'y');
+    delete relocated;
+    Handles* relocated_rows = relocating.select();
+    relocate_ok = relocate_ok && relocated_rows->size() == 30;
+    delete relocated_rows;
+    relocating.drop();
+    std::cout << "update relocate ok" << std::endl;
+
+    // Select with equality and range predicates
+    ValueDict where;
+    where["b"] = Value("World!");
+    Handles* selected = table.select(&where);
+    bool where_ok = selected->size() == 1 && (*selected)[0] == (*batch_handles)[0];
+    delete selected;
+    Predicate range(Predicate::AND, new Predicate(Predicate::GT, "a", std::vector<Value>(1, Value(12))),
+                    new Predicate(Predicate::LIKE_PREFIX, "b", std::vector<Value>(1, Value("Wor"))));
+    selected = table.select(&range);
+    where_ok = where_ok && selected->size() == 1;
+    delete selected;
+    Predicate indexed(Predicate::BETWEEN, "a", std::vector<Value>{Value(12), Value(13)});
+    selected = table.select(&indexed);  // primary key bounds: bitmap heap scan
+    where_ok = where_ok && selected->size() == 2 && (*selected)[0] == (*handles)[0];
+    delete selected;
+    std::cout << "select where ok" << std::endl;
+
+    // Project many rows at once, a subset of columns
+    ColumnNames only_b(1, "b");
+    Handles* all = table.select();
+    ColumnBatch* projected = table.project_batch(all, &only_b);
+    bool batch_ok = projected->size() == 2 && projected->columns.size() == 1 &&
+                    projected->get_value(0, 0).s == "Hello again!" && projected->get_value(1, 0).s == "World!";
+    delete projected;
+    delete all;
+    std::cout << "project_batch ok" << std::endl;
+
+    // Answer from the covering primary key index alone (sees the update)
+    Predicate above(Predicate::GE, "a", std::vector<Value>(1, Value(12)));
+    projected = table.select_columns(&above, &only_b);
+    batch_ok = batch_ok && projected->size() == 2 && projected->get_value(0, 0).s == "Hello again!" &&
+               projected->handles[1] == (*batch_handles)[0];
+    delete projected;
+    std::cout << "index-only select ok" << std::endl;
+
+    // Delete frees the key for reuse
+    table.del((*batch_handles)[0]);
+    table.insert(&row2);
+    Handles* remaining = table.select();
+    bool delete_ok = remaining->size() == 2;
+    delete remaining;
+    std::cout << "delete ok" << std::endl;
 
     // Drop table
     table.drop();
+
+    // Migrate a file created with Berkeley DB's default page size
+    HeapFile legacy("_test_migrate_cpp", 0);
+    legacy.create();
+    SlottedPage* page = legacy.get_new();
+    Dbt hello((void*)"hello", 5);
+    page->add(&hello);
+    legacy.put(page);
+    delete page;
+    legacy.close();
+    bool migrate_ok = HeapFile("_test_migrate_cpp").migrate() && !HeapFile("_test_migrate_cpp").migrate();
+    HeapFile migrated("_test_migrate_cpp");
+    migrated.open();
+    page = migrated.get(2);
+    Dbt* moved = page->get(1);
+    migrate_ok = migrate_ok && migrated.get_page_size() == HeapFile::PAGE_SZ && migrated.get_last_block_id() == 2 &&
+                 std::string((char*)moved->get_data(), moved->get_size()) == "hello";
+    delete moved;
+    delete page;
+    migrated.drop();
+    std::cout << "migrate ok" << std::endl;
+
+    // Store a table in a Queue file, which must still be one after reopening
+    HeapTable queued("_test_queue_cpp", column_names, column_attributes, HeapFile::QUEUE);
+    queued.create();
+    for (int i = 0; i < 1000; i++) {
+        ValueDict queued_row;
+        queued_row["a"] = Value(i);
+        queued_row["b"] = Value(std::string(100, 'q'));
+        queued.insert(&queued_row);
+    }
+    queued.close();
+    HeapTable reopened("_test_queue_cpp", column_names, column_attributes);
+    reopened.open();
+    Handles* queued_handles = reopened.select();
+    ValueDict* queued_last = reopened.project(queued_handles->back());
+    bool queue_ok = queued_handles->size() == 1000 && (*queued_last)["a"].n == 999;
+    delete queued_last;
+    delete queued_handles;
+    std::cout << "queue ok" << std::endl;
+
+    // An asynchronous scan visits the same records, in the same order, as a synchronous one
+    typedef std::vector<std::pair<Handle, std::string>> Visited;
+    Visited scanned, scanned_async;
+    reopened.scan_records([&](const Handle& handle, const Dbt& record) {
+        scanned.push_back(std::make_pair(handle, std::string((const char*)record.get_data(), record.get_size())));
+    });
+    {
+        IOScheduler scheduler(2);
+        std::unique_ptr<AsyncScan> scan(reopened.scan_async(scheduler, [&](const Handle& handle, const Dbt& record) {
+            scanned_async.push_back(std::make_pair(handle,
+                                                   std::string((const char*)record.get_data(), record.get_size())));
+        }));
+        scan->wait();
+    }
+    bool async_ok = scanned.size() == 1000 && scanned.front().first.first != scanned.back().first.first &&
+                    scanned_async == scanned;
+    // an exception from the visitor stops the scan and comes back out of wait()
+    {
+        IOScheduler scheduler(2);
+        std::size_t visited = 0;
+        std::unique_ptr<AsyncScan> scan(reopened.scan_async(scheduler, [&](const Handle& handle, const Dbt& record) {
+            if (++visited == 5)
+                throw DbRelationError("visitor failed");
+        }));
+        try {
+            scan->wait();
+            async_ok = false;
+        } catch (DbRelationError& e) {
+            async_ok = async_ok && std::string(e.what()) == "visitor failed" && visited < scanned.size();
+        }
+    }
+    std::cout << "async scan ok" << std::endl;
+
+    // With no index to use, select_columns decodes only the projected columns of matching rows
+    Predicate top_ten(Predicate::GE, "a", std::vector<Value>(1, Value(990)));
+    ColumnNames b_only(1, "b");
+    ColumnBatch* late = reopened.select_columns(&top_ten, &b_only);
+    bool late_ok = late->size() == 10 && late->columns.size() == 1 &&
+                   late->columns[0].texts[9] == std::string(100, 'q');
+    delete late;
+    std::size_t n_scanned = 0;
+    reopened.scan_batches(&top_ten, [&](const ColumnBatch& batch) { n_scanned += batch.size(); }, &b_only);
+    late_ok = late_ok && n_scanned == 10;
+    std::cout << "late materialization ok" << std::endl;
+
+    // An AND moves its most selective conjunct first once it has seen enough rows
+    Predicate* first_ten = new Predicate(Predicate::LT, "a", std::vector<Value>(1, Value(10)));
+    Predicate* all_q = new Predicate(Predicate::EQ, "b", std::vector<Value>(1, Value(std::string(100, 'q'))));
+    Predicate both(Predicate::AND, all_q, first_ten);
+    std::string explained = reopened.explain_analyze(&both);
+    bool adaptive_ok = explained.find("Seq Scan on _test_queue_cpp (rows 10 of 1000 scanned") == 0 &&
+                       explained.find("Filter: (b = '") != std::string::npos;
+    reopened.drop();
+    FilterProfile profile;
+    RecordFilter filter = both.compile(column_names, column_attributes, &profile);
+    std::size_t n_passed = 0;
+    for (int i = 0; i < 4096; i++) {
+        ValueDict adaptive_row;
+        adaptive_row["a"] = Value(i);
+        adaptive_row["b"] = Value(std::string(100, 'q'));
+        Dbt* adaptive_record = marshal_row(&adaptive_row, column_names, column_attributes);
+        n_passed += filter((const char*)adaptive_record->get_data());
+        delete[] (char*)adaptive_record->get_data();
+        delete adaptive_record;
+    }
+    std::string observed = profile.report();
+    adaptive_ok = adaptive_ok && n_passed == 10 && observed.find("1. a < 10 (passes 0.0%") != std::string::npos &&
+                  observed.find("reordered after") != std::string::npos;
+    std::cout << "adaptive predicate ok" << std::endl;
+
+    // INT columns after a TEXT column are still at fixed, aligned offsets
+    ColumnNames mixed_names = {"s", "n", "t", "m"};
+    ColumnAttributes mixed_attributes = {ColumnAttribute(ColumnAttribute::TEXT), ColumnAttribute(ColumnAttribute::INT),
+                                         ColumnAttribute(ColumnAttribute::TEXT), ColumnAttribute(ColumnAttribute::INT)};
+    ValueDict mixed;
+    mixed["s"] = Value("odd");
+    mixed["n"] = Value(-7);
+    mixed["t"] = Value("");
+    mixed["m"] = Value(5300);
+    Dbt* mixed_record = marshal_row(&mixed, mixed_names, mixed_attributes);
+    ValueDict* mixed_row = unmarshal_row(mixed_record, mixed_names, mixed_attributes);
+    RecordLayout layout(mixed_attributes);
+    Predicate m_is(Predicate::EQ, "m", std::vector<Value>(1, Value(5300)));
+    bool layout_ok = mixed_record->get_size() % RecordLayout::ALIGNMENT == 0 && layout.get_offset(3) == 4 &&
+                     (*mixed_row)["s"].s == "odd" && (*mixed_row)["n"].n == -7 && (*mixed_row)["t"].s.empty() &&
+                     (*mixed_row)["m"].n == 5300 &&
+                     m_is.compile(mixed_names, mixed_attributes)((const char*)mixed_record->get_data());
+    delete mixed_row;
+    delete[] (char*)mixed_record->get_data();
+    delete mixed_record;
+    std::cout << "layout ok" << std::endl;
+
+    // Text kernels agree with std::string at every alignment, across lane boundaries
+    bool text_ok = true;
+    std::string haystack;
+    for (int i = 0; i < 100; i++)
+        haystack += (char)('a' + i * 7 % 26);
+    for (std::size_t start = 0; start < 40; start++)
+        for (std::size_t length = 0; length < 50 && start + length <= haystack.size(); length += 3) {
+            std::string text = haystack.substr(start, length), needle = haystack.substr(start / 2 + 5, start % 6);
+            text_ok = text_ok && text_contains(text.data(), text.size(), needle.data(), needle.size()) ==
+                                     (text.find(needle) != std::string::npos) &&
+                      text_equals(text.data(), text.size(), haystack.data() + start, length) &&
+                      text_starts_with(haystack.data(), haystack.size(), text.data(), text.size()) ==
+                          !haystack.compare(0, length, text);
+        }
+    Predicate infix(Predicate::LIKE_CONTAINS, "b", std::vector<Value>(1, Value("o W")));
+    Predicate not_infix(Predicate::LIKE_CONTAINS, "b", std::vector<Value>(1, Value("oW")));
+    ValueDict greeting;
+    greeting["a"] = Value(1);
+    greeting["b"] = Value("Hello World!");
+    Dbt* hello_record = marshal_row(&greeting, column_names, column_attributes);
+    text_ok = text_ok && infix.compile(column_names, column_attributes)((const char*)hello_record->get_data()) &&
+              !not_infix.compile(column_names, column_attributes)((const char*)hello_record->get_data()) &&
+              infix.to_string() == "b LIKE '%o W%'";
+    delete[] (char*)hello_record->get_data();
+    delete hello_record;
+    std::cout << "text kernels ok" << std::endl;
     
     // Clean up
     delete result;
     delete handles;
+    delete batch_handles;
 
     // Test projection results
     if (value_a.n != 12)
@@ -482,5 +1566,6 @@ bool test_heap_storage() {
     if (value_b.s != "Hello!")
 		return false;
 
-    return true;
+    return unique_ok && update_ok && relocate_ok && where_ok && batch_ok && delete_ok && migrate_ok && queue_ok &&
+           async_ok && late_ok && adaptive_ok && layout_ok && text_ok;
 }
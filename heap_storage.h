@@ -2,6 +2,7 @@
  * @file heap_storage.h - Implementation of storage_engine with a heap file structure.
  * SlottedPage: DbBlock
  * HeapFile: DbFile
+ * HandleBitmap
  * HeapTable: DbRelation
  *
  * @author Kevin Lundeen
@@ -9,9 +10,45 @@
  */
 #pragma once
 
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
 #include "db_cxx.h"
+#include "predicate.h"
 #include "storage_engine.h"
 
+/**
+ * Callback for visiting marshaled records in place: the handle of the record
+ * and its bytes, which are only valid for the duration of the call.
+ */
+using RecordVisitor = std::function<void(const Handle&, const Dbt&)>;
+
+class IOScheduler;
+class AsyncScan;
+class SlottedPage;
+class BTreeIndex;
+class ColumnBatch;
+class ScanKernel;
+
+/**
+ * Callback for visiting rows decoded column by column (see scan_kernels.h),
+ * which are only valid for the duration of the call.
+ */
+using BatchVisitor = std::function<void(const ColumnBatch&)>;
+
+/**
+ * Callback for visiting blocks read in bulk; the block is a view into a
+ * shared buffer, only valid for the duration of the call.
+ */
+using BlockVisitor = std::function<void(SlottedPage*)>;
+
+/**
+ * The record IDs of the records of one block that passed a filter, in order
+ * (a selection vector)
+ */
+using SelectionVector = std::vector<RecordID>;
+
 /**
  * @class SlottedPage - heap file implementation of DbBlock.
  *
@@ -28,11 +65,17 @@
  */
 class SlottedPage : public DbBlock {
 public:
+    /**
+     * @param block The block's bytes; if Berkeley DB allocated them (DB_DBT_MALLOC),
+     *              the page takes ownership and frees them
+     * @param block_id The ID of the block
+     * @param is_new True to initialize the block as empty
+     */
     SlottedPage(Dbt& block, BlockID block_id, bool is_new = false);
 
     // Big 5 - we only need the destructor, copy-ctor, move-ctor, and op= are unnecessary
     // but we delete them explicitly just to make sure we don't use them accidentally
-    virtual ~SlottedPage() {}
+    virtual ~SlottedPage();
 
     SlottedPage(const SlottedPage& other) = delete;
 
@@ -56,6 +99,14 @@ public:
      */
     virtual Dbt* get(RecordID record_id);
 
+    /**
+     * Retrieves a record from a slotted page without allocating
+     * @param record_id The ID of the record to retrieve
+     * @param record Set to point at the record's bytes within the block
+     * @return False if the record has been deleted
+     */
+    virtual bool get(RecordID record_id, Dbt& record);
+
     /**
      * Puts a new record in the place of an existing record in a slotted page
      * @param record_id The ID of the record to replace
@@ -136,10 +187,38 @@ protected:
  * of our database blocks for each Berkeley DB record in the RecNo file.
  * In this way we are using Berkeley DB for buffer management and file
  * management. Uses SlottedPage for storing records within blocks.
+ *
+ * Berkeley DB moves any item larger than about a quarter of a page to
+ * overflow pages, which costs an extra page read and write per access. Files
+ * are therefore created with PAGE_SZ pages, large enough to hold each block
+ * on a regular page; migrate() rewrites files created before that.
+ *
+ * Since every block is BLOCK_SZ bytes, a file may instead be created as a
+ * Berkeley DB Queue, which finds a block by its offset rather than by walking
+ * a RecNo tree. The access method is chosen when the file is created and read
+ * back from the file when it is opened.
  */
 class HeapFile : public DbFile {
 public:
-    HeapFile(std::string name) : DbFile(name), dbfilename(""), last(0), closed(true), db(_DB_ENV, 0) {}
+    static const u_int32_t BULK_BUFFER_SZ = 64 * DbBlock::BLOCK_SZ;  // buffer for get_many
+    static const u_int32_t PAGE_SZ = 8 * DbBlock::BLOCK_SZ;          // Berkeley DB page size
+
+    /**
+     * Berkeley DB access methods a heap file can be stored in
+     */
+    enum AccessMethod {
+        RECNO,
+        QUEUE
+    };
+
+    /**
+     * @param name The name of the file
+     * @param page_size The Berkeley DB page size the file is created with (0 for Berkeley DB's default)
+     * @param access_method The Berkeley DB access method the file is created with
+     */
+    HeapFile(std::string name, u_int32_t page_size = PAGE_SZ, AccessMethod access_method = RECNO)
+        : DbFile(name), dbfilename(""), last(0), page_size(page_size), access_method(access_method), closed(true),
+          db(_DB_ENV, 0) {}
 
     virtual ~HeapFile() {}
 
@@ -184,6 +263,15 @@ public:
      */
     virtual SlottedPage* get(BlockID block_id);
 
+    /**
+     * Reads a run of blocks with a bulk cursor, which returns many blocks per
+     * call into one buffer, rather than one get per block
+     * @param first The ID of the first block to read
+     * @param last The ID of the last block to read
+     * @param visitor Called for each block, in block ID order
+     */
+    virtual void get_many(BlockID first, BlockID last, const BlockVisitor& visitor);
+
     /**
      * Writes a block to the database file
      * @param block The block to write to the database file
@@ -200,9 +288,33 @@ public:
      */
     virtual u_int32_t get_last_block_id() { return last; }
 
+    /**
+     * Retrieves the Berkeley DB page size of the open file
+     */
+    virtual u_int32_t get_page_size();
+
+    /**
+     * Retrieves the Berkeley DB access method of the file (as read from the file once it is open)
+     */
+    virtual AccessMethod get_access_method() const { return this->access_method; }
+
+    /**
+     * Rewrites the file with PAGE_SZ pages if it has smaller ones, keeping
+     * block IDs (so handles stay valid). Nothing else may use the file meanwhile.
+     * @return True if the file was rewritten
+     */
+    virtual bool migrate();
+
+    /**
+     * Checks whether the physical database file exists
+     */
+    virtual bool exists(void);
+
 protected:
     std::string dbfilename;
     u_int32_t last;
+    u_int32_t page_size;
+    AccessMethod access_method;
     bool closed;
     Db db;
 
@@ -213,14 +325,72 @@ protected:
     virtual void db_open(uint flags = 0);
 };
 
+/**
+ * @class HandleBitmap - a set of row handles kept as one bitmap of record IDs per block
+ *
+ * Handles are added in any order (e.g. key order from an index) and read back
+ * block by block in BlockID order, so fetching them reads each block once and
+ * in file order.
+ */
+class HandleBitmap {
+public:
+    HandleBitmap() : blocks(), count(0) {}
+
+    virtual ~HandleBitmap() {}
+
+    HandleBitmap(const HandleBitmap& other) = delete;
+
+    HandleBitmap(HandleBitmap&& temp) = delete;
+
+    HandleBitmap& operator=(const HandleBitmap& other) = delete;
+
+    HandleBitmap& operator=(HandleBitmap&& temp) = delete;
+
+    /**
+     * Flags a handle (flagging one twice has no effect)
+     * @param handle The handle to flag
+     */
+    virtual void add(const Handle& handle);
+
+    /**
+     * Checks whether a handle is flagged
+     * @param handle The handle
+     */
+    virtual bool contains(const Handle& handle) const;
+
+    /**
+     * Retrieves the number of flagged handles
+     */
+    virtual std::size_t size() const { return this->count; }
+
+    /**
+     * Retrieves the flagged record IDs of each block, indexed by record ID, in BlockID order
+     */
+    virtual const std::map<BlockID, std::vector<bool>>& get_blocks() const { return this->blocks; }
+
+protected:
+    std::map<BlockID, std::vector<bool>> blocks;
+    std::size_t count;
+};
+
 /**
  * @class HeapTable - Heap storage engine (implementation of DbRelation)
+ *
+ * PRIMARY KEY and UNIQUE constraints are each backed by a BTreeIndex, so a
+ * violation is caught by probing the index rather than scanning the table.
  */
 class HeapTable : public DbRelation {
 public:
-    HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes);
+    /**
+     * @param table_name The name of the table
+     * @param column_names The table's column names
+     * @param column_attributes The table's column attributes
+     * @param access_method The Berkeley DB access method a new heap file is created with
+     */
+    HeapTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+              HeapFile::AccessMethod access_method = HeapFile::RECNO);
 
-    virtual ~HeapTable() {}
+    virtual ~HeapTable();
 
     HeapTable(const HeapTable& other) = delete;
 
@@ -255,17 +425,50 @@ public:
      */
     virtual void close();
 
+    /**
+     * Declares a PRIMARY KEY or UNIQUE constraint. Must be called before the
+     * table is created or opened; the constraint's index is built from the
+     * existing rows if the table already exists without it.
+     * @param key_columns The columns that must be unique together
+     * @param primary_key True for the table's PRIMARY KEY
+     * @param include_columns Columns whose values the index also stores, making
+     *        it a covering index (none by default)
+     */
+    virtual void add_unique(const ColumnNames& key_columns, bool primary_key = false,
+                            const ColumnNames& include_columns = ColumnNames());
+
+    /**
+     * Retrieves the PRIMARY KEY columns (empty if there is none)
+     */
+    virtual const ColumnNames& get_primary_key() const { return this->primary_key; }
+
     /**
      * Inserts a data tuple into the table
      * @param row The data tuple to insert
      * @return A handle locating the block ID and record ID of the inserted tuple
+     * @throws DbRelationError if the row violates a uniqueness constraint
      */
     virtual Handle insert(const ValueDict* row);
 
     /**
-     * Updates a record to a database
+     * Inserts many data tuples at once. Uniqueness is checked for the whole
+     * batch before anything is written: each constraint's keys are sorted and
+     * checked against the index in one pass over its leaves.
+     * @param rows The data tuples to insert
+     * @return Handles of the inserted tuples, in order (freed by caller)
+     * @throws DbRelationError if any row violates a uniqueness constraint
+     *                         (no rows are inserted)
+     */
+    virtual Handles* insert_batch(const std::vector<const ValueDict*>& rows);
+
+    /**
+     * Updates a record to a database. A record that no longer fits in its block
+     * moves to one with room: its index entries follow it, and the old handle
+     * then reads as deleted.
      * @param handle The location (block ID, record ID) of the record
      * @param new_values The new fields to replace the existing fields with
+     * @throws DbRelationError if the new values violate a uniqueness constraint
+     *                         (the record is left unchanged)
      */
     virtual void update(const Handle handle, const ValueDict* new_values);
 
@@ -287,6 +490,26 @@ public:
      */
     virtual Handles* select(const ValueDict* where);
 
+    /**
+     * Selects data tuples (rows) from the table matching a predicate, which is
+     * compiled once and tested against each record without unmarshaling it.
+     * If the predicate bounds a column with a single-column index, only the
+     * rows the index finds within the bounds are fetched, by a bitmap heap scan.
+     * @param where The predicate (nullptr for all rows)
+     * @return Handles locating the block IDs and record IDs of the matching rows
+     */
+    virtual Handles* select(const Predicate* where);
+
+    /**
+     * Runs a select and reports how it ran (EXPLAIN ANALYZE): the access path,
+     * the rows scanned and matched, the time taken, and for each AND in the
+     * predicate, the pass rates and costs its conjuncts showed and how it
+     * reordered them
+     * @param where The predicate (nullptr for all rows)
+     * @return The report, one line per item
+     */
+    virtual std::string explain_analyze(const Predicate* where);
+
     /**
      * Return a sequence of all values for handle (SELECT *).
      * @param handle Location of row to get values from
@@ -302,8 +525,98 @@ public:
      */
     virtual ValueDict* project(Handle handle, const ColumnNames* column_names);
 
+    /**
+     * Projects many rows at once. Handles are sorted by block so each block is
+     * fetched once, and rows are decoded straight into columns.
+     * @param handles Locations of the rows
+     * @param column_names The columns to project (nullptr for all)
+     * @return The rows (freed by caller), in (block ID, record ID) order; the
+     *         batch's handles give the row each position came from
+     * @throws DbRelationError if a column is unknown or a handle has no row
+     */
+    virtual ColumnBatch* project_batch(const Handles* handles, const ColumnNames* column_names = nullptr);
+
+    /**
+     * Selects and projects the rows matching a predicate. If a covering index
+     * stores every column read (projected or tested), the query is answered
+     * from the index alone, in key order. If another index bounds the
+     * predicate, by select() and project_batch(). Otherwise by a scan that
+     * materializes rows late (see scan_batches()).
+     * @param where The predicate (nullptr for all rows)
+     * @param column_names The columns to project (nullptr for all)
+     * @return The rows (freed by caller); the batch's handles give the row
+     *         each position came from
+     */
+    virtual ColumnBatch* select_columns(const Predicate* where, const ColumnNames* column_names = nullptr);
+
+    /**
+     * Visits the marshaled bytes of every record in the table, one block at a
+     * time, without unmarshaling them
+     * @param visitor Called for each record in (block ID, record ID) order
+     */
+    virtual void scan_records(const RecordVisitor& visitor);
+
+    /**
+     * Visits the marshaled bytes of the records flagged in a bitmap, reading
+     * each of their blocks once, in BlockID order (a bitmap heap scan)
+     * @param bitmap The handles of the records to visit
+     * @param visitor Called for each flagged record still present, in (block ID, record ID) order
+     */
+    virtual void scan_bitmap(const HandleBitmap& bitmap, const RecordVisitor& visitor);
+
+    /**
+     * Starts a scan whose block reads run on the scheduler's I/O threads, so the
+     * caller is free to start other scans meanwhile. The table must not be used
+     * otherwise until the scan is done.
+     * @param scheduler The scheduler to issue block reads through
+     * @param visitor Called for each record, on an I/O thread, in (block ID, record ID) order
+     * @return The running scan, to wait on (freed by caller)
+     */
+    virtual AsyncScan* scan_async(IOScheduler& scheduler, const RecordVisitor& visitor);
+
+    /**
+     * Decodes the rows matching a predicate column by column, a block at a
+     * time, with the scan kernel chosen for the table's schema when it opened.
+     * When only some columns are wanted, rows are materialized late instead:
+     * each block's records are tested in place first, reading only the
+     * predicate's columns, and just the wanted columns of the survivors are
+     * decoded.
+     * @param where The predicate (nullptr for all rows)
+     * @param visitor Called with each block's matching rows, in block ID order
+     * @param column_names The columns to decode (nullptr for all)
+     * @throws DbRelationError if a column is unknown
+     */
+    virtual void scan_batches(const Predicate* where, const BatchVisitor& visitor,
+                              const ColumnNames* column_names = nullptr);
+
+    /**
+     * Finds the uniqueness index whose only key column is a given column
+     * @param column_name The column
+     * @return The index, or nullptr if the column has none
+     */
+    virtual BTreeIndex* get_index(const Identifier& column_name);
+
+    /**
+     * Retrieves the modification counter of a table. The counter moves on every
+     * insert, update, delete, create, and drop so cached results can be checked
+     * for staleness.
+     * @param table_name The name of the table
+     * @return The current modification counter of the table
+     */
+    static u_int64_t get_version(Identifier table_name);
+
+    /**
+     * Advances the modification counter of a table. Every storage engine calls
+     * this when it modifies a table.
+     * @param table_name The name of the table that changed
+     */
+    static void bump_version(Identifier table_name);
+
 protected:
     HeapFile file;
+    ColumnNames primary_key;
+    std::vector<BTreeIndex*> unique_indexes;  // one per PRIMARY KEY/UNIQUE constraint
+    ScanKernel* kernel;                       // decodes blocks for this schema
 
     /**
      * Checks if a row is valid to the table
@@ -319,6 +632,64 @@ protected:
      */
     virtual Handle append(const ValueDict* row);
 
+    /**
+     * Removes a record from its block, leaving indexes alone
+     * @param handle The location (block ID, record ID) of the record
+     */
+    virtual void remove(const Handle handle);
+
+    /**
+     * Adds a row to every uniqueness index
+     * @param row The full row
+     * @param handle The location of the row
+     * @throws DbRelationError if a key is taken (entries added so far are undone)
+     */
+    virtual void index(const ValueDict* row, const Handle handle);
+
+    /**
+     * Creates a uniqueness index and fills it from the rows already in the table
+     * @param index The index to build
+     * @throws DbRelationError if existing rows violate the constraint
+     */
+    virtual void build_index(BTreeIndex* index);
+
+    /**
+     * Picks a single-column uniqueness index on a column the predicate bounds
+     * @param where The predicate
+     * @param low Set to the column's lower bound (inclusive), or nullptr
+     * @param high Set to the column's upper bound (inclusive), or nullptr
+     * @return The index, or nullptr if the predicate bounds no indexed column
+     */
+    virtual BTreeIndex* choose_index(const Predicate* where, const Value*& low, const Value*& high);
+
+    /**
+     * Visits the records a predicate could match, without testing them: the
+     * ones an index finds within the predicate's bounds on its column (see
+     * choose_index()) in block order, or else every record
+     * @param where The predicate
+     * @param visitor Called for each record, in (block ID, record ID) order
+     * @return The index used, or nullptr if every record was visited
+     */
+    virtual BTreeIndex* scan_candidates(const Predicate* where, const RecordVisitor& visitor);
+
+    /**
+     * Picks a covering index storing all of some columns, preferring one whose
+     * key a predicate bounds
+     * @param column_names The columns needed
+     * @param where The predicate (nullptr for none)
+     * @return The index, or nullptr if none covers the columns
+     */
+    virtual BTreeIndex* covering_index(const ColumnNames& column_names, const Predicate* where);
+
+    /**
+     * Scans the table, testing each block's records against a predicate in
+     * place before anything is decoded
+     * @param where The predicate (nullptr for all rows)
+     * @param visitor Called with each block and the record IDs of its matching records
+     */
+    virtual void scan_selected(const Predicate* where,
+                               const std::function<void(SlottedPage*, const SelectionVector&)>& visitor);
+
     /**
      * Return the bits to go into the file. Caller responsible for freeing the
      * returned Dbt and its enclosed ret->get_data().
@@ -331,6 +702,59 @@ protected:
     virtual ValueDict* unmarshal(Dbt* data);
 };
 
+/**
+ * Marshals a row into the record format shared by the storage engines (see RecordLayout)
+ * @param row The row, containing every column
+ * @param column_names The table's column names, in column order
+ * @param column_attributes The table's column attributes, in column order
+ * @return The record bytes (caller frees the Dbt and its enclosed get_data())
+ */
+Dbt* marshal_row(const ValueDict* row, const ColumnNames& column_names, const ColumnAttributes& column_attributes);
+
+/**
+ * Unmarshals a record produced by marshal_row
+ * @param data The record bytes
+ * @param column_names The table's column names, in column order
+ * @param column_attributes The table's column attributes, in column order
+ * @return The row, keyed by column name (freed by caller)
+ */
+ValueDict* unmarshal_row(const Dbt* data, const ColumnNames& column_names, const ColumnAttributes& column_attributes);
+
+/**
+ * Times block puts and random block gets on a file with Berkeley DB's default
+ * page size and on one with HeapFile::PAGE_SZ pages
+ * @param n_blocks The number of blocks to write and read in each file
+ * @return A report of the average latencies
+ */
+std::string benchmark_page_size(std::size_t n_blocks);
+
+/**
+ * Times appending blocks and random block gets on a RecNo file and on a
+ * Queue file, both with HeapFile::PAGE_SZ pages
+ * @param n_blocks The number of blocks to write and read in each file
+ * @return A report of the average latencies
+ */
+std::string benchmark_access_methods(std::size_t n_blocks);
+
+/**
+ * Times a query selecting about 1% of the rows of a wide table and projecting
+ * two of its columns, first by select() and project_batch(), then with every
+ * column decoded by scan_batches(), then by select_columns(), which decodes
+ * the projected columns of matching rows only
+ * @param n_rows The number of rows in the table
+ * @return A report of the timings
+ */
+std::string benchmark_late_materialization(std::size_t n_rows);
+
+/**
+ * Times equality, LIKE 'prefix%' and LIKE '%infix%' filters on a TEXT column,
+ * first as compiled predicates, which test values in place with the text
+ * kernels, then by copying each value into a std::string and comparing that
+ * @param n_rows The number of rows in the table
+ * @return A report of the timings and the TEXT bytes scanned per second
+ */
+std::string benchmark_text_filters(std::size_t n_rows);
+
 /**
  * Heap storage test function. Returns true if all tests pass.
  */
@@ -0,0 +1,209 @@
+/**
+ * @file io_scheduler.cpp - Implementation of asynchronous block reads.
+ * IOScheduler
+ * AsyncScan
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include "io_scheduler.h"
+#include <algorithm>
+#include <memory>
+
+// Begin IO Scheduler Functions
+
+IOScheduler::IOScheduler(unsigned n_threads)
+    : pending(), ready(), busy(), threads(), outstanding(0), reads(0), batches(0), stopping(false), escaped()
+{
+    if (!n_threads)
+        n_threads = 1;
+    for (unsigned i = 0; i < n_threads; i++)
+        this->threads.push_back(std::thread(&IOScheduler::serve, this));
+}
+
+IOScheduler::~IOScheduler() {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->idle.wait(lock, [this] { return this->outstanding == 0; });
+        this->stopping = true;
+    }
+    this->work.notify_all();
+    for (std::thread& thread : this->threads)
+        thread.join();
+}
+
+void IOScheduler::fetch(HeapFile* file, BlockID block_id, Continuation continuation) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Requests& requests = this->pending[file];
+    // a file already queued (or being read) will be picked up again; only wake a thread for new files
+    if (requests.empty() && !this->busy.count(file)) {
+        this->ready.push_back(file);
+        this->work.notify_one();
+    }
+    requests.push_back(Request{block_id, continuation});
+    this->outstanding++;
+}
+
+void IOScheduler::drain() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->idle.wait(lock, [this] { return this->outstanding == 0; });
+    if (this->escaped) {
+        std::exception_ptr escaped = this->escaped;
+        this->escaped = nullptr;
+        std::rethrow_exception(escaped);
+    }
+}
+
+u_int64_t IOScheduler::get_reads() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->reads;
+}
+
+u_int64_t IOScheduler::get_batches() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->batches;
+}
+
+void IOScheduler::serve() {
+    while (true) {
+        HeapFile* file;
+        Requests batch;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->work.wait(lock, [this] { return this->stopping || !this->ready.empty(); });
+            if (this->ready.empty())
+                return;
+            file = this->ready.front();
+            this->ready.pop_front();
+            batch.swap(this->pending[file]);
+            this->pending.erase(file);
+            this->busy.insert(file);
+            this->batches++;
+            this->reads += batch.size();
+        }
+
+        // sequential order lets Berkeley DB walk the file front to back
+        std::stable_sort(batch.begin(), batch.end(), [](const Request& a, const Request& b) {
+            return a.block_id < b.block_id;
+        });
+        // resume each block as soon as it is read, rather than holding the whole batch in memory;
+        // nothing may escape this thread, so a failed read goes to its continuation
+        for (Request& request : batch) {
+            SlottedPage* block = nullptr;
+            std::exception_ptr error;
+            try {
+                block = file->get(request.block_id);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            try {
+                request.continuation(block, error);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (!this->escaped)
+                    this->escaped = std::current_exception();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->busy.erase(file);
+            // continuations usually ask for more blocks of the same file
+            std::map<HeapFile*, Requests>::iterator more = this->pending.find(file);
+            if (more != this->pending.end() && !more->second.empty()) {
+                this->ready.push_back(file);
+                this->work.notify_one();
+            }
+            this->outstanding -= batch.size();
+            if (this->outstanding == 0)
+                this->idle.notify_all();
+        }
+    }
+}
+
+// End IO Scheduler Functions
+
+// Begin Async Scan Functions
+
+AsyncScan::AsyncScan(IOScheduler& scheduler, HeapFile& file, RecordVisitor visitor, unsigned window)
+    : scheduler(scheduler), file(file), visitor(visitor), window(window ? window : 1), block_ids(nullptr),
+      next_fetch(0), in_flight(0), error()
+{}
+
+AsyncScan::~AsyncScan() {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->finished.wait(lock, [this] { return this->complete(); });
+    }
+    delete this->block_ids;
+}
+
+void AsyncScan::start() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->block_ids)
+        return;
+    this->block_ids = this->file.block_ids();
+    for (unsigned i = 0; i < this->window; i++)
+        this->fetch_next();
+}
+
+void AsyncScan::wait() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->finished.wait(lock, [this] { return this->complete(); });
+    if (this->error)
+        std::rethrow_exception(this->error);
+}
+
+bool AsyncScan::done() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->block_ids && this->complete();
+}
+
+void AsyncScan::resume(SlottedPage* block, std::exception_ptr error) {
+    bool failed;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        failed = (bool)this->error;
+    }
+    if (block && !failed) {
+        try {
+            BlockID block_id = block->get_block_id();
+            std::unique_ptr<RecordIDs> record_ids(block->ids());
+            Dbt record;
+            for (auto const& record_id: *record_ids)
+                if (block->get(record_id, record))
+                    this->visitor(Handle(block_id, record_id), record);
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+    delete block;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->in_flight--;
+    if (error && !this->error) {
+        this->error = error;
+        // stop requesting blocks; those already in flight are dropped as they arrive
+        this->next_fetch = this->block_ids->size();
+    }
+    this->fetch_next();
+    if (this->complete())
+        this->finished.notify_all();
+}
+
+void AsyncScan::fetch_next() {
+    if (this->next_fetch == this->block_ids->size())
+        return;
+    BlockID block_id = (*this->block_ids)[this->next_fetch++];
+    this->in_flight++;
+    this->scheduler.fetch(&this->file, block_id, [this](SlottedPage* block, std::exception_ptr error) {
+        this->resume(block, error);
+    });
+}
+
+bool AsyncScan::complete() const {
+    return !this->block_ids || (this->in_flight == 0 && this->next_fetch == this->block_ids->size());
+}
+
+// End Async Scan Functions
@@ -0,0 +1,181 @@
+/**
+ * @file io_scheduler.h - Asynchronous block reads for heap files.
+ * IOScheduler
+ * AsyncScan
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include "heap_storage.h"
+
+/**
+ * @class IOScheduler - runs block reads on a small pool of I/O threads
+ *
+ * Callers hand in a read request plus a continuation and go on with other work;
+ * the continuation is resumed on an I/O thread with the block once it is read.
+ * Outstanding requests against the same file are batched: one I/O thread claims
+ * all of them and reads them in BlockID order, resuming each continuation as
+ * soon as its block is read.
+ * A file is only ever read by one I/O thread at a time, so a HeapFile (and its
+ * Berkeley DB handle) must not be used by anyone else while it has reads
+ * outstanding.
+ */
+class IOScheduler {
+public:
+    /**
+     * Resumed with the block that was read, which owns its bytes (freed by the
+     * continuation), or with nullptr and the exception that failed the read
+     */
+    using Continuation = std::function<void(SlottedPage*, std::exception_ptr)>;
+
+    /**
+     * @param n_threads The number of I/O threads
+     */
+    IOScheduler(unsigned n_threads = 2);
+
+    virtual ~IOScheduler();
+
+    IOScheduler(const IOScheduler& other) = delete;
+
+    IOScheduler(IOScheduler&& temp) = delete;
+
+    IOScheduler& operator=(const IOScheduler& other) = delete;
+
+    IOScheduler& operator=(IOScheduler&& temp) = delete;
+
+    /**
+     * Queues a block read
+     * @param file The file to read from
+     * @param block_id The block to read
+     * @param continuation Resumed with the block once it has been read
+     */
+    virtual void fetch(HeapFile* file, BlockID block_id, Continuation continuation);
+
+    /**
+     * Waits until every queued read has been performed and resumed
+     * @throws The first exception a continuation let escape since the last drain
+     */
+    virtual void drain();
+
+    /**
+     * Retrieves the number of blocks read so far
+     */
+    virtual u_int64_t get_reads() const;
+
+    /**
+     * Retrieves the number of batches the reads were grouped into
+     */
+    virtual u_int64_t get_batches() const;
+
+protected:
+    struct Request {
+        BlockID block_id;
+        Continuation continuation;
+    };
+    using Requests = std::vector<Request>;
+
+    std::map<HeapFile*, Requests> pending;  // outstanding reads of files no thread has claimed
+    std::deque<HeapFile*> ready;            // files with pending reads, in arrival order
+    std::set<HeapFile*> busy;               // files an I/O thread is reading
+    std::vector<std::thread> threads;
+    u_int64_t outstanding;
+    u_int64_t reads;
+    u_int64_t batches;
+    bool stopping;
+    std::exception_ptr escaped;  // thrown by a continuation, for drain() to rethrow
+    mutable std::mutex mutex;
+    std::condition_variable work;
+    std::condition_variable idle;
+
+    /**
+     * I/O thread body: claims batches of reads until the scheduler stops
+     */
+    virtual void serve();
+};
+
+/**
+ * @class AsyncScan - a table scan driven by IOScheduler continuations
+ *
+ * Keeps up to window block reads in flight, and visits each block's records as
+ * soon as the block arrives, on whichever I/O thread read it. Since the
+ * scheduler reads a file's blocks in BlockID order on one thread at a time,
+ * blocks are visited in order. Many scans can be in flight on a few I/O threads.
+ */
+class AsyncScan {
+public:
+    /**
+     * @param scheduler The scheduler to issue reads through
+     * @param file The file to scan (not to be used elsewhere until the scan is done)
+     * @param visitor Called for each record
+     * @param window The number of block reads to keep in flight
+     */
+    AsyncScan(IOScheduler& scheduler, HeapFile& file, RecordVisitor visitor, unsigned window = 4);
+
+    virtual ~AsyncScan();
+
+    AsyncScan(const AsyncScan& other) = delete;
+
+    AsyncScan(AsyncScan&& temp) = delete;
+
+    AsyncScan& operator=(const AsyncScan& other) = delete;
+
+    AsyncScan& operator=(AsyncScan&& temp) = delete;
+
+    /**
+     * Issues the first reads and returns without waiting for them
+     */
+    virtual void start();
+
+    /**
+     * Blocks until every record has been visited, or the scan has failed and
+     * its remaining reads have come back
+     * @throws The exception that failed a block read or escaped the visitor
+     */
+    virtual void wait();
+
+    /**
+     * Checks whether every record has been visited
+     */
+    virtual bool done() const;
+
+protected:
+    IOScheduler& scheduler;
+    HeapFile& file;
+    RecordVisitor visitor;
+    unsigned window;
+    BlockIDs* block_ids;
+    std::size_t next_fetch;  // index into block_ids of the next block to request
+    unsigned in_flight;      // reads requested but not yet visited
+    std::exception_ptr error; // the first failure; no more blocks are requested or visited after it
+    mutable std::mutex mutex;
+    std::condition_variable finished;
+
+    /**
+     * Continuation for a block read: visits its records, then requests the
+     * next block
+     * @param block The block that was read, or nullptr if the read failed
+     * @param error The exception that failed the read, if it did
+     */
+    virtual void resume(SlottedPage* block, std::exception_ptr error);
+
+    /**
+     * Requests the next block, if any remain (caller holds the mutex)
+     */
+    virtual void fetch_next();
+
+    /**
+     * Checks whether no reads are in flight and none remain to be requested (caller holds the mutex)
+     */
+    virtual bool complete() const;
+};
@@ -0,0 +1,729 @@
+/**
+ * @file join_operators.cpp - Implementation of the join operators.
+ * IndexNestedLoopJoin
+ * HashSemiJoin
+ * SubqueryPlan
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include "join_operators.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include "SQLParser.h"
+#include "btree_storage.h"
+#include "scan_kernels.h"
+
+// Begin Index Nested Loop Join Functions
+
+const std::size_t IndexNestedLoopJoin::PROBE_BATCH;
+
+IndexNestedLoopJoin::IndexNestedLoopJoin(HeapTable& inner, const Identifier& inner_column,
+                                         const Identifier& outer_column, const ColumnNames* inner_columns)
+    : inner(inner), index(inner.get_index(inner_column)), outer_column(outer_column),
+      inner_columns(inner_columns ? *inner_columns : inner.get_column_names()), probes(0)
+{
+    if (!this->index)
+        throw DbRelationError("no index on join column " + inner_column);
+}
+
+void IndexNestedLoopJoin::join(const std::vector<const ValueDict*>& outer_rows, const JoinVisitor& visitor) {
+    for (std::size_t first = 0; first < outer_rows.size(); first += PROBE_BATCH) {
+        std::size_t last = std::min(first + PROBE_BATCH, outer_rows.size());
+
+        // the batch's keys, sorted so the probes walk the index in key order
+        std::vector<std::pair<std::string, std::size_t>> keys;
+        for (std::size_t row_num = first; row_num < last; row_num++) {
+            ValueDict::const_iterator value = outer_rows[row_num]->find(this->outer_column);
+            if (value == outer_rows[row_num]->end())
+                throw DbRelationError("outer row has no join column " + this->outer_column);
+            keys.push_back(std::make_pair(encode_key(value->second), row_num));
+        }
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<std::pair<Handle, std::size_t>> matches; // inner row, outer row
+        Handle handle;
+        bool found = false;
+        for (std::size_t i = 0; i < keys.size(); i++) {
+            if (!i || keys[i].first != keys[i - 1].first) {
+                found = this->index->lookup(keys[i].first, handle);
+                this->probes++;
+            }
+            if (found)
+                matches.push_back(std::make_pair(handle, keys[i].second));
+        }
+        if (matches.empty())
+            continue;
+
+        // fetch each matched inner row once, in block order
+        std::sort(matches.begin(), matches.end());
+        Handles handles;
+        for (auto const& match : matches)
+            if (handles.empty() || handles.back() != match.first)
+                handles.push_back(match.first);
+        std::unique_ptr<ColumnBatch> batch(this->inner.project_batch(&handles, &this->inner_columns));
+        ValueDict inner_row;
+        std::size_t match_num = 0;
+        for (std::size_t row = 0; row < batch->size(); row++) {
+            for (std::size_t col_num = 0; col_num < this->inner_columns.size(); col_num++)
+                inner_row[this->inner_columns[col_num]] = batch->get_value(row, col_num);
+            for (; match_num < matches.size() && matches[match_num].first == batch->handles[row]; match_num++)
+                visitor(*outer_rows[matches[match_num].second], inner_row);
+        }
+    }
+}
+
+// End Index Nested Loop Join Functions
+
+// Begin Hash Semi Join Functions
+
+const std::size_t HashSemiJoin::KEY_OVERHEAD;
+
+HashSemiJoin::HashSemiJoin(Kind kind, const Identifier& outer_column)
+    : kind(kind), outer_column(outer_column), keys(), budget(nullptr), reserved(0), spilled(false), sources() {}
+
+HashSemiJoin::~HashSemiJoin() {
+    if (this->budget)
+        this->budget->release(this->reserved);
+}
+
+void HashSemiJoin::build(HeapTable& inner, const Identifier& inner_column, const Predicate* where,
+                         MemoryBudget* budget) {
+    // once the budget has run out there is no point reading keys that can't be hashed
+    if (this->spilled && !inner_column.empty()) {
+        this->sources.push_back(Source{&inner, inner_column, where, {}});
+        return;
+    }
+    // an uncorrelated EXISTS still decodes one column, to learn whether any row matched
+    ColumnNames column_names(1, inner_column.empty() ? inner.get_column_names().front() : inner_column);
+    bool hashed = true;
+    inner.scan_batches(where, [&](const ColumnBatch& batch) {
+        if (inner_column.empty()) {
+            if (batch.size())
+                this->keys.insert("");
+            return;
+        }
+        for (std::size_t row = 0; row < batch.size() && hashed; row++)
+            hashed = this->add_key(encode_key(batch.get_value(row, 0)), budget);
+    }, &column_names);
+    if (!hashed)
+        this->sources.push_back(Source{&inner, inner_column, where, {}});
+}
+
+void HashSemiJoin::build(const std::vector<const ValueDict*>& inner_rows, const Identifier& inner_column,
+                         MemoryBudget* budget) {
+    if (inner_column.empty()) {
+        if (!inner_rows.empty())
+            this->keys.insert("");
+        return;
+    }
+    bool hashed = true;
+    for (const ValueDict* row : inner_rows) {
+        ValueDict::const_iterator value = row->find(inner_column);
+        if (value == row->end())
+            throw DbRelationError("inner row has no join column " + inner_column);
+        if (hashed)
+            hashed = this->add_key(encode_key(value->second), budget);
+    }
+    if (!hashed)
+        this->sources.push_back(Source{nullptr, inner_column, nullptr, inner_rows});
+}
+
+bool HashSemiJoin::passes(const ValueDict& outer_row) const {
+    bool found;
+    if (this->outer_column.empty()) {
+        found = !this->keys.empty();
+    } else {
+        ValueDict::const_iterator value = outer_row.find(this->outer_column);
+        if (value == outer_row.end())
+            throw DbRelationError("outer row has no join column " + this->outer_column);
+        std::string key = encode_key(value->second);
+        found = this->keys.count(key) > 0 || (this->spilled && this->search(key));
+    }
+    return found == (this->kind == SEMI);
+}
+
+void HashSemiJoin::filter(std::vector<const ValueDict*>& outer_rows) const {
+    outer_rows.erase(std::remove_if(outer_rows.begin(), outer_rows.end(),
+                                    [this](const ValueDict* row) { return !this->passes(*row); }),
+                     outer_rows.end());
+}
+
+bool HashSemiJoin::add_key(const std::string& key, MemoryBudget* budget) {
+    if (this->spilled)
+        return false;
+    if (budget && !this->keys.count(key)) {
+        std::size_t bytes = key.size() + KEY_OVERHEAD;
+        if (!budget->reserve(bytes)) {
+            this->spilled = true;
+            return false;
+        }
+        this->budget = budget;
+        this->reserved += bytes;
+    }
+    this->keys.insert(key);
+    return true;
+}
+
+bool HashSemiJoin::search(const std::string& key) const {
+    for (const Source& source : this->sources) {
+        if (!source.table) {
+            for (const ValueDict* row : source.rows)
+                if (encode_key(row->at(source.column)) == key)
+                    return true;
+            continue;
+        }
+        bool found = false;
+        ColumnNames column_names(1, source.column);
+        source.table->scan_batches(source.where, [&](const ColumnBatch& batch) {
+            for (std::size_t row = 0; row < batch.size() && !found; row++)
+                found = encode_key(batch.get_value(row, 0)) == key;
+        }, &column_names);
+        if (found)
+            return true;
+    }
+    return false;
+}
+
+// End Hash Semi Join Functions
+
+// Begin Subquery Plan Functions
+
+/**
+ * Collects the conjuncts of a parsed where clause, however its ANDs nest
+ */
+static void conjuncts_of(const hsql::Expr* expr, std::vector<const hsql::Expr*>& conjuncts) {
+    if (expr->type == hsql::ExprType::kExprOperator && expr->opType == hsql::Expr::AND) {
+        conjuncts_of(expr->expr, conjuncts);
+        conjuncts_of(expr->expr2, conjuncts);
+    } else {
+        conjuncts.push_back(expr);
+    }
+}
+
+/**
+ * Checks whether a parsed expression contains a subquery
+ */
+static bool has_subquery(const hsql::Expr* expr) {
+    if (!expr)
+        return false;
+    if (expr->select || has_subquery(expr->expr) || has_subquery(expr->expr2))
+        return true;
+    if (expr->exprList)
+        for (const hsql::Expr* item : *expr->exprList)
+            if (has_subquery(item))
+                return true;
+    return false;
+}
+
+/**
+ * Checks whether a parsed expression is a column reference, qualified by a table if one is given
+ */
+static bool is_column_of(const hsql::Expr* expr, const Identifier& table_name = "") {
+    if (!expr || expr->type != hsql::ExprType::kExprColumnRef)
+        return false;
+    return table_name.empty() || (expr->table && table_name == expr->table);
+}
+
+/**
+ * Checks whether a parsed expression (outside any subquery) refers to a column qualified by a table
+ */
+static bool refers_to(const hsql::Expr* expr, const Identifier& table_name) {
+    if (!expr)
+        return false;
+    if (is_column_of(expr, table_name) || refers_to(expr->expr, table_name) || refers_to(expr->expr2, table_name))
+        return true;
+    if (expr->exprList)
+        for (const hsql::Expr* item : *expr->exprList)
+            if (refers_to(item, table_name))
+                return true;
+    return false;
+}
+
+/**
+ * ANDs two predicates, either of which may be nullptr
+ */
+static Predicate* and_of(Predicate* left, Predicate* right) {
+    if (!left)
+        return right;
+    if (!right)
+        return left;
+    return new Predicate(Predicate::AND, left, right);
+}
+
+SubqueryPlan::SubqueryPlan(const hsql::Expr* where, const Identifier& outer_table) : subqueries(), where(nullptr) {
+    if (!where)
+        return;
+    std::vector<const hsql::Expr*> conjuncts;
+    conjuncts_of(where, conjuncts);
+    try {
+        for (const hsql::Expr* conjunct : conjuncts) {
+            HashSemiJoin::Kind kind = HashSemiJoin::SEMI;
+            const hsql::Expr* term = conjunct;
+            if (term->type == hsql::ExprType::kExprOperator && term->opType == hsql::Expr::NOT && term->expr) {
+                kind = HashSemiJoin::ANTI;
+                term = term->expr;
+            }
+            bool subquery = term->type == hsql::ExprType::kExprOperator && term->select;
+            if (subquery && term->opType == hsql::Expr::IN)
+                this->add_subquery(kind, term->expr, term->select, outer_table);
+            else if (subquery && term->opType == hsql::Expr::EXISTS)
+                this->add_subquery(kind, nullptr, term->select, outer_table);
+            else if (has_subquery(conjunct))
+                throw PredicateError("subqueries are only supported as [NOT] IN or [NOT] EXISTS conjuncts");
+            else
+                this->where = and_of(this->where, Predicate::from_expr(conjunct));
+        }
+    } catch (...) {
+        this->clear();
+        throw;
+    }
+}
+
+SubqueryPlan::~SubqueryPlan() {
+    this->clear();
+}
+
+void SubqueryPlan::clear() {
+    for (Subquery& subquery : this->subqueries)
+        delete subquery.where;
+    this->subqueries.clear();
+    delete this->where;
+    this->where = nullptr;
+}
+
+void SubqueryPlan::add_subquery(HashSemiJoin::Kind kind, const hsql::Expr* in_column,
+                                const hsql::SelectStatement* select, const Identifier& outer_table) {
+    if (!select->fromTable || select->fromTable->type != hsql::kTableName || select->groupBy || select->unionSelect)
+        throw PredicateError("subqueries must select from one table");
+    // a join keeps every match, so a subquery that trims its rows can't be rewritten
+    if (select->limit)
+        throw PredicateError("subqueries with LIMIT are not supported");
+    for (const hsql::Expr* item : *select->selectList)
+        if (item->type == hsql::ExprType::kExprFunctionRef)
+            throw PredicateError("aggregate subqueries are not supported");
+    Identifier outer_column, inner_column;
+    if (in_column) {
+        if (!is_column_of(in_column))
+            throw PredicateError("IN subqueries must test a column");
+        if (!select->selectList || select->selectList->size() != 1 || !is_column_of((*select->selectList)[0]))
+            throw PredicateError("IN subqueries must select one column");
+        outer_column = in_column->name;
+        inner_column = (*select->selectList)[0]->name;
+    }
+
+    // split the correlation (inner column = outer column) from the subquery's own filter
+    Predicate* where = nullptr;
+    if (select->whereClause) {
+        std::vector<const hsql::Expr*> conjuncts;
+        conjuncts_of(select->whereClause, conjuncts);
+        try {
+            for (const hsql::Expr* conjunct : conjuncts) {
+                bool left_outer = is_column_of(conjunct->expr, outer_table);
+                bool right_outer = is_column_of(conjunct->expr2, outer_table);
+                if (conjunct->type == hsql::ExprType::kExprOperator && conjunct->opType == hsql::Expr::SIMPLE_OP &&
+                    conjunct->opChar == '=' && is_column_of(conjunct->expr) && is_column_of(conjunct->expr2) &&
+                    left_outer != right_outer) {
+                    if (in_column || !outer_column.empty())
+                        throw PredicateError("only EXISTS subqueries correlated by one equality are supported");
+                    outer_column = left_outer ? conjunct->expr->name : conjunct->expr2->name;
+                    inner_column = left_outer ? conjunct->expr2->name : conjunct->expr->name;
+                } else if (has_subquery(conjunct)) {
+                    throw PredicateError("nested subqueries are not supported");
+                } else if (refers_to(conjunct, outer_table)) {
+                    throw PredicateError("subqueries may only refer to the outer table by one equality");
+                } else {
+                    where = and_of(where, Predicate::from_expr(conjunct));
+                }
+            }
+        } catch (...) {
+            delete where;
+            throw;
+        }
+    }
+    this->subqueries.push_back(Subquery{kind, outer_column, select->fromTable->name, inner_column, where});
+}
+
+Handles* SubqueryPlan::select(HeapTable& outer, const TableResolver& tables) const {
+    std::vector<std::unique_ptr<HashSemiJoin>> joins;
+    ColumnNames join_columns;
+    for (const Subquery& subquery : this->subqueries) {
+        joins.emplace_back(new HashSemiJoin(subquery.kind, subquery.outer_column));
+        joins.back()->build(tables(subquery.inner_table), subquery.inner_column, subquery.where);
+        // an uncorrelated EXISTS that fails rejects every outer row unscanned
+        if (subquery.outer_column.empty() && !joins.back()->passes(ValueDict()))
+            return new Handles();
+        if (!subquery.outer_column.empty() &&
+            std::find(join_columns.begin(), join_columns.end(), subquery.outer_column) == join_columns.end())
+            join_columns.push_back(subquery.outer_column);
+    }
+
+    std::unique_ptr<Handles> handles(outer.select(this->where));
+    if (join_columns.empty())
+        return handles.release();
+    std::unique_ptr<ColumnBatch> batch(outer.project_batch(handles.get(), &join_columns));
+    handles->clear();
+    ValueDict row;
+    for (std::size_t row_num = 0; row_num < batch->size(); row_num++) {
+        for (std::size_t col_num = 0; col_num < join_columns.size(); col_num++)
+            row[join_columns[col_num]] = batch->get_value(row_num, col_num);
+        if (std::all_of(joins.begin(), joins.end(),
+                        [&row](const std::unique_ptr<HashSemiJoin>& join) { return join->passes(row); }))
+            handles->push_back(batch->handles[row_num]);
+    }
+    return handles.release();
+}
+
+std::string SubqueryPlan::to_string() const {
+    std::string plan;
+    for (const Subquery& subquery : this->subqueries) {
+        plan += subquery.kind == HashSemiJoin::SEMI ? "Semi Join " : "Anti Join ";
+        plan += subquery.inner_table;
+        if (subquery.outer_column.empty())
+            plan += " (any row)";
+        else
+            plan += " on " + subquery.outer_column + " = " + subquery.inner_table + "." + subquery.inner_column;
+        if (subquery.where)
+            plan += " where " + subquery.where->to_string();
+        plan += "\n";
+    }
+    if (this->where)
+        plan += "Filter: " + this->where->to_string() + "\n";
+    return plan;
+}
+
+// End Subquery Plan Functions
+
+std::string benchmark_index_join(std::size_t max_outer) {
+    typedef std::chrono::steady_clock Clock;
+    const int32_t n_inner = 100000;
+    ColumnNames column_names = {"id", "name"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::TEXT)};
+    HeapFile stale("_bench_join");
+    if (stale.exists())
+        stale.drop();
+    HeapTable inner("_bench_join", column_names, column_attributes);
+    inner.add_unique(ColumnNames(1, "id"), true);
+    inner.create();
+    std::vector<ValueDict> inner_rows(n_inner);
+    std::vector<const ValueDict*> rows;
+    for (int32_t id = 0; id < n_inner; id++) {
+        inner_rows[id]["id"] = Value(id);
+        inner_rows[id]["name"] = Value("customer " + std::to_string(id));
+        rows.push_back(&inner_rows[id]);
+    }
+    delete inner.insert_batch(rows);
+
+    // about half the outer keys have an inner row
+    std::mt19937 random(5300);
+    std::vector<ValueDict> outer_table(max_outer);
+    for (ValueDict& row : outer_table)
+        row["customer"] = Value((int32_t)(random() % (2 * n_inner)));
+    std::ostringstream report;
+    for (std::size_t n_outer = std::max<std::size_t>(max_outer / 100, 1); n_outer <= max_outer; n_outer *= 10) {
+        std::vector<const ValueDict*> outer_rows;
+        for (std::size_t row_num = 0; row_num < n_outer; row_num++)
+            outer_rows.push_back(&outer_table[row_num]);
+
+        Clock::time_point start = Clock::now();
+        IndexNestedLoopJoin join(inner, "id", "customer");
+        std::size_t n_joined = 0;
+        join.join(outer_rows, [&](const ValueDict&, const ValueDict&) { n_joined++; });
+        double index_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        report << n_outer << " outer rows: index nested-loop join " << n_joined << " rows, " << join.get_probes()
+               << " probes, " << index_ms << "ms" << std::endl;
+
+        // hash the outer rows, then scan the whole inner table
+        start = Clock::now();
+        std::unordered_multimap<int32_t, const ValueDict*> hashed;
+        for (const ValueDict* row : outer_rows)
+            hashed.insert(std::make_pair(row->at("customer").n, row));
+        n_joined = 0;
+        inner.scan_batches(nullptr, [&](const ColumnBatch& batch) {
+            for (std::size_t row = 0; row < batch.size(); row++) {
+                auto range = hashed.equal_range(batch.columns[0].ints[row]);
+                for (auto match = range.first; match != range.second; match++) {
+                    ValueDict inner_row;
+                    inner_row["id"] = batch.get_value(row, 0);
+                    inner_row["name"] = batch.get_value(row, 1);
+                    n_joined++;
+                }
+            }
+        }, &column_names);
+        double hash_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        report << "  hash join scanning " << n_inner << " rows: " << n_joined << " rows, " << hash_ms << "ms"
+               << std::endl;
+    }
+    inner.drop();
+    return report.str();
+}
+
+std::string benchmark_semi_join(std::size_t n_outer) {
+    typedef std::chrono::steady_clock Clock;
+    const int32_t n_inner = 100000, n_customers = 2 * n_outer;
+    ColumnNames column_names = {"id", "customer"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::INT)};
+    HeapFile stale("_bench_semi");
+    if (stale.exists())
+        stale.drop();
+    HeapTable inner("_bench_semi", column_names, column_attributes);
+    inner.create();
+    std::mt19937 random(5300);
+    std::vector<ValueDict> inner_rows(n_inner);
+    std::vector<const ValueDict*> rows;
+    for (int32_t id = 0; id < n_inner; id++) {
+        inner_rows[id]["id"] = Value(id);
+        inner_rows[id]["customer"] = Value((int32_t)(random() % n_customers));
+        rows.push_back(&inner_rows[id]);
+    }
+    delete inner.insert_batch(rows);
+
+    std::vector<ValueDict> outer_table(n_outer);
+    std::vector<const ValueDict*> outer_rows;
+    for (std::size_t row_num = 0; row_num < n_outer; row_num++) {
+        outer_table[row_num]["id"] = Value((int32_t)row_num);
+        outer_rows.push_back(&outer_table[row_num]);
+    }
+    std::ostringstream report;
+    report << n_outer << " outer rows, " << n_inner << " inner rows over " << n_customers << " keys" << std::endl;
+
+    // WHERE id IN (SELECT customer FROM _bench_semi)
+    Clock::time_point start = Clock::now();
+    HashSemiJoin semi(HashSemiJoin::SEMI, "id");
+    semi.build(inner, "customer");
+    std::vector<const ValueDict*> kept = outer_rows;
+    semi.filter(kept);
+    double semi_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    report << "semi-join: " << kept.size() << " rows, " << semi.size() << " keys hashed, " << semi_ms << "ms"
+           << std::endl;
+
+    HashSemiJoin anti(HashSemiJoin::ANTI, "id");
+    anti.build(inner, "customer");
+    kept = outer_rows;
+    anti.filter(kept);
+    report << "anti-join: " << kept.size() << " rows" << std::endl;
+
+    // the same IN as a join: materialize every matching pair, then remove the repeated outer rows
+    start = Clock::now();
+    std::unordered_map<int32_t, const ValueDict*> hashed;
+    for (const ValueDict* row : outer_rows)
+        hashed[row->at("id").n] = row;
+    std::vector<std::pair<const ValueDict*, ValueDict>> joined;
+    inner.scan_batches(nullptr, [&](const ColumnBatch& batch) {
+        for (std::size_t row = 0; row < batch.size(); row++) {
+            auto match = hashed.find(batch.columns[1].ints[row]);
+            if (match == hashed.end())
+                continue;
+            ValueDict inner_row;
+            inner_row["id"] = batch.get_value(row, 0);
+            inner_row["customer"] = batch.get_value(row, 1);
+            joined.push_back(std::make_pair(match->second, inner_row));
+        }
+    }, &column_names);
+    std::size_t n_joined = joined.size();
+    kept.clear();
+    for (auto const& pair : joined)
+        kept.push_back(pair.first);
+    std::sort(kept.begin(), kept.end());
+    kept.erase(std::unique(kept.begin(), kept.end()), kept.end());
+    double join_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    report << "join then distinct: " << kept.size() << " rows from " << n_joined << " joined, " << join_ms << "ms"
+           << std::endl;
+    inner.drop();
+    return report.str();
+}
+
+bool test_join_operators() {
+    ColumnNames column_names = {"a", "b"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::TEXT)};
+    HeapFile stale("_test_join_cpp");
+    if (stale.exists())
+        stale.drop();
+    HeapTable inner("_test_join_cpp", column_names, column_attributes);
+    inner.add_unique(ColumnNames(1, "a"), true);
+    inner.create();
+    std::vector<ValueDict> inner_rows(2000);
+    std::vector<const ValueDict*> rows;
+    for (std::size_t i = 0; i < inner_rows.size(); i++) {
+        inner_rows[i]["a"] = Value((int32_t)i);
+        inner_rows[i]["b"] = Value("row " + std::to_string(i));
+        rows.push_back(&inner_rows[i]);
+    }
+    delete inner.insert_batch(rows);
+
+    // over several probe batches, with repeated keys and keys with no inner row
+    std::vector<ValueDict> outer_table(3000);
+    std::vector<const ValueDict*> outer_rows;
+    std::size_t n_expected = 0, n_distinct = 0;
+    std::set<int32_t> batch_keys;
+    for (std::size_t i = 0; i < outer_table.size(); i++) {
+        int32_t k = i * 37 % 2500;
+        outer_table[i]["k"] = Value(k);
+        outer_rows.push_back(&outer_table[i]);
+        n_expected += k < 2000;
+        if (i % IndexNestedLoopJoin::PROBE_BATCH == 0) {
+            n_distinct += batch_keys.size();
+            batch_keys.clear();
+        }
+        batch_keys.insert(k);
+    }
+    n_distinct += batch_keys.size();
+
+    IndexNestedLoopJoin join(inner, "a", "k");
+    std::size_t n_joined = 0;
+    bool pairs_ok = true;
+    join.join(outer_rows, [&](const ValueDict& outer_row, const ValueDict& inner_row) {
+        int32_t k = outer_row.at("k").n;
+        pairs_ok = pairs_ok && inner_row.at("a").n == k && inner_row.at("b").s == "row " + std::to_string(k);
+        n_joined++;
+    });
+    bool join_ok = pairs_ok && n_joined == n_expected && join.get_probes() == n_distinct;
+    try {
+        IndexNestedLoopJoin unindexed(inner, "b", "k");
+        join_ok = false;
+    } catch (DbRelationError& e) {}
+    ValueDict no_k;
+    std::vector<const ValueDict*> missing(1, &no_k);
+    try {
+        join.join(missing, [](const ValueDict&, const ValueDict&) {});
+        join_ok = false;
+    } catch (DbRelationError& e) {}
+    std::cout << "index nested-loop join ok" << std::endl;
+
+    // semi- and anti-joins with the inner rows where a < 1000, keeping the outer rows' order
+    std::unique_ptr<Predicate> below(new Predicate(Predicate::LT, "a", std::vector<Value>(1, Value(1000))));
+    HashSemiJoin semi(HashSemiJoin::SEMI, "k"), anti(HashSemiJoin::ANTI, "k");
+    semi.build(inner, "a", below.get());
+    anti.build(inner, "a", below.get());
+    std::vector<const ValueDict*> semi_rows = outer_rows, anti_rows = outer_rows, expected_rows;
+    semi.filter(semi_rows);
+    anti.filter(anti_rows);
+    for (const ValueDict* row : outer_rows)
+        if (row->at("k").n < 1000)
+            expected_rows.push_back(row);
+    bool semi_ok = semi.size() == 1000 && semi_rows == expected_rows &&
+                   anti_rows.size() == outer_rows.size() - expected_rows.size() &&
+                   std::all_of(anti_rows.begin(), anti_rows.end(),
+                               [](const ValueDict* row) { return row->at("k").n >= 1000; });
+
+    // duplicate inner keys neither repeat nor multiply the outer rows
+    HashSemiJoin duplicates(HashSemiJoin::SEMI, "k");
+    duplicates.build(outer_rows, "k");
+    semi_rows = outer_rows;
+    duplicates.filter(semi_rows);
+    semi_ok = semi_ok && duplicates.size() == 2500 && semi_rows == outer_rows;
+
+    // an uncorrelated EXISTS with no matching inner row
+    std::unique_ptr<Predicate> none(new Predicate(Predicate::LT, "a", std::vector<Value>(1, Value(0))));
+    HashSemiJoin exists(HashSemiJoin::SEMI), not_exists(HashSemiJoin::ANTI);
+    exists.build(inner, "", none.get());
+    not_exists.build(inner, "", none.get());
+    semi_ok = semi_ok && !exists.passes(no_k) && not_exists.passes(no_k);
+
+    // a budget too small for the keys hashes what fits and finds the rest by rescanning the inner rows
+    MemoryManager pool(1 << 20);
+    {
+        MemoryBudget small_budget(pool, 100 * HashSemiJoin::KEY_OVERHEAD);
+        std::vector<const ValueDict*> sample(outer_rows.begin(), outer_rows.begin() + 200), expected_sample;
+        for (const ValueDict* row : sample)
+            if (row->at("k").n < 1000)
+                expected_sample.push_back(row);
+        {
+            HashSemiJoin small_semi(HashSemiJoin::SEMI, "k"), small_anti(HashSemiJoin::ANTI, "k");
+            HashSemiJoin small_duplicates(HashSemiJoin::SEMI, "k");
+            small_semi.build(inner, "a", below.get(), &small_budget);
+            small_anti.build(inner, "a", below.get(), &small_budget);
+            small_duplicates.build(outer_rows, "k", &small_budget);
+            std::vector<const ValueDict*> small_semi_rows = sample, small_anti_rows = sample, all_rows = sample;
+            small_semi.filter(small_semi_rows);
+            small_anti.filter(small_anti_rows);
+            small_duplicates.filter(all_rows);
+            semi_ok = semi_ok && small_semi.is_spilled() && small_semi.size() > 0 && small_semi.size() < 100 &&
+                      small_anti.is_spilled() && small_semi_rows == expected_sample &&
+                      small_anti_rows.size() == sample.size() - expected_sample.size() && all_rows == sample &&
+                      small_budget.get_used() > 0 && !semi.is_spilled();
+        }
+        semi_ok = semi_ok && !small_budget.get_used() && pool.get_spills() == 1;
+    }
+    semi_ok = semi_ok && !pool.get_granted();
+    try {
+        semi.passes(no_k);
+        semi_ok = false;
+    } catch (DbRelationError& e) {}
+    inner.drop();
+    std::cout << "semi-join ok" << std::endl;
+
+    // subqueries parsed from SQL (so the tables are named as the lexer allows)
+    ColumnNames pair_names = {"a", "b"};
+    ColumnAttributes pair_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT)};
+    std::vector<std::pair<Identifier, std::vector<std::vector<int32_t>>>> tables = {
+        {"test_subquery_outer_cpp", {{1, 10}, {2, 20}, {3, 30}, {4, 40}, {5, 50}}},
+        {"test_subquery_inner_cpp", {{1, 0}, {1, 0}, {3, 7}, {3, 0}, {5, 9}, {9, 9}}}};
+    std::vector<std::unique_ptr<HeapTable>> subquery_tables;
+    for (auto const& table : tables) {
+        HeapFile stale_table(table.first);
+        if (stale_table.exists())
+            stale_table.drop();
+        subquery_tables.emplace_back(new HeapTable(table.first, pair_names, pair_attributes));
+        subquery_tables.back()->create();
+        for (auto const& values : table.second) {
+            ValueDict pair;
+            pair["a"] = Value(values[0]);
+            pair["b"] = Value(values[1]);
+            subquery_tables.back()->insert(&pair);
+        }
+    }
+    TableResolver resolve = [&](const Identifier& table_name) -> HeapTable& {
+        for (std::size_t i = 0; i < tables.size(); i++)
+            if (tables[i].first == table_name)
+                return *subquery_tables[i];
+        throw DbRelationError("no such table " + table_name);
+    };
+    // the outer table's a values the query selects
+    auto select_a = [&](const std::string& where) -> std::vector<int32_t> {
+        std::unique_ptr<hsql::SQLParserResult> parsed(
+            hsql::SQLParser::parseSQLString("SELECT * FROM test_subquery_outer_cpp AS o WHERE " + where));
+        if (!parsed->isValid())
+            throw PredicateError("invalid SQL");
+        const hsql::SelectStatement* select = dynamic_cast<const hsql::SelectStatement*>(parsed->getStatement(0));
+        SubqueryPlan plan(select->whereClause, select->fromTable->alias);
+        std::unique_ptr<Handles> handles(plan.select(*subquery_tables[0], resolve));
+        std::vector<int32_t> selected;
+        for (const Handle& handle : *handles) {
+            std::unique_ptr<ValueDict> row(subquery_tables[0]->project(handle));
+            selected.push_back(row->at("a").n);
+        }
+        return selected;
+    };
+    bool subquery_ok =
+        select_a("a IN (SELECT a FROM test_subquery_inner_cpp) AND b > 15") == std::vector<int32_t>({3, 5}) &&
+        select_a("a NOT IN (SELECT a FROM test_subquery_inner_cpp WHERE b = 0)") == std::vector<int32_t>({2, 4, 5}) &&
+        select_a("EXISTS (SELECT * FROM test_subquery_inner_cpp AS i WHERE i.a = o.a AND b > 5)") ==
+            std::vector<int32_t>({3, 5}) &&
+        select_a("NOT EXISTS (SELECT * FROM test_subquery_inner_cpp AS i WHERE o.a = i.a)") ==
+            std::vector<int32_t>({2, 4}) &&
+        select_a("EXISTS (SELECT * FROM test_subquery_inner_cpp WHERE b > 100)").empty();
+    for (const char* unsupported : {"a IN (SELECT a FROM test_subquery_inner_cpp LIMIT 1)",
+                                    "a IN (SELECT a FROM test_subquery_inner_cpp) OR b > 15",
+                                    "EXISTS (SELECT * FROM test_subquery_inner_cpp AS i WHERE i.b > o.b)"}) {
+        try {
+            select_a(unsupported);
+            subquery_ok = false;
+        } catch (PredicateError& e) {}
+    }
+    for (auto& table : subquery_tables)
+        table->drop();
+    std::cout << "subquery rewrite ok" << std::endl;
+
+    return join_ok && semi_ok && subquery_ok;
+}
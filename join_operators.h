@@ -0,0 +1,328 @@
+/**
+ * @file join_operators.h - Join operators over rows and tables.
+ * IndexNestedLoopJoin
+ * HashSemiJoin
+ * SubqueryPlan
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "admission_control.h"
+#include "heap_storage.h"
+#include "predicate.h"
+
+namespace hsql {
+    struct Expr;
+    struct SelectStatement;
+}
+
+/**
+ * Callback for visiting the pairs of rows a join produces, which are only
+ * valid for the duration of the call
+ */
+using JoinVisitor = std::function<void(const ValueDict& outer_row, const ValueDict& inner_row)>;
+
+/**
+ * @class IndexNestedLoopJoin - joins rows with a table through the table's index
+ *
+ * For an equijoin whose outer side is small and whose inner table has an
+ * index on the join column. Rather than scanning the inner table, as a hash
+ * join would, the join probes the index once per distinct outer key.
+ *
+ * Outer rows are taken PROBE_BATCH at a time. A batch's keys are sorted, so
+ * the probes walk the B+tree in key order and neighbouring probes hit the
+ * same pages. The inner rows found are then fetched with
+ * HeapTable::project_batch(), which reads each of their blocks once.
+ *
+ * The index is one of the table's uniqueness indexes (PRIMARY KEY or UNIQUE),
+ * so each outer row matches at most one inner row.
+ */
+class IndexNestedLoopJoin {
+public:
+    static const std::size_t PROBE_BATCH = 1024;
+
+    /**
+     * @param inner The indexed table
+     * @param inner_column The inner table's join column
+     * @param outer_column The outer rows' join column
+     * @param inner_columns The inner columns to project (nullptr for all)
+     * @throws DbRelationError if the inner table has no index on its join column
+     */
+    IndexNestedLoopJoin(HeapTable& inner, const Identifier& inner_column, const Identifier& outer_column,
+                        const ColumnNames* inner_columns = nullptr);
+
+    virtual ~IndexNestedLoopJoin() {}
+
+    IndexNestedLoopJoin(const IndexNestedLoopJoin& other) = delete;
+
+    IndexNestedLoopJoin(IndexNestedLoopJoin&& temp) = delete;
+
+    IndexNestedLoopJoin& operator=(const IndexNestedLoopJoin& other) = delete;
+
+    IndexNestedLoopJoin& operator=(IndexNestedLoopJoin&& temp) = delete;
+
+    /**
+     * Joins outer rows with the inner table
+     * @param outer_rows The outer rows
+     * @param visitor Called for each matching pair; within a batch, in the inner rows' block order
+     * @throws DbRelationError if an outer row lacks the join column
+     */
+    virtual void join(const std::vector<const ValueDict*>& outer_rows, const JoinVisitor& visitor);
+
+    /**
+     * Retrieves the number of index probes made so far (one per distinct key per batch)
+     */
+    virtual u_int64_t get_probes() const { return this->probes; }
+
+protected:
+    HeapTable& inner;
+    BTreeIndex* index;
+    Identifier outer_column;
+    ColumnNames inner_columns;
+    u_int64_t probes;
+};
+
+/**
+ * @class HashSemiJoin - keeps the outer rows that have (SEMI) or lack (ANTI) a matching inner row
+ *
+ * The operator behind IN and EXISTS (semi-join) and NOT IN and NOT EXISTS
+ * (anti-join). build() collects the distinct join keys of the inner side into
+ * a hash set, so duplicate inner rows collapse. Each outer row is then
+ * tested with a single lookup. The test stops at the first match and keeps an
+ * outer row at most once, so no join is materialized and no row is repeated.
+ *
+ * A join without a join column (an uncorrelated EXISTS) only records whether
+ * the inner side has any row.
+ *
+ * Given a MemoryBudget, build() charges each key it hashes to the budget
+ * (its encoding plus KEY_OVERHEAD) until the join is destroyed. Once the
+ * budget can't hold another key the join stops hashing and remembers where
+ * the rest come from: an outer row whose key isn't hashed is then looked for
+ * by rescanning those inner rows, so a join too big for its grant runs
+ * slower instead of growing.
+ */
+class HashSemiJoin {
+public:
+    enum Kind {
+        SEMI, ANTI
+    };
+
+    static const std::size_t KEY_OVERHEAD = 64;  // a hash set node and its string, besides the key bytes
+
+    /**
+     * @param kind SEMI or ANTI
+     * @param outer_column The outer rows' join column (empty for an uncorrelated EXISTS)
+     */
+    HashSemiJoin(Kind kind, const Identifier& outer_column = "");
+
+    virtual ~HashSemiJoin();
+
+    HashSemiJoin(const HashSemiJoin& other) = delete;
+
+    HashSemiJoin(HashSemiJoin&& temp) = delete;
+
+    HashSemiJoin& operator=(const HashSemiJoin& other) = delete;
+
+    HashSemiJoin& operator=(HashSemiJoin&& temp) = delete;
+
+    /**
+     * Adds the join keys of an inner table's rows, decoding only the join column
+     * @param inner The inner table
+     * @param inner_column Its join column (empty for an uncorrelated EXISTS)
+     * @param where The rows to take (nullptr for all)
+     * @param budget The join's memory budget, or nullptr if unlimited (the same one for every build;
+     *        with a budget, the table and predicate must outlive the join)
+     */
+    virtual void build(HeapTable& inner, const Identifier& inner_column, const Predicate* where = nullptr,
+                       MemoryBudget* budget = nullptr);
+
+    /**
+     * Adds the join keys of inner rows
+     * @param inner_rows The inner rows
+     * @param inner_column Their join column (empty for an uncorrelated EXISTS)
+     * @param budget The join's memory budget, or nullptr if unlimited (the same one for every build;
+     *        with a budget, the rows must outlive the join)
+     * @throws DbRelationError if a row lacks the join column
+     */
+    virtual void build(const std::vector<const ValueDict*>& inner_rows, const Identifier& inner_column,
+                       MemoryBudget* budget = nullptr);
+
+    /**
+     * Checks whether an outer row has a match (SEMI) or lacks one (ANTI)
+     * @param outer_row The outer row
+     * @throws DbRelationError if the row lacks the join column
+     */
+    virtual bool passes(const ValueDict& outer_row) const;
+
+    /**
+     * Removes the outer rows that don't pass; the rest keep their order
+     * @param outer_rows The outer rows
+     * @throws DbRelationError if a row lacks the join column
+     */
+    virtual void filter(std::vector<const ValueDict*>& outer_rows) const;
+
+    /**
+     * Retrieves the number of distinct join keys hashed (all of them, unless the budget ran out)
+     */
+    virtual std::size_t size() const { return this->keys.size(); }
+
+    /**
+     * Checks whether the budget ran out, so some keys are found by rescanning the inner rows
+     */
+    virtual bool is_spilled() const { return this->spilled; }
+
+    /**
+     * Retrieves the outer rows' join column (empty for an uncorrelated EXISTS)
+     */
+    virtual const Identifier& get_outer_column() const { return this->outer_column; }
+
+protected:
+    /**
+     * Inner rows built after the budget ran out, searched instead of hashed
+     */
+    struct Source {
+        HeapTable* table;                   // nullptr for rows already in memory
+        Identifier column;
+        const Predicate* where;
+        std::vector<const ValueDict*> rows;
+    };
+
+    Kind kind;
+    Identifier outer_column;
+    std::unordered_set<std::string> keys;
+    MemoryBudget* budget;  // the budget the keys are charged to, if any
+    std::size_t reserved;  // bytes the keys hold of it
+    bool spilled;
+    std::vector<Source> sources;
+
+    /**
+     * Hashes a key, unless the budget can't hold it
+     * @param key The encoded key
+     * @param budget The join's memory budget, or nullptr if unlimited
+     * @return False if the budget ran out (now or before)
+     */
+    virtual bool add_key(const std::string& key, MemoryBudget* budget);
+
+    /**
+     * Looks for a key among the inner rows that weren't hashed
+     * @param key The encoded key
+     * @return True if an inner row has the key
+     */
+    virtual bool search(const std::string& key) const;
+};
+
+/**
+ * Opens a table that a query names
+ */
+using TableResolver = std::function<HeapTable&(const Identifier& table_name)>;
+
+/**
+ * @class SubqueryPlan - a where clause with its subqueries rewritten into semi- and anti-joins
+ *
+ * Each top-level conjunct of the forms
+ *     col [NOT] IN (SELECT col2 FROM t [WHERE ...])
+ *     [NOT] EXISTS (SELECT ... FROM t [WHERE ...])
+ * becomes a HashSemiJoin (an ANTI one when negated) built from t. The other
+ * conjuncts become an ordinary Predicate. An EXISTS subquery may be
+ * correlated through one conjunct t.col2 = outer.col (the outer column
+ * qualified by the outer table's name), which becomes the join's key. An
+ * uncorrelated EXISTS only checks that t has a matching row. Subqueries whose
+ * rows a join can't reproduce (with LIMIT, GROUP BY, UNION, or aggregates)
+ * are rejected.
+ */
+class SubqueryPlan {
+public:
+    /**
+     * @param where The parsed where clause (nullptr for none)
+     * @param outer_table The name (or alias) outer columns are qualified with in correlated subqueries
+     * @throws PredicateError if a subquery appears in another form, or the rest isn't a Predicate
+     */
+    SubqueryPlan(const hsql::Expr* where, const Identifier& outer_table);
+
+    virtual ~SubqueryPlan();
+
+    SubqueryPlan(const SubqueryPlan& other) = delete;
+
+    SubqueryPlan(SubqueryPlan&& temp) = delete;
+
+    SubqueryPlan& operator=(const SubqueryPlan& other) = delete;
+
+    SubqueryPlan& operator=(SubqueryPlan&& temp) = delete;
+
+    /**
+     * Selects the outer rows the where clause keeps. Each join is built from
+     * its table first. The outer rows matching the other conjuncts are then
+     * selected, and only their join columns are projected and tested.
+     * @param outer The outer table
+     * @param tables Opens the subqueries' tables
+     * @return Handles of the rows kept (freed by caller), in (block ID, record ID) order
+     */
+    virtual Handles* select(HeapTable& outer, const TableResolver& tables) const;
+
+    /**
+     * Describes the plan, one line per join, then the remaining filter
+     */
+    virtual std::string to_string() const;
+
+    /**
+     * Retrieves the number of subqueries rewritten into joins
+     */
+    virtual std::size_t size() const { return this->subqueries.size(); }
+
+protected:
+    struct Subquery {
+        HashSemiJoin::Kind kind;
+        Identifier outer_column;  // empty for an uncorrelated EXISTS
+        Identifier inner_table;
+        Identifier inner_column;  // empty for an uncorrelated EXISTS
+        Predicate* where;         // the subquery's other conjuncts (nullptr for none)
+    };
+
+    std::vector<Subquery> subqueries;
+    Predicate* where;  // the conjuncts without subqueries (nullptr for none)
+
+    /**
+     * Rewrites one subquery into a join
+     * @param kind SEMI, or ANTI if the subquery was negated
+     * @param in_column The column tested by IN (nullptr for EXISTS)
+     * @param select The subquery
+     * @param outer_table The name outer columns are qualified with
+     */
+    virtual void add_subquery(HashSemiJoin::Kind kind, const hsql::Expr* in_column,
+                              const hsql::SelectStatement* select, const Identifier& outer_table);
+
+    /**
+     * Frees the predicates of the plan
+     */
+    virtual void clear();
+};
+
+/**
+ * Joins outer rows with a 100,000-row table on its primary key, by
+ * IndexNestedLoopJoin and by a hash join that scans the table. Each join is
+ * run with 1%, 10% and all of the outer rows.
+ * @param max_outer The most outer rows joined
+ * @return A report of the timings
+ */
+std::string benchmark_index_join(std::size_t max_outer);
+
+/**
+ * Selects the outer rows that have a row in a 100,000-row table, as IN
+ * (SELECT ...) would, first with HashSemiJoin, then by materializing the join
+ * and removing repeated outer rows. The inner rows reference twice as many
+ * keys as there are outer rows, so about half of them match one.
+ * @param n_outer The number of outer rows
+ * @return A report of the timings
+ */
+std::string benchmark_semi_join(std::size_t n_outer);
+
+/**
+ * Join operator test function. Returns true if all tests pass.
+ */
+bool test_join_operators();
@@ -0,0 +1,490 @@
+/**
+ * @file partitioned_storage.cpp - Implementation of tables split across several heap files.
+ * PartitionedTable: DbRelation
+ * RangePartitionedTable: PartitionedTable
+ * HashPartitionedTable: PartitionedTable
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include "partitioned_storage.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include "btree_storage.h"
+
+// Begin Partitioned Table Functions
+
+PartitionedTable::PartitionedTable(Identifier table_name, ColumnNames column_names,
+                                   ColumnAttributes column_attributes, Identifier partition_column)
+    : DbRelation(table_name, column_names, column_attributes), partition_column(partition_column), partitions()
+{
+    if (std::find(this->column_names.begin(), this->column_names.end(), partition_column) == this->column_names.end())
+        throw DbRelationError("unknown partition column " + partition_column);
+}
+
+PartitionedTable::~PartitionedTable() {
+    for (HeapTable* partition : this->partitions)
+        delete partition;
+}
+
+void PartitionedTable::create() {
+    for (HeapTable* partition : this->partitions)
+        partition->create();
+    HeapTable::bump_version(this->table_name);
+}
+
+void PartitionedTable::create_if_not_exists() {
+    for (HeapTable* partition : this->partitions)
+        partition->create_if_not_exists();
+    HeapTable::bump_version(this->table_name);
+}
+
+void PartitionedTable::drop() {
+    for (HeapTable* partition : this->partitions)
+        partition->drop();
+    HeapTable::bump_version(this->table_name);
+}
+
+void PartitionedTable::open() {
+    for (HeapTable* partition : this->partitions)
+        partition->open();
+}
+
+void PartitionedTable::close() {
+    for (HeapTable* partition : this->partitions)
+        partition->close();
+}
+
+Handle PartitionedTable::insert(const ValueDict* row) {
+    ValueDict::const_iterator value = row->find(this->partition_column);
+    if (value == row->end())
+        throw DbRelationError("missing column name");
+    std::size_t partition = this->partition_of(value->second);
+    Handle handle = PartitionedTable::to_table_handle(partition, this->partitions[partition]->insert(row));
+    HeapTable::bump_version(this->table_name);
+    return handle;
+}
+
+Handles* PartitionedTable::insert_batch(const std::vector<const ValueDict*>& rows) {
+    // group the rows by partition, remembering where each came from
+    std::vector<std::vector<const ValueDict*>> groups(this->partitions.size());
+    std::vector<std::vector<std::size_t>> positions(this->partitions.size());
+    for (std::size_t i = 0; i < rows.size(); i++) {
+        ValueDict::const_iterator value = rows[i]->find(this->partition_column);
+        if (value == rows[i]->end())
+            throw DbRelationError("missing column name");
+        std::size_t partition = this->partition_of(value->second);
+        groups[partition].push_back(rows[i]);
+        positions[partition].push_back(i);
+    }
+    std::vector<std::size_t> targets;
+    for (std::size_t partition = 0; partition < groups.size(); partition++)
+        if (!groups[partition].empty())
+            targets.push_back(partition);
+
+    Handles* handles = new Handles(rows.size());
+    try {
+        PartitionedTable::run_parallel(targets, [&](std::size_t partition) {
+            Handles* inserted = this->partitions[partition]->insert_batch(groups[partition]);
+            for (std::size_t j = 0; j < inserted->size(); j++)
+                (*handles)[positions[partition][j]] = PartitionedTable::to_table_handle(partition, (*inserted)[j]);
+            delete inserted;
+        });
+    } catch (...) {
+        delete handles;
+        HeapTable::bump_version(this->table_name);
+        throw;
+    }
+    HeapTable::bump_version(this->table_name);
+    return handles;
+}
+
+void PartitionedTable::update(const Handle handle, const ValueDict* new_values) {
+    Handle partition_handle;
+    HeapTable* partition = this->to_partition(handle, partition_handle);
+    ValueDict::const_iterator value = new_values->find(this->partition_column);
+    HeapTable* target = value == new_values->end() ? partition : this->partitions[this->partition_of(value->second)];
+    if (target == partition) {
+        partition->update(partition_handle, new_values);
+    } else {
+        ValueDict* row = partition->project(partition_handle);
+        for (auto const& new_value : *new_values)
+            (*row)[new_value.first] = new_value.second;
+        try {
+            target->insert(row);
+        } catch (DbRelationError& e) {
+            delete row;
+            throw;
+        }
+        partition->del(partition_handle);
+        delete row;
+    }
+    HeapTable::bump_version(this->table_name);
+}
+
+void PartitionedTable::del(const Handle handle) {
+    Handle partition_handle;
+    this->to_partition(handle, partition_handle)->del(partition_handle);
+    HeapTable::bump_version(this->table_name);
+}
+
+Handles* PartitionedTable::select() {
+    return this->select((const Predicate*)nullptr);
+}
+
+Handles* PartitionedTable::select(const ValueDict* where) {
+    Predicate* predicate = Predicate::from_where(where);
+    try {
+        Handles* handles = this->select(predicate);
+        delete predicate;
+        return handles;
+    } catch (PredicateError& e) {
+        delete predicate;
+        throw DbRelationError(e.what());
+    }
+}
+
+Handles* PartitionedTable::select(const Predicate* where) {
+    std::vector<std::size_t> targets = this->prune(where);
+    std::vector<Handles*> found(targets.size(), nullptr);
+    std::vector<std::size_t> slots(this->partitions.size());
+    for (std::size_t i = 0; i < targets.size(); i++)
+        slots[targets[i]] = i;
+    try {
+        PartitionedTable::run_parallel(targets, [&](std::size_t partition) {
+            found[slots[partition]] = this->partitions[partition]->select(where);
+        });
+    } catch (...) {
+        for (Handles* partition_handles : found)
+            delete partition_handles;
+        throw;
+    }
+    Handles* handles = new Handles();
+    for (std::size_t i = 0; i < targets.size(); i++) {
+        for (const Handle& handle : *found[i])
+            handles->push_back(PartitionedTable::to_table_handle(targets[i], handle));
+        delete found[i];
+    }
+    return handles;
+}
+
+ValueDict* PartitionedTable::project(Handle handle) {
+    return this->project(handle, nullptr);
+}
+
+ValueDict* PartitionedTable::project(Handle handle, const ColumnNames* column_names) {
+    Handle partition_handle;
+    HeapTable* partition = this->to_partition(handle, partition_handle);
+    return partition->project(partition_handle, column_names);
+}
+
+HeapTable* PartitionedTable::new_partition(const Identifier& suffix) const {
+    return new HeapTable(this->table_name + "_" + suffix, this->column_names, this->column_attributes);
+}
+
+Handle PartitionedTable::to_table_handle(std::size_t partition, Handle handle) {
+    if (handle.first >= MAX_BLOCKS)
+        throw DbRelationError("partition has too many blocks");
+    return Handle((BlockID)(partition << (32 - PARTITION_BITS)) | handle.first, handle.second);
+}
+
+HeapTable* PartitionedTable::to_partition(Handle handle, Handle& partition_handle) const {
+    std::size_t partition = handle.first >> (32 - PARTITION_BITS);
+    if (partition >= this->partitions.size())
+        throw DbRelationError("no partition for handle");
+    partition_handle = Handle(handle.first & (MAX_BLOCKS - 1), handle.second);
+    return this->partitions[partition];
+}
+
+void PartitionedTable::run_parallel(const std::vector<std::size_t>& partitions,
+                                    const std::function<void(std::size_t)>& job) {
+    std::size_t n_threads = std::min<std::size_t>(partitions.size(), std::max(1u, std::thread::hardware_concurrency()));
+    if (n_threads <= 1) {
+        for (std::size_t partition : partitions)
+            job(partition);
+        return;
+    }
+    std::atomic<std::size_t> next(0);
+    std::vector<std::exception_ptr> errors(partitions.size());
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < n_threads; t++) {
+        threads.emplace_back([&] {
+            for (std::size_t i = next++; i < partitions.size(); i = next++) {
+                try {
+                    job(partitions[i]);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    for (std::exception_ptr& error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
+
+// End Partitioned Table Functions
+
+// Begin Range Partitioned Table Functions
+
+RangePartitionedTable::RangePartitionedTable(Identifier table_name, ColumnNames column_names,
+                                             ColumnAttributes column_attributes, Identifier partition_column,
+                                             std::vector<int32_t> lower_bounds)
+    : PartitionedTable(table_name, column_names, column_attributes, partition_column), lower_bounds()
+{
+    ColumnAttribute ca = this->column_attributes[std::find(this->column_names.begin(), this->column_names.end(),
+                                                           partition_column) - this->column_names.begin()];
+    if (ca.get_data_type() != ColumnAttribute::INT)
+        throw DbRelationError("range partition column must be INT");
+    // left uncreated, for create() or open()
+    for (int32_t lower_bound : lower_bounds)
+        this->append_partition(lower_bound);
+}
+
+void RangePartitionedTable::add_partition(int32_t lower_bound) {
+    // partitions are created together, so the first one's file tells whether the table exists
+    bool exists = !this->lower_bounds.empty() &&
+                  HeapFile(this->table_name + "_p" + std::to_string(this->lower_bounds.front())).exists();
+    HeapTable* partition = this->append_partition(lower_bound);
+    if (!exists)
+        return;
+    try {
+        partition->create();
+    } catch (...) {
+        delete partition;
+        this->partitions.pop_back();
+        this->lower_bounds.pop_back();
+        throw;
+    }
+    HeapTable::bump_version(this->table_name);
+}
+
+HeapTable* RangePartitionedTable::append_partition(int32_t lower_bound) {
+    if (!this->lower_bounds.empty() && lower_bound <= this->lower_bounds.back())
+        throw DbRelationError("partition lower bounds must ascend");
+    if (this->partitions.size() == (std::size_t)1 << PARTITION_BITS)
+        throw DbRelationError("too many partitions");
+    this->partitions.push_back(this->new_partition("p" + std::to_string(lower_bound)));
+    this->lower_bounds.push_back(lower_bound);
+    return this->partitions.back();
+}
+
+void RangePartitionedTable::drop_partition(int32_t lower_bound) {
+    std::vector<int32_t>::iterator bound =
+        std::find(this->lower_bounds.begin(), this->lower_bounds.end(), lower_bound);
+    if (bound == this->lower_bounds.end())
+        throw DbRelationError("no partition with lower bound " + std::to_string(lower_bound));
+    std::size_t partition = bound - this->lower_bounds.begin();
+    this->partitions[partition]->drop();
+    delete this->partitions[partition];
+    this->partitions.erase(this->partitions.begin() + partition);
+    this->lower_bounds.erase(bound);
+    HeapTable::bump_version(this->table_name);
+}
+
+std::size_t RangePartitionedTable::partition_of(const Value& value) const {
+    if (value.data_type != ColumnAttribute::INT)
+        throw DbRelationError("range partition column must be INT");
+    std::vector<int32_t>::const_iterator next =
+        std::upper_bound(this->lower_bounds.begin(), this->lower_bounds.end(), value.n);
+    if (next == this->lower_bounds.begin())
+        throw DbRelationError("no partition for value " + std::to_string(value.n));
+    return next - this->lower_bounds.begin() - 1;
+}
+
+std::vector<std::size_t> RangePartitionedTable::prune(const Predicate* where) const {
+    const Value* low = nullptr;
+    const Value* high = nullptr;
+    if (where)
+        where->get_bounds(this->partition_column, low, high);
+    std::vector<std::size_t> partitions;
+    for (std::size_t i = 0; i < this->lower_bounds.size(); i++) {
+        // partition i holds [lower_bounds[i], lower_bounds[i + 1])
+        bool last = i + 1 == this->lower_bounds.size();
+        if (low && low->data_type == ColumnAttribute::INT && !last && low->n >= this->lower_bounds[i + 1])
+            continue;
+        if (high && high->data_type == ColumnAttribute::INT && high->n < this->lower_bounds[i])
+            continue;
+        partitions.push_back(i);
+    }
+    return partitions;
+}
+
+// End Range Partitioned Table Functions
+
+// Begin Hash Partitioned Table Functions
+
+/**
+ * Collects the values a predicate pins a column to with = and IN
+ * @param where The predicate
+ * @param column The column
+ * @param values Set to the values if there are any
+ * @return False if rows with any value of the column could match
+ */
+static bool pinned_values(const Predicate* where, const Identifier& column, std::vector<Value>& values) {
+    switch (where->get_op()) {
+        case Predicate::EQ:
+        case Predicate::IN:
+            if (where->get_column() != column)
+                return false;
+            values = where->get_operands();
+            return true;
+        case Predicate::AND:
+            return pinned_values(where->get_left(), column, values) ||
+                   pinned_values(where->get_right(), column, values);
+        case Predicate::OR: {
+            std::vector<Value> right;
+            if (!pinned_values(where->get_left(), column, values) || !pinned_values(where->get_right(), column, right))
+                return false;
+            values.insert(values.end(), right.begin(), right.end());
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+HashPartitionedTable::HashPartitionedTable(Identifier table_name, ColumnNames column_names,
+                                           ColumnAttributes column_attributes, Identifier partition_column,
+                                           std::size_t partition_count)
+    : PartitionedTable(table_name, column_names, column_attributes, partition_column)
+{
+    if (!partition_count || partition_count > (std::size_t)1 << PARTITION_BITS)
+        throw DbRelationError("partition count must be 1 to " + std::to_string(1 << PARTITION_BITS));
+    for (std::size_t i = 0; i < partition_count; i++)
+        this->partitions.push_back(this->new_partition("h" + std::to_string(i)));
+}
+
+std::size_t HashPartitionedTable::partition_of(const Value& value) const {
+    // FNV-1a over the value's key encoding, which is the same on every run
+    u_int32_t hash = 2166136261u;
+    for (char c : encode_key(value)) {
+        hash ^= (unsigned char)c;
+        hash *= 16777619u;
+    }
+    return hash % this->partitions.size();
+}
+
+std::vector<std::size_t> HashPartitionedTable::prune(const Predicate* where) const {
+    std::vector<std::size_t> partitions;
+    std::vector<Value> values;
+    if (!where || !pinned_values(where, this->partition_column, values)) {
+        for (std::size_t i = 0; i < this->partitions.size(); i++)
+            partitions.push_back(i);
+        return partitions;
+    }
+    for (const Value& value : values)
+        partitions.push_back(this->partition_of(value));
+    std::sort(partitions.begin(), partitions.end());
+    partitions.erase(std::unique(partitions.begin(), partitions.end()), partitions.end());
+    return partitions;
+}
+
+// End Hash Partitioned Table Functions
+
+bool test_partitioned_storage() {
+    ColumnNames column_names;
+    column_names.push_back("t");
+    column_names.push_back("event");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+
+    // Three day-sized partitions of an event log
+    RangePartitionedTable table("_test_ranges_cpp", column_names, column_attributes, "t", {0, 100, 200});
+    table.create_if_not_exists();
+    std::cout << "range create ok" << std::endl;
+
+    ValueDict row;
+    for (int32_t t : {5, 150, 250, 120, 10}) {
+        row["t"] = Value(t);
+        row["event"] = Value("event " + std::to_string(t));
+        table.insert(&row);
+    }
+    bool route_ok = false;
+    row["t"] = Value(-1);
+    try {
+        table.insert(&row);
+    } catch (DbRelationError& e) {
+        route_ok = true;
+    }
+    std::cout << "range insert ok" << std::endl;
+
+    // A predicate within one day scans only that partition
+    Predicate day(Predicate::BETWEEN, "t", std::vector<Value>{Value(100), Value(199)});
+    Handles* handles = table.select(&day);
+    bool prune_ok = handles->size() == 2;
+    ValueDict* found = table.project((*handles)[0]);
+    prune_ok = prune_ok && (*found)["event"].s == "event 150";
+    delete found;
+
+    // Moving a row across partitions, then dropping the oldest day
+    ValueDict new_values;
+    new_values["t"] = Value(50);
+    table.update((*handles)[0], &new_values);
+    delete handles;
+    table.drop_partition(0);
+    handles = table.select();
+    bool drop_ok = handles->size() == 2 && table.get_partition_count() == 2;
+    delete handles;
+    std::cout << "range prune/drop ok" << std::endl;
+
+    // Rolling a new day onto the live table
+    table.add_partition(300);
+    row["t"] = Value(310);
+    row["event"] = Value("event 310");
+    Handle added = table.insert(&row);
+    found = table.project(added);
+    handles = table.select();
+    bool add_ok = table.get_partition_count() == 3 && handles->size() == 3 && (*found)["event"].s == "event 310";
+    delete found;
+    delete handles;
+    std::cout << "range add ok" << std::endl;
+
+    table.drop();
+
+    // Four hash partitions, filled by a concurrent batch insert
+    HashPartitionedTable hashed("_test_hashed_cpp", column_names, column_attributes, "t", 4);
+    hashed.create_if_not_exists();
+    std::vector<ValueDict> rows(100);
+    std::vector<const ValueDict*> batch;
+    for (int32_t t = 0; t < 100; t++) {
+        rows[t]["t"] = Value(t);
+        rows[t]["event"] = Value("event " + std::to_string(t));
+        batch.push_back(&rows[t]);
+    }
+    handles = hashed.insert_batch(batch);
+    found = hashed.project((*handles)[42]);
+    bool hash_ok = handles->size() == 100 && (*found)["t"].n == 42;
+    delete found;
+    delete handles;
+    handles = hashed.select();
+    hash_ok = hash_ok && handles->size() == 100;
+    delete handles;
+
+    // An equality lookup touches the one partition its value hashes to
+    Predicate in(Predicate::IN, "t", std::vector<Value>{Value(7), Value(63)});
+    handles = hashed.select(&in);
+    hash_ok = hash_ok && handles->size() == 2;
+    delete handles;
+    Predicate eq(Predicate::EQ, "t", std::vector<Value>(1, Value(42)));
+    handles = hashed.select(&eq);
+    hash_ok = hash_ok && handles->size() == 1;
+    delete handles;
+
+    // Every partition got a share of the rows
+    for (std::size_t i = 0; i < hashed.get_partition_count(); i++) {
+        handles = hashed.get_partition(i)->select();
+        hash_ok = hash_ok && !handles->empty();
+        delete handles;
+    }
+    std::cout << "hash partitions ok" << std::endl;
+
+    hashed.drop();
+    return route_ok && prune_ok && drop_ok && add_ok && hash_ok;
+}
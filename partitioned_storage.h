@@ -0,0 +1,320 @@
+/**
+ * @file partitioned_storage.h - Tables split across several heap files.
+ * PartitionedTable: DbRelation
+ * RangePartitionedTable: PartitionedTable
+ * HashPartitionedTable: PartitionedTable
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <functional>
+#include <vector>
+#include "heap_storage.h"
+#include "predicate.h"
+#include "storage_engine.h"
+
+/**
+ * @class PartitionedTable - a table whose rows are split across partitions by
+ * the value of one column (implementation of DbRelation)
+ *
+ * Each partition is a HeapTable with its own heap file, named after the table
+ * and the partition. Subclasses decide which partition a value belongs to and
+ * which partitions a predicate could match. Partitions share no state, so
+ * selects and batch inserts work on several partitions at once, one thread
+ * per partition up to the number of cores.
+ *
+ * A handle carries its partition's position in the top PARTITION_BITS bits of
+ * the block ID, so handles stay valid only until partitions are added before
+ * or dropped from in front of the row's partition.
+ */
+class PartitionedTable : public DbRelation {
+public:
+    static const unsigned PARTITION_BITS = 12;
+    static const BlockID MAX_BLOCKS = (BlockID)1 << (32 - PARTITION_BITS);  // per partition
+
+    /**
+     * @param table_name The name of the table
+     * @param column_names The table's column names
+     * @param column_attributes The table's column attributes
+     * @param partition_column The column rows are partitioned on
+     */
+    PartitionedTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                     Identifier partition_column);
+
+    virtual ~PartitionedTable();
+
+    PartitionedTable(const PartitionedTable& other) = delete;
+
+    PartitionedTable(PartitionedTable&& temp) = delete;
+
+    PartitionedTable& operator=(const PartitionedTable& other) = delete;
+
+    PartitionedTable& operator=(PartitionedTable&& temp) = delete;
+
+    /**
+     * Creates every partition
+     */
+    virtual void create();
+
+    /**
+     * Creates the partitions that don't already exist
+     */
+    virtual void create_if_not_exists();
+
+    /**
+     * Drops every partition
+     */
+    virtual void drop();
+
+    /**
+     * Opens every partition
+     */
+    virtual void open();
+
+    /**
+     * Closes every partition
+     */
+    virtual void close();
+
+    /**
+     * Inserts a row into the partition its partition column value belongs to
+     * @param row The data tuple to insert
+     * @return A handle locating the inserted tuple
+     * @throws DbRelationError if no partition holds the row's value
+     */
+    virtual Handle insert(const ValueDict* row);
+
+    /**
+     * Inserts rows, grouped by partition, into all their partitions at once
+     * @param rows The data tuples to insert
+     * @return Handles locating the inserted tuples, in the order of rows (freed by caller)
+     * @throws DbRelationError if no partition holds a row's value, or a
+     *         partition rejects its rows (other partitions keep theirs)
+     */
+    virtual Handles* insert_batch(const std::vector<const ValueDict*>& rows);
+
+    /**
+     * Updates a row, moving it if its partition column value now belongs to
+     * another partition (which gives it a new handle)
+     * @param handle The handle of the row
+     * @param new_values The new fields to replace the existing fields with
+     */
+    virtual void update(const Handle handle, const ValueDict* new_values);
+
+    /**
+     * Deletes a row
+     * @param handle The handle of the row
+     */
+    virtual void del(const Handle handle);
+
+    /**
+     * Selects every row, partition by partition
+     */
+    virtual Handles* select();
+
+    /**
+     * Selects rows matching equality predicates, scanning only the partitions
+     * that could hold them
+     * @param where The where-clause predicates
+     * @return Handles of the matching rows
+     */
+    virtual Handles* select(const ValueDict* where);
+
+    /**
+     * Selects rows matching a predicate, scanning only the partitions that
+     * could hold them, concurrently
+     * @param where The predicate (nullptr for all rows)
+     * @return Handles of the matching rows, partition by partition
+     */
+    virtual Handles* select(const Predicate* where);
+
+    /**
+     * Return a sequence of all values for handle (SELECT *).
+     * @param handle The handle of the row
+     * @returns Dictionary of values from row (keyed by all column names)
+     */
+    virtual ValueDict* project(Handle handle);
+
+    /**
+     * Return a sequence of values for handle given by column_names
+     * @param handle The handle of the row
+     * @param column_names List of column names to project
+     * @returns Dictionary of values from row (keyed by column_names)
+     */
+    virtual ValueDict* project(Handle handle, const ColumnNames* column_names);
+
+    /**
+     * Retrieves the name of the partition column
+     */
+    virtual const Identifier& get_partition_column() const { return this->partition_column; }
+
+    /**
+     * Retrieves the number of partitions
+     */
+    virtual std::size_t get_partition_count() const { return this->partitions.size(); }
+
+    /**
+     * Retrieves a partition, for working on it directly (e.g. one thread per partition)
+     * @param partition The partition's position
+     */
+    virtual HeapTable* get_partition(std::size_t partition) { return this->partitions.at(partition); }
+
+protected:
+    Identifier partition_column;
+    std::vector<HeapTable*> partitions;
+
+    /**
+     * Finds the partition a partition column value belongs to
+     * @param value The value
+     * @return The partition's position
+     * @throws DbRelationError if no partition holds the value
+     */
+    virtual std::size_t partition_of(const Value& value) const = 0;
+
+    /**
+     * Finds the partitions that could hold rows matching a predicate
+     * @param where The predicate (nullptr for all rows)
+     * @return The positions of the partitions, in order
+     */
+    virtual std::vector<std::size_t> prune(const Predicate* where) const = 0;
+
+    /**
+     * Creates the HeapTable for a partition (freed by caller)
+     * @param suffix Appended to the table's name to name the partition
+     */
+    virtual HeapTable* new_partition(const Identifier& suffix) const;
+
+    /**
+     * Converts a partition's handle to a handle of this table
+     * @param partition The partition's position
+     * @param handle The handle within the partition
+     * @throws DbRelationError if the partition has outgrown MAX_BLOCKS
+     */
+    static Handle to_table_handle(std::size_t partition, Handle handle);
+
+    /**
+     * Finds the partition of a handle of this table
+     * @param handle The handle
+     * @param partition_handle Set to the handle within the partition
+     * @return The partition
+     * @throws DbRelationError if the handle names no partition
+     */
+    virtual HeapTable* to_partition(Handle handle, Handle& partition_handle) const;
+
+    /**
+     * Runs a job for each of some partitions, concurrently when there are several
+     * @param partitions The positions of the partitions
+     * @param job Called with the position of each partition
+     * @throws The first exception a job threw, after every job has finished
+     */
+    static void run_parallel(const std::vector<std::size_t>& partitions, const std::function<void(std::size_t)>& job);
+};
+
+/**
+ * @class RangePartitionedTable - partitions rows by ranges of an INT column
+ *
+ * Each partition holds the rows whose partition column is at least its lower
+ * bound and below the next partition's. Meant for append-only tables keyed
+ * by time (e.g. epoch seconds or days): new ranges are added at the end, and
+ * old data is discarded by dropping a partition's file instead of deleting
+ * its rows. A select only scans partitions overlapping the bounds its
+ * predicate places on the partition column.
+ */
+class RangePartitionedTable : public PartitionedTable {
+public:
+    /**
+     * @param table_name The name of the table
+     * @param column_names The table's column names
+     * @param column_attributes The table's column attributes
+     * @param partition_column The INT column rows are partitioned on
+     * @param lower_bounds Each partition's smallest value, ascending
+     */
+    RangePartitionedTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                          Identifier partition_column, std::vector<int32_t> lower_bounds);
+
+    virtual ~RangePartitionedTable() {}
+
+    RangePartitionedTable(const RangePartitionedTable& other) = delete;
+
+    RangePartitionedTable(RangePartitionedTable&& temp) = delete;
+
+    RangePartitionedTable& operator=(const RangePartitionedTable& other) = delete;
+
+    RangePartitionedTable& operator=(RangePartitionedTable&& temp) = delete;
+
+    /**
+     * Adds a partition after the last one. If the table's partitions already
+     * exist on disk, the new partition's file is created too.
+     * @param lower_bound The partition's smallest value, above every existing lower bound
+     */
+    virtual void add_partition(int32_t lower_bound);
+
+    /**
+     * Drops a partition, removing its file and rows. Rows inserted later in its
+     * range go to the partition before it, if there is one.
+     * @param lower_bound The partition's lower bound
+     */
+    virtual void drop_partition(int32_t lower_bound);
+
+    /**
+     * Retrieves each partition's smallest value, ascending
+     */
+    virtual const std::vector<int32_t>& get_lower_bounds() const { return this->lower_bounds; }
+
+protected:
+    std::vector<int32_t> lower_bounds;
+
+    /**
+     * Appends a partition without creating its file
+     * @param lower_bound The partition's smallest value, above every existing lower bound
+     * @return The new partition
+     */
+    virtual HeapTable* append_partition(int32_t lower_bound);
+
+    virtual std::size_t partition_of(const Value& value) const;
+
+    virtual std::vector<std::size_t> prune(const Predicate* where) const;
+};
+
+/**
+ * @class HashPartitionedTable - partitions rows by a hash of one column
+ *
+ * Spreads rows evenly over a number of partitions fixed when the table is
+ * created, so ingest and scans split into that many independent pieces. A
+ * select whose predicate pins the partition column to particular values
+ * (with = or IN) only scans the partitions those values hash to.
+ */
+class HashPartitionedTable : public PartitionedTable {
+public:
+    /**
+     * @param table_name The name of the table
+     * @param column_names The table's column names
+     * @param column_attributes The table's column attributes
+     * @param partition_column The column rows are partitioned on
+     * @param partition_count The number of partitions
+     */
+    HashPartitionedTable(Identifier table_name, ColumnNames column_names, ColumnAttributes column_attributes,
+                         Identifier partition_column, std::size_t partition_count);
+
+    virtual ~HashPartitionedTable() {}
+
+    HashPartitionedTable(const HashPartitionedTable& other) = delete;
+
+    HashPartitionedTable(HashPartitionedTable&& temp) = delete;
+
+    HashPartitionedTable& operator=(const HashPartitionedTable& other) = delete;
+
+    HashPartitionedTable& operator=(HashPartitionedTable&& temp) = delete;
+
+protected:
+    virtual std::size_t partition_of(const Value& value) const;
+
+    virtual std::vector<std::size_t> prune(const Predicate* where) const;
+};
+
+/**
+ * Partitioned storage test function. Returns true if all tests pass.
+ */
+bool test_partitioned_storage();
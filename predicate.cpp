@@ -0,0 +1,552 @@
+/**
+ * @file predicate.cpp - Implementation of compiled where-clause predicates.
+ * AdaptiveConjunction
+ * FilterProfile
+ * Predicate
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include "predicate.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include "SQLParser.h"
+#include "record_layout.h"
+#include "text_kernels.h"
+
+using u16 = u_int16_t;
+
+static inline int compare_text(const char* record, u16 offset, const std::string& s) {
+    u16 size;
+    const char* text = RecordLayout::get_text(record, offset, size);
+    int cmp = std::memcmp(text, s.data(), std::min<std::size_t>(size, s.size()));
+    if (cmp)
+        return cmp;
+    return size < s.size() ? -1 : size > s.size() ? 1 : 0;
+}
+
+template <typename Compare>
+static RecordFilter int_filter(u16 offset, int32_t value, Compare compare) {
+    return [offset, value, compare](const char* record) {
+        return compare(RecordLayout::get_int(record, offset), value);
+    };
+}
+
+template <typename Compare>
+static RecordFilter text_filter(u16 offset, const std::string& value, Compare compare) {
+    return [offset, value, compare](const char* record) {
+        return compare(compare_text(record, offset, value), 0);
+    };
+}
+
+static RecordFilter compile_int(Predicate::Op op, u16 offset, const std::vector<Value>& operands) {
+    int32_t a = operands[0].n;
+    switch (op) {
+        case Predicate::EQ:
+            return int_filter(offset, a, std::equal_to<int32_t>());
+        case Predicate::NE:
+            return int_filter(offset, a, std::not_equal_to<int32_t>());
+        case Predicate::LT:
+            return int_filter(offset, a, std::less<int32_t>());
+        case Predicate::LE:
+            return int_filter(offset, a, std::less_equal<int32_t>());
+        case Predicate::GT:
+            return int_filter(offset, a, std::greater<int32_t>());
+        case Predicate::GE:
+            return int_filter(offset, a, std::greater_equal<int32_t>());
+        case Predicate::BETWEEN: {
+            int32_t b = operands[1].n;
+            return [offset, a, b](const char* record) {
+                int32_t n = RecordLayout::get_int(record, offset);
+                return a <= n && n <= b;
+            };
+        }
+        case Predicate::IN: {
+            std::vector<int32_t> values;
+            for (const Value& operand : operands)
+                values.push_back(operand.n);
+            std::sort(values.begin(), values.end());
+            return [offset, values](const char* record) {
+                return std::binary_search(values.begin(), values.end(), RecordLayout::get_int(record, offset));
+            };
+        }
+        default:
+            throw PredicateError("LIKE needs a TEXT column");
+    }
+}
+
+/**
+ * Builds a filter that tests a TEXT column in place with one of the text kernels
+ */
+template <typename Kernel>
+static RecordFilter text_kernel_filter(u16 offset, const std::string& value, Kernel kernel, bool expected = true) {
+    return [offset, value, kernel, expected](const char* record) {
+        u16 size;
+        const char* text = RecordLayout::get_text(record, offset, size);
+        return kernel(text, size, value.data(), value.size()) == expected;
+    };
+}
+
+static RecordFilter compile_text(Predicate::Op op, u16 offset, const std::vector<Value>& operands) {
+    const std::string& a = operands[0].s;
+    switch (op) {
+        case Predicate::EQ:
+            return text_kernel_filter(offset, a, text_equals);
+        case Predicate::NE:
+            return text_kernel_filter(offset, a, text_equals, false);
+        case Predicate::LT:
+            return text_filter(offset, a, std::less<int>());
+        case Predicate::LE:
+            return text_filter(offset, a, std::less_equal<int>());
+        case Predicate::GT:
+            return text_filter(offset, a, std::greater<int>());
+        case Predicate::GE:
+            return text_filter(offset, a, std::greater_equal<int>());
+        case Predicate::BETWEEN: {
+            std::string b = operands[1].s;
+            return [offset, a, b](const char* record) {
+                return compare_text(record, offset, a) >= 0 && compare_text(record, offset, b) <= 0;
+            };
+        }
+        case Predicate::IN: {
+            std::vector<std::string> values;
+            for (const Value& operand : operands)
+                values.push_back(operand.s);
+            return [offset, values](const char* record) {
+                u16 size;
+                const char* text = RecordLayout::get_text(record, offset, size);
+                for (const std::string& value : values)
+                    if (text_equals(text, size, value.data(), value.size()))
+                        return true;
+                return false;
+            };
+        }
+        case Predicate::LIKE_PREFIX:
+            return text_kernel_filter(offset, a, text_starts_with);
+        case Predicate::LIKE_CONTAINS:
+            return text_kernel_filter(offset, a, text_contains);
+        default:
+            throw PredicateError("not a comparison");
+    }
+}
+
+/**
+ * @class AdaptiveConjunction - the compiled conjuncts of an AND, run in the
+ * order that rejects rows most cheaply
+ *
+ * Every SAMPLE_PERIOD-th row is a sample. Every conjunct runs on it, timed,
+ * so pass rates aren't skewed by the conjuncts that run before. Every
+ * REORDER_PERIOD samples, the conjuncts are ranked by cost per row rejected.
+ * That order is optimal for independent conjuncts. The new order is adopted
+ * only if its expected cost per row is below REORDER_GAIN times the current
+ * order's, so near-ties don't flap.
+ */
+class AdaptiveConjunction {
+public:
+    static const u_int64_t SAMPLE_PERIOD = 64;
+    static const u_int64_t REORDER_PERIOD = 16;
+    static const std::size_t MAX_DECISIONS = 32;  // reorders kept for the report
+    static constexpr double REORDER_GAIN = 0.9;
+
+    struct Conjunct {
+        RecordFilter filter;
+        std::string description;
+        u_int64_t sampled;
+        u_int64_t passed;
+        double ns;  // total time over the samples
+
+        double pass_rate() const { return this->sampled ? (double)this->passed / this->sampled : 1.0; }
+
+        double cost() const { return this->sampled ? this->ns / this->sampled : 0.0; }
+
+        double rank() const {
+            double rejected = 1.0 - this->pass_rate();
+            return rejected > 0.0 ? this->cost() / rejected : std::numeric_limits<double>::infinity();
+        }
+    };
+
+    struct Decision {
+        u_int64_t rows;  // rows tested before the reorder
+        std::string order;
+    };
+
+    explicit AdaptiveConjunction(std::vector<Conjunct> conjuncts)
+        : conjuncts(conjuncts), decisions(), rows(0), samples(0), reorders(0) {}
+
+    AdaptiveConjunction(const AdaptiveConjunction& other) = delete;
+
+    AdaptiveConjunction(AdaptiveConjunction&& temp) = delete;
+
+    AdaptiveConjunction& operator=(const AdaptiveConjunction& other) = delete;
+
+    AdaptiveConjunction& operator=(AdaptiveConjunction&& temp) = delete;
+
+    bool operator()(const char* record) {
+        if (++this->rows % SAMPLE_PERIOD)
+            return std::all_of(this->conjuncts.begin(), this->conjuncts.end(),
+                               [record](const Conjunct& conjunct) { return conjunct.filter(record); });
+        return this->sample(record);
+    }
+
+    /**
+     * Describes the conjuncts in their current order, with what was observed
+     */
+    void report(std::ostream& out) const {
+        out << "  AND of " << this->conjuncts.size() << " conjuncts: " << this->samples << " of " << this->rows
+            << " rows sampled, reordered " << this->reorders << " times" << std::endl;
+        std::size_t position = 1;
+        for (const Conjunct& conjunct : this->conjuncts)
+            out << "    " << position++ << ". " << conjunct.description << " (passes " << std::fixed
+                << std::setprecision(1) << 100 * conjunct.pass_rate() << "%, " << conjunct.cost() << "ns)"
+                << std::endl;
+        for (const Decision& decision : this->decisions)
+            out << "    reordered after " << decision.rows << " rows: " << decision.order << std::endl;
+        if (this->reorders > this->decisions.size())
+            out << "    (" << this->reorders - this->decisions.size() << " later reorders not shown)" << std::endl;
+    }
+
+protected:
+    std::vector<Conjunct> conjuncts;  // in evaluation order
+    std::vector<Decision> decisions;
+    u_int64_t rows;
+    u_int64_t samples;
+    u_int64_t reorders;
+
+    bool sample(const char* record) {
+        typedef std::chrono::steady_clock Clock;
+        bool result = true;
+        for (Conjunct& conjunct : this->conjuncts) {
+            Clock::time_point start = Clock::now();
+            bool passed = conjunct.filter(record);
+            conjunct.ns += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+            conjunct.sampled++;
+            conjunct.passed += passed;
+            result = result && passed;
+        }
+        if (++this->samples % REORDER_PERIOD == 0)
+            this->reorder();
+        return result;
+    }
+
+    static double expected_cost(const std::vector<Conjunct>& order) {
+        double cost = 0.0, reached = 1.0;
+        for (const Conjunct& conjunct : order) {
+            cost += reached * conjunct.cost();
+            reached *= conjunct.pass_rate();
+        }
+        return cost;
+    }
+
+    void reorder() {
+        std::vector<Conjunct> ranked(this->conjuncts);
+        std::stable_sort(ranked.begin(), ranked.end(),
+                         [](const Conjunct& a, const Conjunct& b) { return a.rank() < b.rank(); });
+        if (expected_cost(ranked) >= REORDER_GAIN * expected_cost(this->conjuncts))
+            return;
+        this->conjuncts.swap(ranked);
+        this->reorders++;
+        if (this->decisions.size() == MAX_DECISIONS)
+            return;
+        std::string order;
+        for (const Conjunct& conjunct : this->conjuncts)
+            order += (order.empty() ? "" : ", ") + conjunct.description;
+        this->decisions.push_back(Decision{this->rows, order});
+    }
+};
+
+constexpr double AdaptiveConjunction::REORDER_GAIN;
+
+/**
+ * Collects the operands of a chain of ANDs
+ */
+static void get_conjuncts(const Predicate* predicate, std::vector<const Predicate*>& conjuncts) {
+    if (predicate->get_op() != Predicate::AND) {
+        conjuncts.push_back(predicate);
+        return;
+    }
+    get_conjuncts(predicate->get_left(), conjuncts);
+    get_conjuncts(predicate->get_right(), conjuncts);
+}
+
+static std::string to_literal(const Value& value) {
+    if (value.data_type == ColumnAttribute::INT)
+        return std::to_string(value.n);
+    return "'" + value.s + "'";
+}
+
+// Begin Filter Profile Functions
+
+void FilterProfile::add(std::shared_ptr<AdaptiveConjunction> conjunction) {
+    this->conjunctions.push_back(conjunction);
+}
+
+std::string FilterProfile::report() const {
+    std::ostringstream out;
+    for (const std::shared_ptr<AdaptiveConjunction>& conjunction : this->conjunctions)
+        conjunction->report(out);
+    return out.str();
+}
+
+// End Filter Profile Functions
+
+// Begin Predicate Functions
+
+Predicate::Predicate(Op op, Identifier column, std::vector<Value> operands)
+    : op(op), column(column), operands(operands), left(nullptr), right(nullptr)
+{
+    std::size_t expected = op == BETWEEN ? 2 : 1;
+    if (op == IN ? operands.empty() : operands.size() != expected)
+        throw PredicateError("wrong number of operands for column " + column);
+}
+
+Predicate::Predicate(Op op, Predicate* left, Predicate* right)
+    : op(op), column(""), operands(), left(left), right(right)
+{}
+
+Predicate::~Predicate() {
+    delete this->left;
+    delete this->right;
+}
+
+RecordFilter Predicate::compile(const ColumnNames& column_names, const ColumnAttributes& column_attributes,
+                                FilterProfile* profile) const {
+    switch (this->op) {
+        case AND: {
+            std::vector<const Predicate*> operands;
+            get_conjuncts(this, operands);
+            std::vector<AdaptiveConjunction::Conjunct> conjuncts;
+            for (const Predicate* operand : operands)
+                conjuncts.push_back({operand->compile(column_names, column_attributes, profile), operand->to_string(),
+                                     0, 0, 0.0});
+            std::shared_ptr<AdaptiveConjunction> conjunction = std::make_shared<AdaptiveConjunction>(conjuncts);
+            if (profile)
+                profile->add(conjunction);
+            return [conjunction](const char* record) { return (*conjunction)(record); };
+        }
+        case OR: {
+            RecordFilter left = this->left->compile(column_names, column_attributes, profile);
+            RecordFilter right = this->right->compile(column_names, column_attributes, profile);
+            return [left, right](const char* record) { return left(record) || right(record); };
+        }
+        case NOT: {
+            RecordFilter left = this->left->compile(column_names, column_attributes, profile);
+            return [left](const char* record) { return !left(record); };
+        }
+        default:
+            break;
+    }
+
+    ColumnNames::const_iterator column = std::find(column_names.begin(), column_names.end(), this->column);
+    if (column == column_names.end())
+        throw PredicateError("unknown column " + this->column);
+    std::size_t col_num = column - column_names.begin();
+    ColumnAttribute ca = column_attributes[col_num];
+    ColumnAttribute::DataType data_type = ca.get_data_type();
+    for (const Value& operand : this->operands)
+        if (operand.data_type != data_type)
+            throw PredicateError("wrong type of value for column " + this->column);
+    u16 offset = RecordLayout(column_attributes).get_offset(col_num);
+    if (data_type == ColumnAttribute::INT)
+        return compile_int(this->op, offset, this->operands);
+    return compile_text(this->op, offset, this->operands);
+}
+
+std::string Predicate::to_string() const {
+    static const char* const comparisons[] = {"=", "<>", "<", "<=", ">", ">="};
+    switch (this->op) {
+        case AND:
+        case OR:
+            return "(" + this->left->to_string() + (this->op == AND ? " AND " : " OR ") + this->right->to_string() +
+                   ")";
+        case NOT:
+            return "NOT " + this->left->to_string();
+        case BETWEEN:
+            return this->column + " BETWEEN " + to_literal(this->operands[0]) + " AND " +
+                   to_literal(this->operands[1]);
+        case IN: {
+            std::string values;
+            for (const Value& operand : this->operands)
+                values += (values.empty() ? "" : ", ") + to_literal(operand);
+            return this->column + " IN (" + values + ")";
+        }
+        case LIKE_PREFIX:
+            return this->column + " LIKE '" + this->operands[0].s + "%'";
+        case LIKE_CONTAINS:
+            return this->column + " LIKE '%" + this->operands[0].s + "%'";
+        default:
+            return this->column + " " + comparisons[this->op] + " " + to_literal(this->operands[0]);
+    }
+}
+
+void Predicate::get_bounds(const Identifier& column, const Value*& low, const Value*& high) const {
+    if (this->op == AND) {
+        this->left->get_bounds(column, low, high);
+        this->right->get_bounds(column, low, high);
+        return;
+    }
+    if (this->column != column)
+        return;
+    switch (this->op) {
+        case EQ:
+        case BETWEEN:
+            if (!low)
+                low = &this->operands.front();
+            if (!high)
+                high = &this->operands.back();
+            break;
+        case LT:
+        case LE:
+            if (!high)
+                high = &this->operands[0];
+            break;
+        case GT:
+        case GE:
+        case LIKE_PREFIX:
+            if (!low)
+                low = &this->operands[0];
+            break;
+        default:
+            break;
+    }
+}
+
+void Predicate::get_columns(ColumnNames& columns) const {
+    if (this->left)
+        this->left->get_columns(columns);
+    if (this->right)
+        this->right->get_columns(columns);
+    if (!this->column.empty() && std::find(columns.begin(), columns.end(), this->column) == columns.end())
+        columns.push_back(this->column);
+}
+
+Predicate* Predicate::from_where(const ValueDict* where) {
+    Predicate* predicate = nullptr;
+    if (!where)
+        return predicate;
+    for (auto const& equality : *where) {
+        Predicate* term = new Predicate(EQ, equality.first, std::vector<Value>(1, equality.second));
+        predicate = predicate ? new Predicate(AND, predicate, term) : term;
+    }
+    return predicate;
+}
+
+/**
+ * Retrieves the column a parsed expression refers to
+ */
+static Identifier column_of(const hsql::Expr* expr) {
+    if (!expr || expr->type != hsql::ExprType::kExprColumnRef)
+        throw PredicateError("expected a column");
+    return expr->name;
+}
+
+/**
+ * Retrieves the literal a parsed expression holds
+ */
+static Value literal_of(const hsql::Expr* expr) {
+    if (expr && expr->type == hsql::ExprType::kExprLiteralInt)
+        return Value((int32_t)expr->ival);
+    if (expr && expr->type == hsql::ExprType::kExprLiteralString)
+        return Value(std::string(expr->name));
+    throw PredicateError("expected an INT or TEXT literal");
+}
+
+/**
+ * Builds a comparison from a parsed column-versus-literal expression, in either order
+ */
+static Predicate* comparison_of(Predicate::Op op, const hsql::Expr* expr) {
+    if (expr->expr && expr->expr->type == hsql::ExprType::kExprColumnRef)
+        return new Predicate(op, column_of(expr->expr), std::vector<Value>(1, literal_of(expr->expr2)));
+    // literal op column: mirror the comparison
+    switch (op) {
+        case Predicate::LT: op = Predicate::GT; break;
+        case Predicate::LE: op = Predicate::GE; break;
+        case Predicate::GT: op = Predicate::LT; break;
+        case Predicate::GE: op = Predicate::LE; break;
+        default: break;
+    }
+    return new Predicate(op, column_of(expr->expr2), std::vector<Value>(1, literal_of(expr->expr)));
+}
+
+/**
+ * Builds a LIKE predicate; only patterns with a single trailing %, or with
+ * one % at each end, are supported
+ */
+static Predicate* like_of(const hsql::Expr* expr) {
+    Value pattern = literal_of(expr->expr2);
+    if (pattern.data_type != ColumnAttribute::TEXT)
+        throw PredicateError("LIKE needs a TEXT pattern");
+    std::string::size_type wildcard = pattern.s.find_first_of("%_");
+    if (wildcard == std::string::npos)
+        return new Predicate(Predicate::EQ, column_of(expr->expr), std::vector<Value>(1, pattern));
+    std::string::size_type last = pattern.s.size() - 1;
+    if (wildcard == 0 && last > 0 && pattern.s[0] == '%' && pattern.s[last] == '%' &&
+        pattern.s.find_first_of("%_", 1) == last) {
+        Value infix(pattern.s.substr(1, last - 1));
+        return new Predicate(Predicate::LIKE_CONTAINS, column_of(expr->expr), std::vector<Value>(1, infix));
+    }
+    if (wildcard != last || pattern.s[wildcard] != '%')
+        throw PredicateError("only LIKE 'prefix%' and '%infix%' patterns are supported");
+    Value prefix(pattern.s.substr(0, wildcard));
+    return new Predicate(Predicate::LIKE_PREFIX, column_of(expr->expr), std::vector<Value>(1, prefix));
+}
+
+Predicate* Predicate::from_expr(const hsql::Expr* expr) {
+    if (!expr || expr->type != hsql::ExprType::kExprOperator)
+        throw PredicateError("unsupported where clause");
+    switch (expr->opType) {
+        case hsql::Expr::AND:
+        case hsql::Expr::OR: {
+            Predicate* left = Predicate::from_expr(expr->expr);
+            Predicate* right;
+            try {
+                right = Predicate::from_expr(expr->expr2);
+            } catch (PredicateError& e) {
+                delete left;
+                throw;
+            }
+            return new Predicate(expr->opType == hsql::Expr::AND ? AND : OR, left, right);
+        }
+        case hsql::Expr::NOT:
+            return new Predicate(NOT, Predicate::from_expr(expr->expr));
+        case hsql::Expr::SIMPLE_OP:
+            switch (expr->opChar) {
+                case '=': return comparison_of(EQ, expr);
+                case '<': return comparison_of(LT, expr);
+                case '>': return comparison_of(GT, expr);
+                default: throw PredicateError(std::string("unsupported operator ") + expr->opChar);
+            }
+        case hsql::Expr::NOT_EQUALS:
+            return comparison_of(NE, expr);
+        case hsql::Expr::LESS_EQ:
+            return comparison_of(LE, expr);
+        case hsql::Expr::GREATER_EQ:
+            return comparison_of(GE, expr);
+        case hsql::Expr::BETWEEN: {
+            if (!expr->exprList || expr->exprList->size() != 2)
+                throw PredicateError("BETWEEN needs two bounds");
+            std::vector<Value> bounds = {literal_of((*expr->exprList)[0]), literal_of((*expr->exprList)[1])};
+            return new Predicate(BETWEEN, column_of(expr->expr), bounds);
+        }
+        case hsql::Expr::IN: {
+            if (!expr->exprList)
+                throw PredicateError("IN needs a list of literals");
+            std::vector<Value> values;
+            for (const hsql::Expr* value : *expr->exprList)
+                values.push_back(literal_of(value));
+            return new Predicate(IN, column_of(expr->expr), values);
+        }
+        case hsql::Expr::LIKE:
+            return like_of(expr);
+        case hsql::Expr::NOT_LIKE:
+            return new Predicate(NOT, like_of(expr));
+        default:
+            throw PredicateError("unsupported where clause");
+    }
+}
+
+// End Predicate Functions
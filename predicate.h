@@ -0,0 +1,185 @@
+/**
+ * @file predicate.h - Where-clause predicates compiled to run on marshaled records.
+ * FilterProfile
+ * Predicate
+ * PredicateError
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "storage_engine.h"
+
+namespace hsql {
+struct Expr;
+}
+
+/**
+ * A compiled predicate: tests the marshaled bytes of one record. Filters
+ * compiled from predicates with AND keep statistics as they run, so each
+ * thread compiles its own.
+ */
+using RecordFilter = std::function<bool(const char*)>;
+
+class AdaptiveConjunction;
+
+/**
+ * @class PredicateError - a where clause that cannot be turned into a Predicate
+ */
+class PredicateError : public std::runtime_error {
+public:
+    explicit PredicateError(std::string s) : runtime_error(s) {}
+};
+
+/**
+ * @class FilterProfile - what the AND nodes of a compiled predicate observed
+ * while it ran, for EXPLAIN ANALYZE
+ */
+class FilterProfile {
+public:
+    FilterProfile() : conjunctions() {}
+
+    virtual ~FilterProfile() {}
+
+    FilterProfile(const FilterProfile& other) = delete;
+
+    FilterProfile(FilterProfile&& temp) = delete;
+
+    FilterProfile& operator=(const FilterProfile& other) = delete;
+
+    FilterProfile& operator=(FilterProfile&& temp) = delete;
+
+    /**
+     * Registers an AND node of a filter being compiled
+     * @param conjunction The node, shared with the filter
+     */
+    virtual void add(std::shared_ptr<AdaptiveConjunction> conjunction);
+
+    /**
+     * Describes each AND node: its conjuncts in their final order, with their
+     * observed pass rates and costs, and every time it reordered them
+     * @return The report, one line per item
+     */
+    virtual std::string report() const;
+
+protected:
+    std::vector<std::shared_ptr<AdaptiveConjunction>> conjunctions;
+};
+
+/**
+ * @class Predicate - a where-clause predicate tree
+ *
+ * Leaves compare one column with literals (=, <>, <, <=, >, >=, BETWEEN, IN,
+ * LIKE 'prefix%', and LIKE '%infix%'); inner nodes are AND, OR, and NOT. A predicate is
+ * compiled once per query, against a table's schema, into a tree of closures
+ * that read columns straight out of marshaled records without unmarshaling
+ * them, so testing a row costs a few nanoseconds per comparison.
+ *
+ * The conjuncts of an AND (however nested) run in the order that rejects rows
+ * most cheaply. A compiled AND times every conjunct and counts its passes on
+ * a sample of rows. Every so often it reorders the conjuncts by cost per row
+ * rejected.
+ */
+class Predicate {
+public:
+    enum Op {
+        EQ, NE, LT, LE, GT, GE, BETWEEN, IN, LIKE_PREFIX, LIKE_CONTAINS, AND, OR, NOT
+    };
+
+    /**
+     * Creates a comparison of a column with literals
+     * @param op The comparison (EQ through LIKE_CONTAINS)
+     * @param column The column compared
+     * @param operands The literals: one, two for BETWEEN, any number for IN
+     */
+    Predicate(Op op, Identifier column, std::vector<Value> operands);
+
+    /**
+     * Creates a connective, taking ownership of its operands
+     * @param op AND, OR, or NOT
+     * @param left The first operand
+     * @param right The second operand (nullptr for NOT)
+     */
+    Predicate(Op op, Predicate* left, Predicate* right = nullptr);
+
+    virtual ~Predicate();
+
+    Predicate(const Predicate& other) = delete;
+
+    Predicate(Predicate&& temp) = delete;
+
+    Predicate& operator=(const Predicate& other) = delete;
+
+    Predicate& operator=(Predicate&& temp) = delete;
+
+    /**
+     * Compiles the predicate against a table's schema
+     * @param column_names The table's column names, in column order
+     * @param column_attributes The table's column attributes, in column order
+     * @param profile Collects what the filter's AND nodes observe (nullptr for none)
+     * @return A filter over the table's marshaled records
+     * @throws PredicateError if a column is unknown or compared with the wrong type
+     */
+    virtual RecordFilter compile(const ColumnNames& column_names, const ColumnAttributes& column_attributes,
+                                 FilterProfile* profile = nullptr) const;
+
+    /**
+     * Writes the predicate as SQL, e.g. (a > 5 AND b = 'x')
+     */
+    virtual std::string to_string() const;
+
+    /**
+     * Finds bounds on a column implied by the predicate, for narrowing a scan
+     * of a table ordered on that column. Rows outside the bounds cannot match;
+     * rows inside must still be filtered.
+     * @param column The column
+     * @param low Set to the lower bound (inclusive) if still nullptr and one is found
+     * @param high Set to the upper bound (inclusive) if still nullptr and one is found
+     */
+    virtual void get_bounds(const Identifier& column, const Value*& low, const Value*& high) const;
+
+    /**
+     * Collects the columns the predicate reads
+     * @param columns The list to append column names to (without duplicates)
+     */
+    virtual void get_columns(ColumnNames& columns) const;
+
+    virtual Op get_op() const { return this->op; }
+
+    virtual const Identifier& get_column() const { return this->column; }
+
+    virtual const std::vector<Value>& get_operands() const { return this->operands; }
+
+    virtual const Predicate* get_left() const { return this->left; }
+
+    virtual const Predicate* get_right() const { return this->right; }
+
+    /**
+     * Builds a conjunction of equalities from a where dictionary
+     * @param where Column values to match
+     * @return The predicate (freed by caller), or nullptr if where is empty
+     */
+    static Predicate* from_where(const ValueDict* where);
+
+    /**
+     * Builds a predicate from a parsed where clause
+     * @param expr The where clause
+     * @return The predicate (freed by caller)
+     * @throws PredicateError if the clause uses anything but comparisons of
+     *         columns with literals joined by AND, OR, and NOT
+     */
+    static Predicate* from_expr(const hsql::Expr* expr);
+
+protected:
+    Op op;
+    Identifier column;
+    std::vector<Value> operands;
+    Predicate* left;
+    Predicate* right;
+};
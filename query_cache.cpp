@@ -0,0 +1,301 @@
+/**
+ * @file query_cache.cpp - Implementation of the statement result cache.
+ * QueryCache
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include "query_cache.h"
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include "SQLParser.h"
+#include "heap_storage.h"
+
+// rough per-entry bookkeeping cost (list node, index slot, version map nodes)
+const std::size_t ENTRY_OVERHEAD = 128;
+
+static void append_key(std::string& key, const hsql::SelectStatement* const statement);
+static void append_key(std::string& key, hsql::Expr* const expr);
+static void append_key(std::string& key, const std::vector<hsql::Expr*>* const exprs);
+static void append_key(std::string& key, hsql::TableRef* const table);
+static void append_key(std::string& key, const char* const name);
+
+/**
+ * Appends the canonical encoding of a SELECT statement (or subquery) to a key
+ */
+static void append_key(std::string& key, const hsql::SelectStatement* const statement) {
+    if (!statement) {
+        key.append(" -");
+        return;
+    }
+    key.append(statement->selectDistinct ? " (SELECT DISTINCT" : " (SELECT");
+    append_key(key, statement->selectList);
+    append_key(key, statement->fromTable);
+    append_key(key, statement->whereClause);
+    if (statement->groupBy) {
+        key.append(" GROUP");
+        append_key(key, statement->groupBy->columns);
+        append_key(key, statement->groupBy->having);
+    }
+    if (statement->order) {
+        key.append(" ORDER");
+        for (hsql::OrderDescription* const order : *statement->order) {
+            key.append(order->type == hsql::kOrderAsc ? " ASC" : " DESC");
+            append_key(key, order->expr);
+        }
+    }
+    if (statement->limit)
+        key.append(" LIMIT ").append(std::to_string(statement->limit->limit))
+           .append(" ").append(std::to_string(statement->limit->offset));
+    if (statement->unionSelect) {
+        key.append(" UNION");
+        append_key(key, statement->unionSelect);
+    }
+    key.append(")");
+}
+
+/**
+ * Appends the canonical encoding of an expression to a key
+ */
+static void append_key(std::string& key, hsql::Expr* const expr) {
+    if (!expr) {
+        key.append(" -");
+        return;
+    }
+    // only the fields each kind of expression sets are read
+    key.append(" (").append(std::to_string((int)expr->type));
+    switch (expr->type) {
+        case hsql::ExprType::kExprLiteralFloat: {
+            std::ostringstream literal;
+            literal << std::hexfloat << expr->fval;
+            key.append(" ").append(literal.str());
+            break;
+        }
+        case hsql::ExprType::kExprLiteralInt:
+        case hsql::ExprType::kExprPlaceholder:
+            key.append(" ").append(std::to_string(expr->ival));
+            break;
+        case hsql::ExprType::kExprLiteralString:
+            append_key(key, expr->name);
+            break;
+        case hsql::ExprType::kExprColumnRef:
+            append_key(key, expr->table);
+            append_key(key, expr->name);
+            break;
+        case hsql::ExprType::kExprFunctionRef:
+            append_key(key, expr->name);
+            key.append(expr->distinct ? " DISTINCT" : "");
+            append_key(key, expr->exprList);
+            break;
+        case hsql::ExprType::kExprOperator:
+            key.append(" ").append(std::to_string((int)expr->opType));
+            if (expr->opType == hsql::Expr::SIMPLE_OP)
+                key.append(" ").push_back(expr->opChar);
+            append_key(key, expr->expr);
+            append_key(key, expr->expr2);
+            append_key(key, expr->exprList);
+            append_key(key, expr->select);
+            break;
+        case hsql::ExprType::kExprSelect:
+            append_key(key, expr->select);
+            break;
+        default:
+            break;
+    }
+    append_key(key, expr->alias);
+    key.append(")");
+}
+
+/**
+ * Appends the canonical encoding of a list of expressions to a key
+ */
+static void append_key(std::string& key, const std::vector<hsql::Expr*>* const exprs) {
+    if (!exprs) {
+        key.append(" -");
+        return;
+    }
+    key.append(" [");
+    for (hsql::Expr* const expr : *exprs)
+        append_key(key, expr);
+    key.append("]");
+}
+
+/**
+ * Appends the canonical encoding of a table reference to a key
+ */
+static void append_key(std::string& key, hsql::TableRef* const table) {
+    if (!table) {
+        key.append(" -");
+        return;
+    }
+    key.append(" (T").append(std::to_string((int)table->type));
+    append_key(key, table->schema);
+    append_key(key, table->name);
+    append_key(key, table->alias);
+    append_key(key, table->select);
+    if (table->list)
+        for (hsql::TableRef* const item : *table->list)
+            append_key(key, item);
+    if (table->join) {
+        key.append(" ").append(std::to_string((int)table->join->type));
+        append_key(key, table->join->left);
+        append_key(key, table->join->right);
+        append_key(key, table->join->condition);
+    }
+    key.append(")");
+}
+
+/**
+ * Appends a name to a key, prefixed by its length so names can't run together
+ */
+static void append_key(std::string& key, const char* const name) {
+    if (!name) {
+        key.append(" -");
+        return;
+    }
+    key.append(" ").append(std::to_string(std::strlen(name))).append(":").append(name);
+}
+
+QueryCache::QueryCache(std::size_t capacity)
+    : capacity(capacity), memory_used(0), hits(0), misses(0), entries(), index()
+{}
+
+bool QueryCache::get(const std::string& key, std::string& result) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto found = this->index.find(key);
+    if (found == this->index.end()) {
+        this->misses++;
+        return false;
+    }
+    Entries::iterator entry = found->second;
+    for (auto const& version : entry->versions) {
+        if (HeapTable::get_version(version.first) != version.second) {
+            this->evict(entry);
+            this->misses++;
+            return false;
+        }
+    }
+    this->entries.splice(this->entries.begin(), this->entries, entry);
+    result = entry->result;
+    this->hits++;
+    return true;
+}
+
+void QueryCache::put(const std::string& key, const TableVersions& versions, const std::string& result) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto found = this->index.find(key);
+    if (found != this->index.end())
+        this->evict(found->second);
+
+    Entry entry;
+    entry.key = key;
+    entry.result = result;
+    entry.versions = versions;
+    entry.size = 2 * key.size() + result.size() + ENTRY_OVERHEAD;
+    for (auto const& version : versions)
+        entry.size += version.first.size() + sizeof(u_int64_t);
+    if (entry.size > this->capacity)
+        return;
+    while (this->memory_used + entry.size > this->capacity)
+        this->evict(std::prev(this->entries.end()));
+
+    this->memory_used += entry.size;
+    this->entries.push_front(entry);
+    this->index[key] = this->entries.begin();
+}
+
+std::string QueryCache::key_of(const hsql::SelectStatement* statement) {
+    std::string key;
+    append_key(key, statement);
+    return key;
+}
+
+QueryCache::TableVersions QueryCache::versions_of(const ColumnNames& tables) {
+    TableVersions versions;
+    for (auto const& table_name : tables)
+        versions[table_name] = HeapTable::get_version(table_name);
+    return versions;
+}
+
+void QueryCache::clear() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->entries.clear();
+    this->index.clear();
+    this->memory_used = 0;
+}
+
+double QueryCache::get_hit_rate() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    u_int64_t lookups = this->hits + this->misses;
+    return lookups ? (double)this->hits / lookups : 0.0;
+}
+
+std::string QueryCache::stats() const {
+    double hit_rate = this->get_hit_rate();
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::stringstream out;
+    out << "query cache: " << this->entries.size() << " entries, "
+        << this->memory_used << "/" << this->capacity << " bytes, "
+        << this->hits << " hits, " << this->misses << " misses, "
+        << "hit rate " << hit_rate * 100 << "%";
+    return out.str();
+}
+
+void QueryCache::evict(Entries::iterator entry) {
+    this->memory_used -= entry->size;
+    this->index.erase(entry->key);
+    this->entries.erase(entry);
+}
+
+bool test_query_cache() {
+    // each entry is 2 * 2 + 100 + ENTRY_OVERHEAD bytes, so two fit
+    const std::string result(100, 'r');
+    QueryCache cache(2 * (2 * 2 + result.size() + ENTRY_OVERHEAD) + 10);
+    std::string found;
+    cache.put("k1", QueryCache::TableVersions(), result);
+    bool hit_ok = cache.get("k1", found) && found == result && !cache.get("k9", found) &&
+                  cache.get_hit_rate() == 0.5;
+    std::cout << "query cache hit ok" << std::endl;
+
+    // the least recently used entry goes first, and an entry larger than the cache is never kept
+    cache.put("k2", QueryCache::TableVersions(), result);
+    cache.get("k1", found);
+    cache.put("k3", QueryCache::TableVersions(), result);
+    bool evict_ok = cache.get("k1", found) && !cache.get("k2", found) && cache.get("k3", found) &&
+                    cache.get_memory_used() <= 2 * (2 * 2 + result.size() + ENTRY_OVERHEAD);
+    cache.put("k4", QueryCache::TableVersions(), std::string(1000, 'r'));
+    evict_ok = evict_ok && !cache.get("k4", found) && cache.get("k1", found) && cache.get("k3", found);
+    std::cout << "query cache eviction ok" << std::endl;
+
+    // a write to a table read invalidates the entry, including one landing while the statement ran
+    QueryCache versioned(1 << 16);
+    ColumnNames tables(1, "_test_query_cache_cpp");
+    versioned.put("k1", QueryCache::versions_of(tables), result);
+    bool version_ok = versioned.get("k1", found);
+    HeapTable::bump_version(tables[0]);
+    version_ok = version_ok && !versioned.get("k1", found);
+    QueryCache::TableVersions before = QueryCache::versions_of(tables);
+    HeapTable::bump_version(tables[0]);
+    versioned.put("k2", before, result);
+    version_ok = version_ok && !versioned.get("k2", found) && versioned.get_memory_used() == 0;
+    std::cout << "query cache versions ok" << std::endl;
+
+    // reparsing a query gives the same key; a different literal, literal kind, or clause does not
+    auto key_of = [](const std::string& sql) -> std::string {
+        std::unique_ptr<hsql::SQLParserResult> parsed(hsql::SQLParser::parseSQLString(sql));
+        if (!parsed->isValid())
+            return "";
+        return QueryCache::key_of(dynamic_cast<const hsql::SelectStatement*>(parsed->getStatement(0)));
+    };
+    std::string key = key_of("SELECT a FROM t WHERE a = 1");
+    bool key_ok = !key.empty() && key == key_of("SELECT a FROM t WHERE a = 1") &&
+                  key != key_of("SELECT a FROM t WHERE a = 2") && key != key_of("SELECT a FROM t WHERE a = '1'") &&
+                  key != key_of("SELECT a FROM t WHERE a = 1 LIMIT 1") && key != key_of("SELECT b FROM t WHERE a = 1");
+    std::cout << "query cache key ok" << std::endl;
+
+    return hit_ok && evict_ok && version_ok && key_ok;
+}
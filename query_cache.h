@@ -0,0 +1,128 @@
+/**
+ * @file query_cache.h - Bounded cache of statement results.
+ * QueryCache
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "storage_engine.h"
+
+namespace hsql {
+    struct SelectStatement;
+}
+
+/**
+ * @class QueryCache - LRU cache of statement results
+ *
+ * Results are keyed by a canonical encoding of the statement (key_of). Each entry
+ * remembers the modification counter of every table the statement read, as of
+ * before the statement ran; an entry is only served while none of those
+ * counters have moved. Total size is bounded by a byte budget, evicting least recently used
+ * entries first. Safe to share between threads.
+ */
+class QueryCache {
+public:
+    using TableVersions = std::map<Identifier, u_int64_t>;
+
+    /**
+     * @param capacity The maximum number of bytes the cached entries may occupy
+     */
+    QueryCache(std::size_t capacity);
+
+    virtual ~QueryCache() {}
+
+    QueryCache(const QueryCache& other) = delete;
+
+    QueryCache(QueryCache&& temp) = delete;
+
+    QueryCache& operator=(const QueryCache& other) = delete;
+
+    QueryCache& operator=(QueryCache&& temp) = delete;
+
+    /**
+     * Looks up a cached result, discarding it if any referenced table changed
+     * @param key The canonical encoding of the statement
+     * @param result Set to the cached result on a hit
+     * @return True on a hit, false otherwise
+     */
+    virtual bool get(const std::string& key, std::string& result);
+
+    /**
+     * Caches a result, evicting older entries until it fits
+     * @param key The canonical encoding of the statement
+     * @param versions The versions_of() the tables the statement reads, taken before it ran
+     * @param result The result to cache
+     */
+    virtual void put(const std::string& key, const TableVersions& versions, const std::string& result);
+
+    /**
+     * Builds the key of a SELECT statement: a canonical encoding of every
+     * clause, operator, and literal (with its kind), so two statements share a
+     * key only if they are the same query
+     * @param statement A pointer to a SELECT statement
+     * @return The key
+     */
+    static std::string key_of(const hsql::SelectStatement* statement);
+
+    /**
+     * Reads the current modification counters of tables
+     * @param tables The tables
+     * @return Each table's counter
+     */
+    static TableVersions versions_of(const ColumnNames& tables);
+
+    /**
+     * Drops every cached entry (statistics are kept)
+     */
+    virtual void clear();
+
+    /**
+     * Retrieves the number of bytes currently used by cached entries
+     */
+    virtual std::size_t get_memory_used() const { return this->memory_used; }
+
+    /**
+     * Retrieves the fraction of lookups served from the cache
+     */
+    virtual double get_hit_rate() const;
+
+    /**
+     * Summarizes memory use and hit rate for the shell
+     */
+    virtual std::string stats() const;
+
+protected:
+    struct Entry {
+        std::string key;
+        std::string result;
+        TableVersions versions;
+        std::size_t size;
+    };
+    using Entries = std::list<Entry>;
+
+    std::size_t capacity;
+    std::size_t memory_used;
+    u_int64_t hits;
+    u_int64_t misses;
+    Entries entries; // most recently used first
+    std::unordered_map<std::string, Entries::iterator> index;
+    mutable std::mutex mutex;
+
+    /**
+     * Removes an entry from the cache (caller holds the mutex)
+     * @param entry The entry to remove
+     */
+    virtual void evict(Entries::iterator entry);
+};
+
+/**
+ * Query cache test function. Returns true if all tests pass.
+ */
+bool test_query_cache();
@@ -0,0 +1,92 @@
+/**
+ * @file record_layout.cpp - Implementation of the marshaled row layout.
+ * RecordLayout
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include "record_layout.h"
+#include <limits>
+
+using u16 = u_int16_t;
+
+// Begin Record Layout Functions
+
+RecordLayout::RecordLayout(const ColumnAttributes& column_attributes)
+    : data_types(), offsets(), fixed_size(0), header_size(0)
+{
+    std::size_t n_ints = 0, n_texts = 0;
+    for (ColumnAttribute ca : column_attributes) {
+        this->data_types.push_back(ca.get_data_type());
+        if (ca.get_data_type() == ColumnAttribute::INT)
+            this->offsets.push_back(n_ints++ * sizeof(int32_t));
+        else
+            this->offsets.push_back(n_texts++ * sizeof(u16)); // relative to the offset table for now
+    }
+    this->fixed_size = n_ints * sizeof(int32_t);
+    for (std::size_t i = 0; i < this->offsets.size(); i++)
+        if (this->data_types[i] == ColumnAttribute::TEXT)
+            this->offsets[i] += this->fixed_size;
+    this->header_size = this->fixed_size + (n_texts ? (n_texts + 1) * sizeof(u16) : 0);
+}
+
+std::string RecordLayout::marshal(const std::vector<Value>& values) const {
+    if (values.size() != this->size())
+        throw DbRelationError("wrong number of values to marshal");
+    std::size_t size = this->header_size;
+    for (std::size_t i = 0; i < values.size(); i++) {
+        if (values[i].data_type != this->data_types[i])
+            throw DbRelationError("wrong type of value to marshal");
+        if (values[i].data_type == ColumnAttribute::TEXT)
+            size += values[i].s.size();
+    }
+    std::size_t padded = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    if (padded > std::numeric_limits<u16>::max())
+        throw DbRelationError("row too big to marshal");
+
+    std::string bytes(padded, '\0');
+    u16 text_offset = this->header_size;
+    for (std::size_t i = 0; i < values.size(); i++) {
+        if (values[i].data_type == ColumnAttribute::INT) {
+            std::memcpy(&bytes[this->offsets[i]], &values[i].n, sizeof(int32_t));
+        } else {
+            std::memcpy(&bytes[this->offsets[i]], &text_offset, sizeof(u16));
+            std::memcpy(&bytes[text_offset], values[i].s.data(), values[i].s.size());
+            text_offset += values[i].s.size();
+        }
+    }
+    if (this->header_size > this->fixed_size) // close the offset table with the end of the last TEXT
+        std::memcpy(&bytes[this->header_size - sizeof(u16)], &text_offset, sizeof(u16));
+    return bytes;
+}
+
+void RecordLayout::unmarshal(const char* record, std::vector<Value>& values) const {
+    values.clear();
+    for (std::size_t i = 0; i < this->offsets.size(); i++) {
+        if (this->data_types[i] == ColumnAttribute::INT) {
+            values.push_back(Value(get_int(record, this->offsets[i])));
+        } else {
+            u16 size;
+            const char* text = get_text(record, this->offsets[i], size);
+            values.push_back(Value(std::string(text, size)));
+        }
+    }
+}
+
+bool RecordLayout::check(const char* record, std::size_t size) const {
+    if (size < this->header_size)
+        return false;
+    // the offset table must climb from the header to no further than the record's end
+    u16 previous = this->header_size;
+    for (std::size_t entry = this->fixed_size; entry < this->header_size; entry += sizeof(u16)) {
+        u16 offset;
+        std::memcpy(&offset, record + entry, sizeof(u16));
+        if (offset < previous || offset > size)
+            return false;
+        previous = offset;
+    }
+    return true;
+}
+
+// End Record Layout Functions
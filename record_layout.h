@@ -0,0 +1,121 @@
+/**
+ * @file record_layout.h - Physical layout of marshaled rows.
+ * RecordLayout
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class RecordLayout - where each column of a schema lives in a marshaled row
+ *
+ * A record puts all INT columns first, in declaration order, each at a fixed
+ * offset that is a multiple of ALIGNMENT. A table of u16 offsets follows:
+ * where each TEXT column's bytes start, in declaration order, then where the
+ * last one ends. The TEXT bytes come last.
+ *     INT 0, INT 1, ..., start of TEXT 0, start of TEXT 1, ..., end, TEXT bytes
+ *
+ * So every column is found in constant time, without looking at the columns
+ * before it. Records are zero-padded to a multiple of ALIGNMENT. Records
+ * packed end to end from the end of a block therefore all start aligned, and
+ * so do their INT fields.
+ *
+ * A layout is computed once per schema. Compiled predicates and scan kernels
+ * keep only the offsets they need.
+ */
+class RecordLayout {
+public:
+    static const u_int16_t ALIGNMENT = sizeof(int32_t);
+
+    RecordLayout() : data_types(), offsets(), fixed_size(0), header_size(0) {}
+
+    /**
+     * @param column_attributes The attributes of the record's columns, in declaration order
+     */
+    explicit RecordLayout(const ColumnAttributes& column_attributes);
+
+    virtual ~RecordLayout() {}
+
+    /**
+     * Retrieves the number of columns
+     */
+    virtual std::size_t size() const { return this->offsets.size(); }
+
+    /**
+     * Retrieves a column's data type
+     * @param col_num The column's position in declaration order
+     */
+    virtual ColumnAttribute::DataType get_data_type(std::size_t col_num) const { return this->data_types[col_num]; }
+
+    /**
+     * Retrieves where to find a column: the offset of an INT column's value, or
+     * of a TEXT column's entry in the offset table
+     * @param col_num The column's position in declaration order
+     */
+    virtual u_int16_t get_offset(std::size_t col_num) const { return this->offsets[col_num]; }
+
+    /**
+     * Retrieves the size of the INT columns and offset table, where the TEXT bytes begin
+     */
+    virtual u_int16_t get_header_size() const { return this->header_size; }
+
+    /**
+     * Marshals a row
+     * @param values The row's values, in declaration order
+     * @return The record's bytes, padded to a multiple of ALIGNMENT
+     * @throws DbRelationError if a value has the wrong type or the record is too big
+     */
+    virtual std::string marshal(const std::vector<Value>& values) const;
+
+    /**
+     * Unmarshals a record
+     * @param record The record's bytes
+     * @param values Set to the row's values, in declaration order
+     */
+    virtual void unmarshal(const char* record, std::vector<Value>& values) const;
+
+    /**
+     * Checks that a record of this layout lies within its size
+     * @param record The record's bytes
+     * @param size The record's size
+     * @return True if every column's bytes are within the record
+     */
+    virtual bool check(const char* record, std::size_t size) const;
+
+    /**
+     * Reads an INT column
+     * @param record The record's bytes
+     * @param offset The column's offset (from get_offset)
+     */
+    static inline int32_t get_int(const char* record, u_int16_t offset) {
+        int32_t n;
+        std::memcpy(&n, record + offset, sizeof(n));
+        return n;
+    }
+
+    /**
+     * Finds a TEXT column's bytes
+     * @param record The record's bytes
+     * @param offset The column's entry in the offset table (from get_offset)
+     * @param size Set to the number of bytes
+     * @return The first byte
+     */
+    static inline const char* get_text(const char* record, u_int16_t offset, u_int16_t& size) {
+        u_int16_t bounds[2];
+        std::memcpy(bounds, record + offset, sizeof(bounds));
+        size = bounds[1] - bounds[0];
+        return record + bounds[0];
+    }
+
+protected:
+    std::vector<ColumnAttribute::DataType> data_types;
+    std::vector<u_int16_t> offsets;
+    u_int16_t fixed_size;   // bytes of INT columns, where the offset table begins
+    u_int16_t header_size;
+};
@@ -0,0 +1,194 @@
+/**
+ * @file scan_kernels.cpp - Implementation of schema-specialized block decoding.
+ * ColumnBatch
+ * ScanKernel
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include "scan_kernels.h"
+#include <cstring>
+
+using u16 = u_int16_t;
+
+/**
+ * Decodes a TEXT value given its entry in the record's offset table
+ */
+static inline void decode_text(const char* bytes, u16 offset, std::vector<std::string>& texts) {
+    u16 size;
+    const char* text = RecordLayout::get_text(bytes, offset, size);
+    texts.emplace_back(text, size);
+}
+
+/**
+ * Calls fn(record_id, bytes) for each live record of a block. Reads the slot
+ * directory straight out of the block (see SlottedPage for its layout) so the
+ * per-record cost is two loads rather than two virtual calls.
+ */
+template <typename Fn>
+static inline void for_each_record(SlottedPage* block, Fn fn) {
+    const char* data = (const char*)block->get_data();
+    u16 num_records;
+    std::memcpy(&num_records, data, sizeof(u16));
+    for (RecordID record_id = 1; record_id <= num_records; record_id++) {
+        u16 loc;
+        std::memcpy(&loc, data + 4 * record_id + 2, sizeof(u16));
+        if (loc) // skip tombstones
+            fn(record_id, data + loc);
+    }
+}
+
+// Begin Column Batch Functions
+
+ColumnBatch::ColumnBatch(const ColumnAttributes& column_attributes) : handles(), columns() {
+    for (ColumnAttribute ca : column_attributes) {
+        Column column;
+        column.data_type = ca.get_data_type();
+        this->columns.push_back(column);
+    }
+}
+
+void ColumnBatch::clear() {
+    this->handles.clear();
+    for (Column& column : this->columns) {
+        column.ints.clear();
+        column.texts.clear();
+    }
+}
+
+Value ColumnBatch::get_value(std::size_t row, std::size_t col_num) const {
+    const Column& column = this->columns[col_num];
+    if (column.data_type == ColumnAttribute::INT)
+        return Value(column.ints[row]);
+    return Value(column.texts[row]);
+}
+
+void ColumnBatch::append(Handle handle, const char* bytes, const RecordLayout& record_layout,
+                         const std::vector<int>& positions) {
+    this->handles.push_back(handle);
+    for (std::size_t i = 0; i < record_layout.size(); i++) {
+        if (positions[i] < 0)
+            continue;
+        Column& column = this->columns[positions[i]];
+        if (column.data_type == ColumnAttribute::INT)
+            column.ints.push_back(RecordLayout::get_int(bytes, record_layout.get_offset(i)));
+        else
+            decode_text(bytes, record_layout.get_offset(i), column.texts);
+    }
+}
+
+void ColumnBatch::append(SlottedPage* block, const SelectionVector& selection, const RecordLayout& record_layout,
+                         const std::vector<int>& positions) {
+    BlockID block_id = block->get_block_id();
+    const char* data = (const char*)block->get_data();
+    for (RecordID record_id : selection) {
+        u16 loc;
+        std::memcpy(&loc, data + 4 * record_id + 2, sizeof(u16));
+        this->append(Handle(block_id, record_id), data + loc, record_layout, positions);
+    }
+}
+
+// End Column Batch Functions
+
+// Begin Scan Kernel Functions
+
+/**
+ * Decodes INT columns I..N-1, which sit at fixed offsets; the recursion is
+ * resolved at compile time, leaving straight-line code
+ */
+template <unsigned I, unsigned N>
+struct DecodeInts {
+    static inline void decode(const char* bytes, ColumnBatch::Column* columns) {
+        columns[I].ints.push_back(RecordLayout::get_int(bytes, I * sizeof(int32_t)));
+        DecodeInts<I + 1, N>::decode(bytes, columns);
+    }
+};
+
+template <unsigned N>
+struct DecodeInts<N, N> {
+    static inline void decode(const char*, ColumnBatch::Column*) {}
+};
+
+/**
+ * @class GenericScanKernel - decodes any schema, one column type check at a time
+ */
+class GenericScanKernel : public ScanKernel {
+public:
+    GenericScanKernel(const ColumnAttributes& column_attributes) : layout(column_attributes) {}
+
+    virtual void scan(SlottedPage* block, const RecordFilter& filter, ColumnBatch& batch) const {
+        BlockID block_id = block->get_block_id();
+        for_each_record(block, [&](RecordID record_id, const char* bytes) {
+            if (filter && !filter(bytes))
+                return;
+            batch.handles.push_back(Handle(block_id, record_id));
+            for (std::size_t i = 0; i < batch.columns.size(); i++) {
+                ColumnBatch::Column& column = batch.columns[i];
+                if (column.data_type == ColumnAttribute::INT)
+                    column.ints.push_back(RecordLayout::get_int(bytes, this->layout.get_offset(i)));
+                else
+                    decode_text(bytes, this->layout.get_offset(i), column.texts);
+            }
+        });
+    }
+
+protected:
+    RecordLayout layout;
+};
+
+/**
+ * @class ShapedScanKernel - decodes schemas of N_INTS INT columns, followed by
+ * one TEXT column if TRAILING_TEXT
+ */
+template <unsigned N_INTS, bool TRAILING_TEXT>
+class ShapedScanKernel : public ScanKernel {
+public:
+    virtual void scan(SlottedPage* block, const RecordFilter& filter, ColumnBatch& batch) const {
+        BlockID block_id = block->get_block_id();
+        ColumnBatch::Column* columns = batch.columns.data();
+        for_each_record(block, [&](RecordID record_id, const char* bytes) {
+            if (filter && !filter(bytes))
+                return;
+            batch.handles.push_back(Handle(block_id, record_id));
+            DecodeInts<0, N_INTS>::decode(bytes, columns);
+            if (TRAILING_TEXT)
+                decode_text(bytes, N_INTS * sizeof(int32_t), columns[N_INTS].texts);
+        });
+    }
+};
+
+template <bool TRAILING_TEXT>
+static ScanKernel* create_shaped(unsigned n_ints) {
+    switch (n_ints) {
+        case 0: return new ShapedScanKernel<0, TRAILING_TEXT>();
+        case 1: return new ShapedScanKernel<1, TRAILING_TEXT>();
+        case 2: return new ShapedScanKernel<2, TRAILING_TEXT>();
+        case 3: return new ShapedScanKernel<3, TRAILING_TEXT>();
+        default: return new ShapedScanKernel<4, TRAILING_TEXT>();
+    }
+}
+
+ScanKernel* ScanKernel::create(const ColumnAttributes& column_attributes) {
+    unsigned n_ints = 0;
+    while (n_ints < column_attributes.size()) {
+        ColumnAttribute ca = column_attributes[n_ints];
+        if (ca.get_data_type() != ColumnAttribute::INT)
+            break;
+        n_ints++;
+    }
+    std::size_t rest = column_attributes.size() - n_ints;
+    if (n_ints > MAX_SHAPED_INTS || rest > 1 || column_attributes.empty())
+        return new GenericScanKernel(column_attributes);
+    return rest ? create_shaped<true>(n_ints) : create_shaped<false>(n_ints);
+}
+
+void ScanKernel::select(SlottedPage* block, const RecordFilter& filter, SelectionVector& selection) {
+    selection.clear();
+    for_each_record(block, [&](RecordID record_id, const char* bytes) {
+        if (!filter || filter(bytes))
+            selection.push_back(record_id);
+    });
+}
+
+// End Scan Kernel Functions
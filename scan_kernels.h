@@ -0,0 +1,125 @@
+/**
+ * @file scan_kernels.h - Schema-specialized decoding of heap blocks.
+ * ColumnBatch
+ * ScanKernel
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "heap_storage.h"
+#include "predicate.h"
+#include "record_layout.h"
+#include "storage_engine.h"
+
+/**
+ * @class ColumnBatch - decoded rows stored column by column
+ */
+class ColumnBatch {
+public:
+    struct Column {
+        ColumnAttribute::DataType data_type;
+        std::vector<int32_t> ints;       // values of an INT column
+        std::vector<std::string> texts;  // values of a TEXT column
+    };
+
+    /**
+     * @param column_attributes The attributes of the batch's columns, in order
+     */
+    ColumnBatch(const ColumnAttributes& column_attributes);
+
+    virtual ~ColumnBatch() {}
+
+    ColumnBatch(const ColumnBatch& other) = delete;
+
+    ColumnBatch(ColumnBatch&& temp) = delete;
+
+    ColumnBatch& operator=(const ColumnBatch& other) = delete;
+
+    ColumnBatch& operator=(ColumnBatch&& temp) = delete;
+
+    /**
+     * Retrieves the number of rows in the batch
+     */
+    virtual std::size_t size() const { return this->handles.size(); }
+
+    /**
+     * Removes every row, keeping the columns' memory for reuse
+     */
+    virtual void clear();
+
+    /**
+     * Retrieves one value of the batch
+     * @param row The row's position in the batch
+     * @param col_num The column's position in the batch
+     * @return The value
+     */
+    virtual Value get_value(std::size_t row, std::size_t col_num) const;
+
+    /**
+     * Decodes one marshaled record, keeping some of its columns
+     * @param handle The record's handle
+     * @param bytes The marshaled record
+     * @param record_layout The layout of the record's columns
+     * @param positions For each column of the record, its column in the batch (-1 to skip)
+     */
+    virtual void append(Handle handle, const char* bytes, const RecordLayout& record_layout,
+                        const std::vector<int>& positions);
+
+    /**
+     * Decodes the selected records of a block, keeping some of their columns
+     * @param block The block
+     * @param selection The records to decode (see ScanKernel::select)
+     * @param record_layout The layout of the records' columns
+     * @param positions For each column of the records, its column in the batch (-1 to skip)
+     */
+    virtual void append(SlottedPage* block, const SelectionVector& selection, const RecordLayout& record_layout,
+                        const std::vector<int>& positions);
+
+    Handles handles;              // the handle of each row
+    std::vector<Column> columns;  // the values of each column
+};
+
+/**
+ * @class ScanKernel - decodes the records of heap blocks into column batches
+ *
+ * The generic kernel switches on each column's type for every row. Common
+ * schema shapes (up to MAX_SHAPED_INTS INT columns, optionally followed by one
+ * TEXT column) get a kernel instantiated from a template for that shape, with
+ * every column at an offset known at compile time and the decoding loop
+ * unrolled. create() picks the kernel once per table, when it is opened.
+ */
+class ScanKernel {
+public:
+    static const unsigned MAX_SHAPED_INTS = 4;
+
+    virtual ~ScanKernel() {}
+
+    /**
+     * Decodes the records of a block that pass a filter, appending them to a batch
+     * @param block The block to decode
+     * @param filter Tested against each record first (empty to keep all)
+     * @param batch The batch to append to (one column per table column)
+     */
+    virtual void scan(SlottedPage* block, const RecordFilter& filter, ColumnBatch& batch) const = 0;
+
+    /**
+     * Picks the kernel for a schema
+     * @param column_attributes The table's column attributes, in column order
+     * @return A specialized kernel if the schema has a common shape, else the
+     *         generic one (freed by caller)
+     */
+    static ScanKernel* create(const ColumnAttributes& column_attributes);
+
+    /**
+     * Tests the records of a block against a filter in place, decoding nothing
+     * @param block The block to test
+     * @param filter The filter (empty to keep all)
+     * @param selection Set to the record IDs of the records that passed
+     */
+    static void select(SlottedPage* block, const RecordFilter& filter, SelectionVector& selection);
+};
@@ -0,0 +1,333 @@
+/**
+ * @file sort_operator.cpp - Implementation of sorting rows by normalized keys.
+ * SortOperator
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include "sort_operator.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+
+using u8 = unsigned char;
+using u32 = u_int32_t;
+
+/**
+ * Finds a sort column's value in a row
+ */
+static inline const Value& column_value(const ValueDict& row, const Identifier& column_name) {
+    ValueDict::const_iterator found = row.find(column_name);
+    if (found == row.end())
+        throw DbRelationError("row has no sort column " + column_name);
+    return found->second;
+}
+
+/**
+ * Sorts exact keys with an LSD radix sort: one stable counting pass per key
+ * byte, last byte first, skipping bytes that are the same in every key
+ * @param entries The entries (key, then row number); set to the buffer holding them sorted
+ * @param scratch Room for as many entries; set to the other buffer
+ * @param n The number of entries (at least one)
+ * @param stride The size of an entry
+ * @param key_size The size of its key
+ */
+static void lsd_radix_sort(u8*& entries, u8*& scratch, std::size_t n, std::size_t stride, std::size_t key_size) {
+    // histograms of every key byte, in one pass
+    std::vector<std::size_t> counts(key_size * 256, 0);
+    for (std::size_t i = 0; i < n; i++)
+        for (std::size_t byte = 0; byte < key_size; byte++)
+            counts[byte * 256 + entries[i * stride + byte]]++;
+
+    for (std::size_t byte = key_size; byte-- > 0;) {
+        const std::size_t* count = &counts[byte * 256];
+        if (count[entries[byte]] == n)
+            continue;
+        std::size_t positions[256], position = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            positions[digit] = position;
+            position += count[digit];
+        }
+        for (std::size_t i = 0; i < n; i++) {
+            const u8* entry = entries + i * stride;
+            std::memcpy(scratch + positions[entry[byte]]++ * stride, entry, stride);
+        }
+        std::swap(entries, scratch);
+    }
+}
+
+/**
+ * Sorts inexact keys with an MSD radix sort. Buckets of at most MSD_CUTOFF
+ * entries, and buckets whose keys are used up, are finished with std::sort.
+ * @param entries The entries (key, then row number), reordered in place
+ * @param scratch Room for as many entries
+ * @param n The number of entries
+ * @param stride The size of an entry
+ * @param key_size The size of its key
+ * @param byte The key byte to split on; the bytes before it are the same in every entry
+ * @param order Set to the entries' row numbers, sorted
+ * @param less Orders two entries whose keys agree before a given byte
+ */
+template <typename Less>
+static void msd_radix_sort(u8* entries, u8* scratch, std::size_t n, std::size_t stride, std::size_t key_size,
+                           std::size_t byte, u32* order, const Less& less) {
+    if (n <= SortOperator::MSD_CUTOFF || byte == key_size) {
+        std::vector<const u8*> bucket(n);
+        for (std::size_t i = 0; i < n; i++)
+            bucket[i] = entries + i * stride;
+        std::sort(bucket.begin(), bucket.end(), [&](const u8* a, const u8* b) { return less(a, b, byte); });
+        for (std::size_t i = 0; i < n; i++)
+            std::memcpy(&order[i], bucket[i] + key_size, sizeof(u32));
+        return;
+    }
+
+    std::size_t counts[256] = {0};
+    for (std::size_t i = 0; i < n; i++)
+        counts[entries[i * stride + byte]]++;
+    if (counts[entries[byte]] == n) // one bucket: nothing to move
+        return msd_radix_sort(entries, scratch, n, stride, key_size, byte + 1, order, less);
+    std::size_t starts[256], positions[256], position = 0;
+    for (int digit = 0; digit < 256; digit++) {
+        starts[digit] = positions[digit] = position;
+        position += counts[digit];
+    }
+    for (std::size_t i = 0; i < n; i++) {
+        const u8* entry = entries + i * stride;
+        std::memcpy(scratch + positions[entry[byte]]++ * stride, entry, stride);
+    }
+    std::memcpy(entries, scratch, n * stride);
+    for (int digit = 0; digit < 256; digit++)
+        if (counts[digit])
+            msd_radix_sort(entries + starts[digit] * stride, scratch + starts[digit] * stride, counts[digit], stride,
+                           key_size, byte + 1, order + starts[digit], less);
+}
+
+// Begin Sort Operator Functions
+
+const std::size_t SortOperator::TEXT_PREFIX;
+const std::size_t SortOperator::MSD_CUTOFF;
+
+SortOperator::SortOperator(const ColumnNames& column_names, const ColumnAttributes& column_attributes,
+                           const std::vector<bool>& descending)
+    : column_names(column_names), data_types(), descending(descending), n_key_columns(0), key_size(0), exact(true)
+{
+    if (column_names.empty() || column_names.size() != column_attributes.size() ||
+        (!descending.empty() && descending.size() != column_names.size()))
+        throw DbRelationError("sort needs one attribute and direction per sort column");
+    if (this->descending.empty())
+        this->descending.assign(column_names.size(), false);
+    for (ColumnAttribute ca : column_attributes)
+        this->data_types.push_back(ca.get_data_type());
+    for (ColumnAttribute::DataType data_type : this->data_types) {
+        this->n_key_columns++;
+        if (data_type == ColumnAttribute::INT) {
+            this->key_size += sizeof(int32_t);
+        } else {
+            this->key_size += TEXT_PREFIX;
+            this->exact = false;
+            break;
+        }
+    }
+}
+
+void SortOperator::sort(std::vector<const ValueDict*>& rows, MemoryBudget* budget) const {
+    std::size_t n = rows.size();
+    if (n < 2)
+        return;
+    std::size_t stride = this->key_size + sizeof(u32);
+    std::size_t bytes = 2 * n * stride;
+    if (budget && !budget->reserve(bytes)) {
+        std::sort(rows.begin(), rows.end(),
+                  [this](const ValueDict* a, const ValueDict* b) { return this->compare(*a, *b) < 0; });
+        return;
+    }
+
+    std::vector<u32> order(n);
+    try {
+        std::vector<u8> buffer(bytes);
+        u8* entries = buffer.data();
+        u8* scratch = entries + n * stride;
+        for (u32 row_num = 0; row_num < n; row_num++) {
+            this->encode(*rows[row_num], entries + row_num * stride);
+            std::memcpy(entries + row_num * stride + this->key_size, &row_num, sizeof(u32));
+        }
+        if (this->exact) {
+            lsd_radix_sort(entries, scratch, n, stride, this->key_size);
+            for (std::size_t i = 0; i < n; i++)
+                std::memcpy(&order[i], entries + i * stride + this->key_size, sizeof(u32));
+        } else {
+            // keys that agree are tied by the rows' values
+            std::size_t key_size = this->key_size;
+            auto less = [this, &rows, key_size](const u8* a, const u8* b, std::size_t byte) {
+                int cmp = std::memcmp(a + byte, b + byte, key_size - byte);
+                if (cmp)
+                    return cmp < 0;
+                u32 a_row, b_row;
+                std::memcpy(&a_row, a + key_size, sizeof(u32));
+                std::memcpy(&b_row, b + key_size, sizeof(u32));
+                return this->compare(*rows[a_row], *rows[b_row]) < 0;
+            };
+            msd_radix_sort(entries, scratch, n, stride, this->key_size, 0, order.data(), less);
+        }
+    } catch (...) {
+        if (budget)
+            budget->release(bytes);
+        throw;
+    }
+    if (budget)
+        budget->release(bytes);
+
+    std::vector<const ValueDict*> sorted;
+    sorted.reserve(n);
+    for (u32 row_num : order)
+        sorted.push_back(rows[row_num]);
+    rows.swap(sorted);
+}
+
+int SortOperator::compare(const ValueDict& a, const ValueDict& b) const {
+    for (std::size_t i = 0; i < this->column_names.size(); i++) {
+        const Value& a_value = column_value(a, this->column_names[i]);
+        const Value& b_value = column_value(b, this->column_names[i]);
+        int cmp;
+        if (this->data_types[i] == ColumnAttribute::INT)
+            cmp = a_value.n < b_value.n ? -1 : a_value.n > b_value.n;
+        else
+            cmp = a_value.s.compare(b_value.s);
+        if (cmp)
+            return (cmp < 0) == this->descending[i] ? 1 : -1;
+    }
+    return 0;
+}
+
+void SortOperator::encode(const ValueDict& row, unsigned char* key) const {
+    for (std::size_t i = 0; i < this->n_key_columns; i++) {
+        const Value& value = column_value(row, this->column_names[i]);
+        std::size_t size;
+        if (this->data_types[i] == ColumnAttribute::INT) {
+            u32 bits = (u32)value.n ^ 0x80000000u; // negatives first
+            key[0] = bits >> 24;
+            key[1] = bits >> 16;
+            key[2] = bits >> 8;
+            key[3] = bits;
+            size = sizeof(int32_t);
+        } else {
+            size = TEXT_PREFIX;
+            std::size_t n_bytes = std::min(value.s.size(), TEXT_PREFIX);
+            std::memcpy(key, value.s.data(), n_bytes);
+            std::memset(key + n_bytes, 0, TEXT_PREFIX - n_bytes);
+        }
+        if (this->descending[i])
+            for (std::size_t j = 0; j < size; j++)
+                key[j] = ~key[j];
+        key += size;
+    }
+}
+
+// End Sort Operator Functions
+
+std::string benchmark_sort(std::size_t n_rows) {
+    typedef std::chrono::steady_clock Clock;
+    std::mt19937 random(5300);
+    std::vector<ValueDict> table(n_rows);
+    std::vector<const ValueDict*> rows;
+    for (ValueDict& row : table) {
+        std::string b(16, ' ');
+        for (char& c : b)
+            c = 'a' + random() % 26;
+        row["a"] = Value((int32_t)random());
+        row["b"] = Value(b);
+        rows.push_back(&row);
+    }
+
+    ColumnAttribute int_column(ColumnAttribute::INT), text_column(ColumnAttribute::TEXT);
+    std::unique_ptr<SortOperator> sorts[] = {
+        std::unique_ptr<SortOperator>(new SortOperator({"a"}, {int_column})),
+        std::unique_ptr<SortOperator>(new SortOperator({"b"}, {text_column})),
+        std::unique_ptr<SortOperator>(new SortOperator({"a", "b"}, {int_column, text_column}, {true, false}))};
+    const char* const orders[] = {"ORDER BY a", "ORDER BY b", "ORDER BY a DESC, b"};
+    std::ostringstream report;
+    for (int i = 0; i < 3; i++) {
+        const SortOperator& sort = *sorts[i];
+        std::vector<const ValueDict*> by_keys = rows;
+        Clock::time_point start = Clock::now();
+        sort.sort(by_keys);
+        double keys_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        std::vector<const ValueDict*> by_values = rows;
+        start = Clock::now();
+        std::sort(by_values.begin(), by_values.end(),
+                  [&sort](const ValueDict* a, const ValueDict* b) { return sort.compare(*a, *b) < 0; });
+        double values_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        bool same = true;
+        for (std::size_t row_num = 0; row_num < n_rows; row_num++)
+            same = same && !sort.compare(*by_keys[row_num], *by_values[row_num]);
+        report << orders[i] << " (" << n_rows << " rows, " << (sort.is_exact() ? "LSD" : "MSD") << "): "
+               << "normalized keys " << keys_ms << "ms, std::sort " << values_ms << "ms"
+               << (same ? "" : ", ORDERS DIFFER") << std::endl;
+    }
+    return report.str();
+}
+
+bool test_sort_operator() {
+    // negative and duplicate INTs; TEXTs that share more than a key's prefix
+    std::vector<ValueDict> table(3000);
+    std::vector<const ValueDict*> rows;
+    for (std::size_t i = 0; i < table.size(); i++) {
+        table[i]["a"] = Value((int32_t)(i * 7919 % 201) - 100);
+        table[i]["b"] = Value((i % 3 ? "a longer shared prefix " : "") + std::to_string(i % 37));
+        rows.push_back(&table[i]);
+    }
+    ColumnAttribute int_column(ColumnAttribute::INT), text_column(ColumnAttribute::TEXT);
+    SortOperator by_a({"a"}, {int_column});
+    SortOperator by_b({"b"}, {text_column});
+    SortOperator by_a_desc_b({"a", "b"}, {int_column, text_column}, {true, false});
+    SortOperator by_b_desc_a({"b", "a"}, {text_column, int_column}, {true, false});
+
+    // the exact (LSD) sort is stable, so it matches std::stable_sort row for row
+    std::vector<const ValueDict*> sorted = rows, expected = rows;
+    by_a.sort(sorted);
+    std::stable_sort(expected.begin(), expected.end(),
+                     [&by_a](const ValueDict* a, const ValueDict* b) { return by_a.compare(*a, *b) < 0; });
+    bool sort_ok = by_a.is_exact() && sorted == expected;
+    for (const SortOperator* sort : {&by_b, &by_a_desc_b, &by_b_desc_a}) {
+        sorted = rows;
+        sort->sort(sorted);
+        expected = rows;
+        std::sort(expected.begin(), expected.end(),
+                  [sort](const ValueDict* a, const ValueDict* b) { return sort->compare(*a, *b) < 0; });
+        sort_ok = sort_ok && !sort->is_exact() && sorted.size() == rows.size();
+        for (std::size_t i = 0; i < rows.size(); i++)
+            sort_ok = sort_ok && !sort->compare(*sorted[i], *expected[i]);
+    }
+    std::cout << "sort ok" << std::endl;
+
+    // a budget too small for the keys falls back to sorting the rows directly
+    MemoryManager small_pool(MemoryManager::MIN_GRANT), large_pool(64 << 20);
+    MemoryBudget small_budget(small_pool, 1 << 20), large_budget(large_pool, 1 << 20);
+    std::vector<const ValueDict*> within_budget = rows;
+    sorted = rows;
+    by_a_desc_b.sort(sorted, &small_budget);
+    by_a_desc_b.sort(within_budget, &large_budget);
+    bool budget_ok = small_budget.get_limit() < 2 * rows.size() * (by_a_desc_b.get_key_size() + sizeof(u32)) &&
+                     !small_budget.get_used() && !large_budget.get_used();
+    for (std::size_t i = 0; i < rows.size(); i++)
+        budget_ok = budget_ok && !by_a_desc_b.compare(*sorted[i], *within_budget[i]);
+    std::vector<const ValueDict*> missing(2, &table[0]);
+    ValueDict no_b;
+    no_b["a"] = Value(1);
+    missing.push_back(&no_b);
+    try {
+        by_b.sort(missing, &large_budget);
+        budget_ok = false;
+    } catch (DbRelationError& e) {}
+    budget_ok = budget_ok && !large_budget.get_used();
+    std::cout << "sort budget ok" << std::endl;
+
+    return sort_ok && budget_ok;
+}
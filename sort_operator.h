@@ -0,0 +1,113 @@
+/**
+ * @file sort_operator.h - Sorting rows by normalized keys.
+ * SortOperator
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+#include "admission_control.h"
+#include "storage_engine.h"
+
+/**
+ * @class SortOperator - sorts rows (ORDER BY) by normalized binary keys
+ *
+ * Each row gets a key whose bytes compare, with memcmp, in the order of its
+ * sort columns. An INT is stored big-endian with its sign bit flipped. A TEXT
+ * contributes its first TEXT_PREFIX bytes, zero-padded. A descending column's
+ * bytes are inverted. A key stops after its first TEXT column, since a
+ * truncated prefix can't order the columns after it.
+ *
+ * Keys and row numbers are packed into one array of fixed-size entries, so
+ * sorting moves entries and never touches the rows themselves. When every sort
+ * column is an INT, the keys are exact, and an LSD radix sort orders them. It
+ * makes one stable pass per key byte and skips bytes that are the same in
+ * every key. Otherwise an MSD radix sort splits the entries by key byte until
+ * a bucket holds at most MSD_CUTOFF entries or its keys run out. Each bucket
+ * is then finished with std::sort, which breaks key ties by comparing the
+ * rows' values.
+ */
+class SortOperator {
+public:
+    static const std::size_t TEXT_PREFIX = 12;
+    static const std::size_t MSD_CUTOFF = 64;
+
+    /**
+     * @param column_names The sort columns, most significant first
+     * @param column_attributes The sort columns' attributes
+     * @param descending Which sort columns are descending (all ascending if empty)
+     * @throws DbRelationError if there are no sort columns or the lists differ in length
+     */
+    SortOperator(const ColumnNames& column_names, const ColumnAttributes& column_attributes,
+                 const std::vector<bool>& descending = std::vector<bool>());
+
+    virtual ~SortOperator() {}
+
+    SortOperator(const SortOperator& other) = delete;
+
+    SortOperator(SortOperator&& temp) = delete;
+
+    SortOperator& operator=(const SortOperator& other) = delete;
+
+    SortOperator& operator=(SortOperator&& temp) = delete;
+
+    /**
+     * Sorts rows by the sort columns. If a budget is given and can't hold the
+     * keys (twice over, for the radix sort's scratch space), the row pointers
+     * are sorted with compare() instead.
+     * @param rows The rows, sorted in place
+     * @param budget The operator's memory budget, or nullptr if unlimited
+     * @throws DbRelationError if a row lacks a sort column
+     */
+    virtual void sort(std::vector<const ValueDict*>& rows, MemoryBudget* budget = nullptr) const;
+
+    /**
+     * Compares two rows by the sort columns
+     * @return Negative, zero, or positive as a sorts before, with, or after b
+     * @throws DbRelationError if a row lacks a sort column
+     */
+    virtual int compare(const ValueDict& a, const ValueDict& b) const;
+
+    /**
+     * Writes a row's normalized key
+     * @param row The row
+     * @param key Where to write get_key_size() bytes
+     * @throws DbRelationError if the row lacks a sort column
+     */
+    virtual void encode(const ValueDict& row, unsigned char* key) const;
+
+    /**
+     * Retrieves the size of a normalized key
+     */
+    virtual std::size_t get_key_size() const { return this->key_size; }
+
+    /**
+     * Checks whether keys alone order the rows (every sort column is an INT)
+     */
+    virtual bool is_exact() const { return this->exact; }
+
+protected:
+    ColumnNames column_names;
+    std::vector<ColumnAttribute::DataType> data_types;
+    std::vector<bool> descending;
+    std::size_t n_key_columns; // sort columns encoded in the key
+    std::size_t key_size;
+    bool exact;
+};
+
+/**
+ * Sorts rows of an INT and a TEXT column by the INT, by the TEXT, and by the
+ * INT descending then the TEXT, first with SortOperator, then with std::sort
+ * and a comparator that looks the columns up in each ValueDict
+ * @param n_rows The number of rows
+ * @return A report of the timings
+ */
+std::string benchmark_sort(std::size_t n_rows);
+
+/**
+ * Sort operator test function. Returns true if all tests pass.
+ */
+bool test_sort_operator();
@@ -6,16 +6,50 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <mutex>
 #include <string>
 #include <iostream>
+#include <unistd.h>
 #include "db_cxx.h"
 #include "SQLParser.h"
 #include "sqlhelper.h"
+#include "admission_control.h"
+#include "btree_storage.h"
 #include "heap_storage.h"
+#include "join_operators.h"
+#include "partitioned_storage.h"
+#include "query_cache.h"
+#include "sort_operator.h"
+#include "sql_server.h"
+#include "statement_scheduler.h"
  
 DbEnv* _DB_ENV; // Global DB environment
-const u_int32_t ENV_FLAGS = DB_CREATE | DB_INIT_MPOOL;
-const std::string TEST = "test", QUIT = "quit";
+// DB_THREAD: server, partition, and I/O threads all use handles, so every Dbt a get fills brings its own memory
+const u_int32_t ENV_FLAGS = DB_CREATE | DB_INIT_MPOOL | DB_THREAD;
+const std::string TEST = "test", STATUS = "status", BENCH = "bench", QUIT = "quit";
+const std::string MIGRATE = "migrate", BENCH_PAGES = "bench pages", BENCH_QUEUE = "bench queue";
+const std::string BENCH_LATE = "bench late", BENCH_TEXT = "bench text", BENCH_SORT = "bench sort";
+const std::string BENCH_JOIN = "bench join", BENCH_SEMI = "bench semi";
+const Identifier BENCH_TABLE = "_bench_rows";
+const std::size_t BENCH_PAGE_BLOCKS = 10000; // blocks written and read per page size or access method
+const std::size_t BENCH_LATE_ROWS = 100000; // rows in the wide table queried by bench late
+const std::size_t BENCH_TEXT_ROWS = 100000; // rows of 200-byte TEXT values filtered by bench text
+const std::size_t BENCH_SORT_ROWS = 1000000; // rows sorted by bench sort
+const std::size_t BENCH_JOIN_OUTER = 10000; // most outer rows joined by bench join
+const std::size_t BENCH_SEMI_OUTER = 10000; // outer rows semi-joined by bench semi
+const std::size_t OPERATOR_MEMORY_SZ = 64 << 20; // 64MB shared by sorts and hash tables
+MemoryManager memoryManager(OPERATOR_MEMORY_SZ);
+const unsigned MAX_HEAVY_QUERIES = 4;
+AdmissionController admission(MAX_HEAVY_QUERIES); // Heavy queries queue, point lookups bypass
+
+/**
+ * Retrieves the scheduler that runs independent statements of one query
+ * concurrently. It is created on first use rather than during static
+ * initialization, so in server mode its threads start after SQLServer has
+ * blocked SIGINT and SIGTERM, and inherit that mask.
+ * @return The statement scheduler
+ */
+StatementScheduler& getStatementScheduler();
 
 /**
  * Establishes a database environment
@@ -29,23 +63,107 @@ DbEnv* initDbEnv(std::string);
  */
 void runSQLShell();
 
+/**
+ * Serves SQL sessions over a Unix domain socket until interrupted
+ * @param socketPath The path of the socket to listen on
+ */
+void runSQLServer(std::string);
+
 /**
  * Processes a single SQL query
  * @param sql A SQL query (or queries) to process
+ * @return The output of the query
+ */
+std::string handleSQL(std::string);
+
+/**
+ * Processes a single SQL query for a server session
+ * @param sql A SQL query (or queries) to process
+ * @param writer Encodes the output of the query for the client
+ */
+void handleRemoteSQL(const std::string&, ResultWriter&);
+
+/**
+ * Streams rows of the benchmark table straight from its blocks, filling the
+ * table up to the requested size first
+ * @param nRows The number of rows to stream
+ * @param writer Encodes the rows for the client
+ */
+void streamBenchRows(std::size_t, ResultWriter&);
+
+/**
+ * Rewrites a table's heap file with full-sized Berkeley DB pages, if it was
+ * created with smaller ones. The table must not be in use meanwhile.
+ * @param tableName The name of the table
+ * @return A description of what was done
  */
-void handleSQL(std::string);
+std::string migrateTable(const Identifier&);
 
 /**
- * Processes SQL statements within a parsed query
+ * Processes SQL statements within a parsed query. Statements touching disjoint
+ * tables (or only reading) run concurrently; ones touching a common table
+ * that either writes run in order.
  * @param parsedSQL A pointer to a parsed SQL query
+ * @return The output of the statements, one per line
  */
-void handleStatements(hsql::SQLParserResult* const);
+std::string handleStatements(hsql::SQLParserResult* const);
 
 /**
- * Executes a provided SQL statement
+ * Executes a provided SQL statement. There is no executor yet, so the result
+ * is the unparsed statement; SELECT statements still queue for admission.
  * @param statement A pointer to a SQL statement
+ * @return The result of the statement
+ */
+std::string execute(const hsql::SQLStatement* const);
+
+/**
+ * Decides whether a SELECT statement must queue for admission. Only point
+ * lookups (one table filtered by equalities with literals, at least one of
+ * them on an indexed column, no ordering or grouping) are light enough to
+ * bypass the queue. Without an index the same filter is a full scan.
+ * @param statement A pointer to a SELECT statement
+ * @return True if the statement is heavy
+ */
+bool isHeavy(const hsql::SelectStatement* const);
+
+/**
+ * Checks whether an expression is a conjunction of column = literal terms
+ * @param expr A pointer to an expression
+ * @param columnNames The list to append the filtered columns to
+ * @return True if the expression can only match by equality
  */
-void execute(const hsql::SQLStatement* const);
+bool isEqualityFilter(hsql::Expr* const, ColumnNames&);
+
+/**
+ * Determines which tables a statement reads and which it modifies
+ * @param statement A pointer to a SQL statement
+ * @param reads The list to append tables read to
+ * @param writes The list to append tables modified to
+ * @return False if the statement's table access is unknown
+ */
+bool getTableAccess(const hsql::SQLStatement* const, ColumnNames&, ColumnNames&);
+
+/**
+ * Collects the names of all tables referenced by a SELECT statement,
+ * including those in subqueries
+ * @param statement A pointer to a SELECT statement
+ * @param tableNames The list to append table names to
+ */
+void getTableNames(const hsql::SelectStatement* const, ColumnNames&);
+
+/**
+ * Collects the names of all tables referenced by a table reference
+ * @param table A pointer to a database table reference
+ * @param tableNames The list to append table names to
+ */
+void getTableNames(hsql::TableRef* const, ColumnNames&);
+
+/**
+ * Collects the names of all tables referenced by subqueries in an expression
+ * @param expr A pointer to an expression
+ * @param tableNames The list to append table names to
+ */
+void getTableNames(hsql::Expr* const, ColumnNames&);
 
 /**
  * Unparses a statement into a string
@@ -97,19 +215,27 @@ std::string toString(hsql::TableRef* const);
 std::string toString(hsql::JoinDefinition* const);
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        std::cout << "USAGE: " << argv[0] << " [db_environment]\n";
+    if (argc != 2 && argc != 3) {
+        std::cout << "USAGE: " << argv[0] << " [db_environment] [server_socket]\n";
         return EXIT_FAILURE;
     }
     std::string envDir = argv[1];
     _DB_ENV = initDbEnv(envDir);
     std::cout << "(sql5300: running with database environment at " << envDir << std::endl;
-    runSQLShell();
+    if (argc == 3)
+        runSQLServer(argv[2]);
+    else
+        runSQLShell();
     _DB_ENV->close(0);
     delete _DB_ENV;
     return EXIT_SUCCESS;
 }
 
+StatementScheduler& getStatementScheduler() {
+    static StatementScheduler statementScheduler;
+    return statementScheduler;
+}
+
 DbEnv* initDbEnv(std::string envDir) {
     DbEnv* dbEnv = new DbEnv(0U);
     dbEnv->set_message_stream(&std::cout);
@@ -129,33 +255,260 @@ void runSQLShell() {
     while (sql != QUIT) {
         std::cout << "SQL> ";
         std::getline(std::cin, sql);
-        if (sql.length())
-            handleSQL(sql);
+        if (sql.length() && sql != QUIT)
+            std::cout << handleSQL(sql) << std::endl;
     }
 }
 
-void handleSQL(std::string sql) {
-    if (sql == QUIT) return;
+void runSQLServer(std::string socketPath) {
+    SQLServer server(socketPath, handleRemoteSQL);
+    std::cout << "(sql5300: serving on " << socketPath << ")" << std::endl;
+    try {
+        server.run();
+    } catch (std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+std::string handleSQL(std::string sql) {
+    if (sql == QUIT) return "";
+    std::string output;
     hsql::SQLParserResult* const parsedSQL = hsql::SQLParser::parseSQLString(sql);
     if (parsedSQL->isValid())
-        handleStatements(parsedSQL);
+        output = handleStatements(parsedSQL);
     else if (sql == TEST)
-        std::cout << (test_heap_storage() ? "Passed" : "Failed") << std::endl;
+        output = test_heap_storage() && test_btree_storage() && test_partitioned_storage() && test_sort_operator() &&
+                 test_join_operators() && test_query_cache() && test_statement_scheduler() &&
+                 test_admission_control() && test_wire_protocol() ? "Passed" : "Failed";
+    else if (sql == STATUS)
+        output = admission_stats(admission, memoryManager);
+    else if (sql.compare(0, MIGRATE.size() + 1, MIGRATE + " ") == 0)
+        output = migrateTable(sql.substr(MIGRATE.size() + 1));
+    else if (sql == BENCH_PAGES)
+        output = benchmark_page_size(BENCH_PAGE_BLOCKS);
+    else if (sql == BENCH_QUEUE)
+        output = benchmark_access_methods(BENCH_PAGE_BLOCKS);
+    else if (sql == BENCH_LATE)
+        output = benchmark_late_materialization(BENCH_LATE_ROWS);
+    else if (sql == BENCH_TEXT)
+        output = benchmark_text_filters(BENCH_TEXT_ROWS);
+    else if (sql == BENCH_SORT)
+        output = benchmark_sort(BENCH_SORT_ROWS);
+    else if (sql == BENCH_JOIN)
+        output = benchmark_index_join(BENCH_JOIN_OUTER);
+    else if (sql == BENCH_SEMI)
+        output = benchmark_semi_join(BENCH_SEMI_OUTER);
     else
-        std::cout << "INVALID SQL: " << sql << std::endl;
+        output = "INVALID SQL: " + sql;
     delete parsedSQL;
+    return output;
+}
+
+void handleRemoteSQL(const std::string& sql, ResultWriter& writer) {
+    // "bench N" streams rows; named benchmarks such as "bench sort" run like any other command
+    std::string argument = sql.compare(0, BENCH.size() + 1, BENCH + " ") == 0 ? sql.substr(BENCH.size() + 1) : "";
+    if (!argument.empty() && argument.find_first_not_of("0123456789") == std::string::npos)
+        streamBenchRows(std::stoul(argument), writer);
+    else
+        writer.text(handleSQL(sql));
+}
+
+void streamBenchRows(std::size_t nRows, ResultWriter& writer) {
+    static std::mutex benchMutex; // sessions share the one benchmark table
+    std::lock_guard<std::mutex> lock(benchMutex);
+    ColumnNames columnNames;
+    columnNames.push_back("a");
+    columnNames.push_back("b");
+    ColumnAttributes columnAttributes;
+    columnAttributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    columnAttributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table(BENCH_TABLE, columnNames, columnAttributes);
+    table.create_if_not_exists();
+
+    Handles* handles = table.select();
+    std::size_t nExisting = handles->size();
+    delete handles;
+    ValueDict row;
+    for (std::size_t i = nExisting; i < nRows; i++) {
+        row["a"] = Value((int32_t)i);
+        row["b"] = Value("benchmark row " + std::to_string(i));
+        table.insert(&row);
+    }
+
+    writer.begin_rows(table.get_column_attributes());
+    std::size_t nSent = 0;
+    table.scan_records([&](const Handle& handle, const Dbt& record) {
+        if (nSent++ < nRows)
+            writer.row(record);
+    });
+    table.close();
 }
 
-void handleStatements(hsql::SQLParserResult* const parsedSQL) {
+std::string migrateTable(const Identifier& tableName) {
+    HeapFile file(tableName);
+    if (!file.exists())
+        return "no such table " + tableName;
+    try {
+        if (!file.migrate())
+            return tableName + " already uses " + std::to_string(HeapFile::PAGE_SZ) + "-byte pages";
+    } catch (std::exception& e) {
+        return std::string("migration failed: ") + e.what();
+    }
+    return "migrated " + tableName + " to " + std::to_string(HeapFile::PAGE_SZ) + "-byte pages";
+}
+
+std::string handleStatements(hsql::SQLParserResult* const parsedSQL) {
     std::size_t nStatements = parsedSQL->size();
+    StatementScheduler::Tasks tasks(nStatements);
     for (std::size_t i = 0; i < nStatements; i++) {
         const hsql::SQLStatement* const statement = parsedSQL->getStatement(i);
-        execute(statement);
+        tasks[i].barrier = !getTableAccess(statement, tasks[i].reads, tasks[i].writes);
+        tasks[i].run = [statement] { return execute(statement); };
+    }
+    std::vector<std::string> results = getStatementScheduler().run(tasks);
+
+    std::string output;
+    for (std::size_t i = 0; i < nStatements; i++) {
+        output.append(results[i]);
+        if (i + 1 < nStatements)
+            output.push_back('\n');
+    }
+    return output;
+}
+
+std::string execute(const hsql::SQLStatement* const statement) {
+    if (statement->type() != hsql::StatementType::kStmtSelect)
+        return unparse(statement);
+
+    const hsql::SelectStatement* const select = dynamic_cast<const hsql::SelectStatement* const>(statement);
+    AdmissionTicket ticket(admission, isHeavy(select));
+    // there is no SELECT executor yet: the result is the statement's unparsed text
+    return unparse(statement);
+}
+
+bool isHeavy(const hsql::SelectStatement* const statement) {
+    if (!statement->fromTable || statement->fromTable->type != hsql::TableRefType::kTableName)
+        return true;
+    if (statement->groupBy || statement->order)
+        return true;
+    ColumnNames columnNames;
+    if (!statement->whereClause || !isEqualityFilter(statement->whereClause, columnNames))
+        return true;
+    // an index on any filtered column (a PRIMARY KEY or UNIQUE one) turns the filter into a lookup;
+    // its file is named as BTreeIndex names it, so a stat is enough to find it
+    const char* home;
+    _DB_ENV->get_home(&home);
+    for (const Identifier& columnName : columnNames) {
+        std::string indexPath = std::string(home) + "/" + statement->fromTable->name + "-" + columnName + ".db";
+        if (access(indexPath.c_str(), F_OK) == 0)
+            return false;
     }
+    return true;
+}
+
+bool isEqualityFilter(hsql::Expr* const expr, ColumnNames& columnNames) {
+    if (expr->type != hsql::ExprType::kExprOperator)
+        return false;
+    if (expr->opType == hsql::Expr::AND)
+        return isEqualityFilter(expr->expr, columnNames) && isEqualityFilter(expr->expr2, columnNames);
+    if (expr->opType != hsql::Expr::SIMPLE_OP || expr->opChar != '=')
+        return false;
+    hsql::Expr* const literal = expr->expr->type == hsql::ExprType::kExprColumnRef ? expr->expr2 : expr->expr;
+    hsql::Expr* const column = literal == expr->expr2 ? expr->expr : expr->expr2;
+    if (column->type != hsql::ExprType::kExprColumnRef
+        || (literal->type != hsql::ExprType::kExprLiteralInt && literal->type != hsql::ExprType::kExprLiteralString))
+        return false;
+    columnNames.push_back(column->name);
+    return true;
 }
 
-void execute(const hsql::SQLStatement* const statement) {
-    std::cout << unparse(statement) << std::endl;
+bool getTableAccess(const hsql::SQLStatement* const statement, ColumnNames& reads, ColumnNames& writes) {
+    switch (statement->type()) {
+        case hsql::StatementType::kStmtSelect:
+            getTableNames(dynamic_cast<const hsql::SelectStatement* const>(statement), reads);
+            return true;
+        case hsql::StatementType::kStmtInsert: {
+            const hsql::InsertStatement* const insert = dynamic_cast<const hsql::InsertStatement* const>(statement);
+            writes.push_back(insert->tableName);
+            if (insert->select)
+                getTableNames(insert->select, reads);
+            return true;
+        }
+        case hsql::StatementType::kStmtUpdate: {
+            const hsql::UpdateStatement* const update = dynamic_cast<const hsql::UpdateStatement* const>(statement);
+            getTableNames(update->table, writes);
+            getTableNames(update->where, reads);
+            return true;
+        }
+        case hsql::StatementType::kStmtDelete: {
+            const hsql::DeleteStatement* const del = dynamic_cast<const hsql::DeleteStatement* const>(statement);
+            writes.push_back(del->tableName);
+            getTableNames(del->expr, reads);
+            return true;
+        }
+        case hsql::StatementType::kStmtCreate:
+            writes.push_back(dynamic_cast<const hsql::CreateStatement* const>(statement)->tableName);
+            return true;
+        case hsql::StatementType::kStmtDrop: {
+            const hsql::DropStatement* const drop = dynamic_cast<const hsql::DropStatement* const>(statement);
+            if (drop->type != hsql::DropStatement::EntityType::kTable)
+                return false;
+            writes.push_back(drop->name);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+void getTableNames(const hsql::SelectStatement* const statement, ColumnNames& tableNames) {
+    getTableNames(statement->fromTable, tableNames);
+    if (statement->selectList)
+        for (hsql::Expr* const expr : *statement->selectList)
+            getTableNames(expr, tableNames);
+    getTableNames(statement->whereClause, tableNames);
+    if (statement->groupBy)
+        getTableNames(statement->groupBy->having, tableNames);
+    if (statement->unionSelect)
+        getTableNames(statement->unionSelect, tableNames);
+}
+
+void getTableNames(hsql::Expr* const expr, ColumnNames& tableNames) {
+    if (!expr) return;
+    if (expr->type == hsql::ExprType::kExprSelect) {
+        getTableNames(expr->select, tableNames);
+        return;
+    }
+    // IN (SELECT ...) and EXISTS are operators that carry their subquery
+    if (expr->type == hsql::ExprType::kExprOperator && expr->select)
+        getTableNames(expr->select, tableNames);
+    getTableNames(expr->expr, tableNames);
+    getTableNames(expr->expr2, tableNames);
+    if (expr->exprList)
+        for (hsql::Expr* const e : *expr->exprList)
+            getTableNames(e, tableNames);
+}
+
+void getTableNames(hsql::TableRef* const table, ColumnNames& tableNames) {
+    if (!table) return;
+    switch (table->type) {
+        case hsql::TableRefType::kTableName:
+            tableNames.push_back(table->name);
+            break;
+        case hsql::TableRefType::kTableSelect:
+            getTableNames(table->select, tableNames);
+            break;
+        case hsql::TableRefType::kTableJoin:
+            getTableNames(table->join->left, tableNames);
+            getTableNames(table->join->right, tableNames);
+            break;
+        case hsql::TableRefType::kTableCrossProduct:
+            for (hsql::TableRef* const t : *table->list)
+                getTableNames(t, tableNames);
+            break;
+        default:
+            break;
+    }
 }
 
 std::string unparse(const hsql::SQLStatement* const statement) {
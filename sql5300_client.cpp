@@ -0,0 +1,289 @@
+/**
+ * @file sql5300_client.cpp - Client for the sql5300 server
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "wire_protocol.h"
+
+const std::string QUIT = "quit", BENCH = "bench", ROWS = "rows";
+// parsed, admitted, and echoed by the server (there is no executor), so bench times the protocol and scheduling
+const std::string BENCH_SQL = "SELECT a, b FROM bench WHERE a = 1";
+
+/**
+ * @class Connection - a client session speaking the wire protocol
+ */
+class Connection {
+public:
+    Connection() : fd(-1), reader(), next_request_id(1) {}
+
+    ~Connection() {
+        if (this->fd >= 0)
+            close(this->fd);
+    }
+
+    /**
+     * Connects to a server's Unix domain socket
+     * @param socketPath The path of the server socket
+     * @return True if connected
+     */
+    bool open(std::string socketPath);
+
+    /**
+     * Sends statements without waiting for their results
+     * @param statements The statements to send
+     * @return True if all were sent
+     */
+    bool send(const std::vector<std::string>& statements);
+
+    /**
+     * Receives the next frame from the server
+     * @param frame Set to the received frame
+     * @return True if a frame was received
+     * @throws WireProtocolError if the server sent a malformed frame
+     */
+    bool receive(Frame& frame);
+
+protected:
+    int fd;
+    FrameReader reader;
+    u_int32_t next_request_id;
+};
+
+/**
+ * Reads statements from stdin and prints their results until quit
+ * @param connection The connected session
+ */
+void runClientShell(Connection&);
+
+/**
+ * Runs a fixed number of statements from many concurrent sessions and reports
+ * throughput and latency
+ * @param socketPath The path of the server socket
+ * @param nClients The number of concurrent sessions
+ * @param nStatements The number of statements each session sends
+ * @param depth The number of statements each session keeps in flight
+ */
+void runBenchmark(std::string, int, int, int);
+
+/**
+ * Streams rows from the server's benchmark table and reports rows per second
+ * @param socketPath The path of the server socket
+ * @param nRows The number of rows to stream
+ */
+void runRowsBenchmark(std::string, int);
+
+int main(int argc, char** argv) {
+    if ((argc == 5 || argc == 6) && argv[2] == BENCH) {
+        runBenchmark(argv[1], std::atoi(argv[3]), std::atoi(argv[4]), argc == 6 ? std::atoi(argv[5]) : 1);
+        return EXIT_SUCCESS;
+    }
+    if (argc == 4 && argv[2] == ROWS) {
+        runRowsBenchmark(argv[1], std::atoi(argv[3]));
+        return EXIT_SUCCESS;
+    }
+    if (argc != 2) {
+        std::cout << "USAGE: " << argv[0] << " [server_socket] "
+                  << "[bench n_clients n_statements [depth] | rows n_rows]\n";
+        return EXIT_FAILURE;
+    }
+    Connection connection;
+    if (!connection.open(argv[1])) {
+        std::cerr << "could not connect to " << argv[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+    runClientShell(connection);
+    return EXIT_SUCCESS;
+}
+
+bool Connection::open(std::string socketPath) {
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path))
+        return false;
+    std::strcpy(addr.sun_path, socketPath.c_str());
+    this->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (this->fd < 0)
+        return false;
+    return connect(this->fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+}
+
+bool Connection::send(const std::vector<std::string>& statements) {
+    std::string out;
+    for (const std::string& sql : statements)
+        Frame(FrameType::QUERY, this->next_request_id++, sql).encode(out);
+    std::size_t sent = 0;
+    while (sent < out.size()) {
+        ssize_t n = ::send(this->fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+bool Connection::receive(Frame& frame) {
+    char buffer[64 * 1024];
+    while (!this->reader.next(frame)) {
+        ssize_t n = recv(this->fd, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+            return false;
+        this->reader.feed(buffer, n);
+    }
+    return true;
+}
+
+void runClientShell(Connection& connection) {
+    std::string sql = "";
+    Frame frame;
+    std::vector<Value> row;
+    while (sql != QUIT) {
+        std::cout << "SQL> ";
+        if (!std::getline(std::cin, sql))
+            break;
+        if (!sql.length() || sql == QUIT)
+            continue;
+        if (!connection.send(std::vector<std::string>(1, sql))) {
+            std::cerr << "connection lost" << std::endl;
+            break;
+        }
+        bool done = false;
+        while (!done) {
+            try {
+                if (!connection.receive(frame)) {
+                    std::cerr << "connection lost" << std::endl;
+                    return;
+                }
+            } catch (WireProtocolError& e) {
+                // the stream can no longer be split into frames
+                std::cerr << "protocol error: " << e.what() << std::endl;
+                return;
+            }
+            switch (frame.type) {
+                case FrameType::TEXT:
+                    std::cout << frame.payload << std::endl;
+                    break;
+                case FrameType::ROWS: {
+                    try {
+                        RowBatchReader rows(frame.payload);
+                        while (rows.next(row)) {
+                            for (std::size_t i = 0; i < row.size(); i++) {
+                                if (row[i].data_type == ColumnAttribute::INT)
+                                    std::cout << row[i].n;
+                                else
+                                    std::cout << '"' << row[i].s << '"';
+                                std::cout << (i + 1 < row.size() ? " " : "\n");
+                            }
+                        }
+                    } catch (WireProtocolError& e) {
+                        // only this batch is bad; the frames after it are still readable
+                        std::cout << "Error: malformed rows: " << e.what() << std::endl;
+                    }
+                    break;
+                }
+                case FrameType::ERROR:
+                    std::cout << "Error: " << frame.payload << std::endl;
+                    done = true;
+                    break;
+                default:
+                    done = true;
+                    break;
+            }
+        }
+    }
+}
+
+void runBenchmark(std::string socketPath, int nClients, int nStatements, int depth) {
+    using Clock = std::chrono::steady_clock;
+    std::vector<std::thread> clients;
+    std::vector<int> completed(nClients, 0);
+    if (depth < 1)
+        depth = 1;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < nClients; i++) {
+        clients.push_back(std::thread([&, i] {
+            Connection connection;
+            if (!connection.open(socketPath))
+                return;
+            Frame frame;
+            int sent = 0;
+            while (completed[i] < nStatements) {
+                // keep up to depth requests in flight
+                int batch = std::min(depth - (sent - completed[i]), nStatements - sent);
+                if (batch > 0) {
+                    if (!connection.send(std::vector<std::string>(batch, BENCH_SQL)))
+                        return;
+                    sent += batch;
+                }
+                if (!connection.receive(frame))
+                    return;
+                if (frame.type == FrameType::DONE || frame.type == FrameType::ERROR)
+                    completed[i]++;
+            }
+        }));
+    }
+    for (std::thread& client : clients)
+        client.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    long total = 0;
+    for (int count : completed)
+        total += count;
+    std::cout << nClients << " clients, depth " << depth << ", " << total << " statements in " << seconds
+              << "s: " << (seconds > 0 ? total / seconds : 0) << " statements/s, "
+              << (total ? seconds * nClients * 1e6 / total : 0) << "us per statement per client" << std::endl;
+}
+
+void runRowsBenchmark(std::string socketPath, int nRows) {
+    using Clock = std::chrono::steady_clock;
+    Connection connection;
+    if (!connection.open(socketPath)) {
+        std::cerr << "could not connect to " << socketPath << std::endl;
+        return;
+    }
+    // the first request fills the benchmark table; time the second
+    for (int pass = 0; pass < 2; pass++) {
+        Clock::time_point start = Clock::now();
+        if (!connection.send(std::vector<std::string>(1, BENCH + " " + std::to_string(nRows))))
+            return;
+        Frame frame;
+        std::vector<Value> row;
+        long rows = 0, bytes = 0, batches = 0;
+        bool done = false;
+        try {
+            while (!done && connection.receive(frame)) {
+                bytes += Frame::HEADER_SZ + frame.payload.size();
+                if (frame.type == FrameType::ROWS) {
+                    RowBatchReader reader(frame.payload);
+                    while (reader.next(row))
+                        rows++;
+                    batches++;
+                } else if (frame.type == FrameType::ERROR) {
+                    std::cerr << "Error: " << frame.payload << std::endl;
+                    return;
+                } else if (frame.type == FrameType::DONE) {
+                    done = true;
+                }
+            }
+        } catch (WireProtocolError& e) {
+            std::cerr << "protocol error: " << e.what() << std::endl;
+            return;
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (pass == 1)
+            std::cout << rows << " rows in " << batches << " batches (" << bytes << " bytes) in " << seconds
+                      << "s: " << (seconds > 0 ? rows / seconds : 0) << " rows/s" << std::endl;
+    }
+}
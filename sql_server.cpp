@@ -0,0 +1,385 @@
+/**
+ * @file sql_server.cpp - Implementation of the Unix domain socket server.
+ * SQLServer
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include "sql_server.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const int MAX_EVENTS = 64;
+const std::size_t READ_SZ = 4096;
+const uint32_t CLIENT_EVENTS = EPOLLIN | EPOLLRDHUP;
+
+/**
+ * Raises a runtime error describing the failed system call
+ * @param what The failed operation
+ */
+static void fail(const std::string& what) {
+    throw std::runtime_error("sql server: " + what + ": " + std::strerror(errno));
+}
+
+SQLServer::SQLServer(std::string socket_path, Handler handler, unsigned n_workers)
+    : socket_path(socket_path), handler(handler), n_workers(n_workers), listen_fd(-1), epoll_fd(-1),
+      event_fd(-1), signal_fd(-1), spare_fd(-1), stopping(false)
+{
+    if (!this->n_workers)
+        this->n_workers = std::thread::hardware_concurrency();
+    if (!this->n_workers)
+        this->n_workers = 1;
+}
+
+SQLServer::~SQLServer() {
+    for (int fd : {this->listen_fd, this->epoll_fd, this->event_fd, this->signal_fd, this->spare_fd})
+        if (fd >= 0)
+            ::close(fd);
+}
+
+void SQLServer::run() {
+    // however the loop exits, stop and join the workers (a joinable std::thread terminates the process)
+    struct Shutdown {
+        SQLServer* server;
+        ~Shutdown() { this->server->shutdown(); }
+    } shutdown{this};
+
+    this->listen();
+    for (unsigned i = 0; i < this->n_workers; i++)
+        this->workers.push_back(std::thread(&SQLServer::serve, this));
+
+    struct epoll_event events[MAX_EVENTS];
+    bool stop = false;
+    while (!stop) {
+        int n = epoll_wait(this->epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail("epoll_wait");
+        }
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == this->listen_fd) {
+                this->accept();
+            } else if (fd == this->event_fd) {
+                this->deliver();
+            } else if (fd == this->signal_fd) {
+                stop = true;
+            } else {
+                std::map<int, SessionPtr>::iterator found = this->sessions.find(fd);
+                if (found == this->sessions.end())
+                    continue;
+                SessionPtr session = found->second;
+                if (events[i].events & EPOLLOUT)
+                    this->flush(session);
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                    this->receive(session);
+            }
+        }
+    }
+}
+
+void SQLServer::listen() {
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (this->socket_path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("sql server: socket path too long");
+    std::strcpy(addr.sun_path, this->socket_path.c_str());
+    ::unlink(this->socket_path.c_str());
+
+    this->listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (this->listen_fd < 0)
+        fail("socket");
+    if (::bind(this->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        fail("bind");
+    if (::listen(this->listen_fd, SOMAXCONN) < 0)
+        fail("listen");
+
+    this->spare_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    this->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->event_fd < 0)
+        fail("eventfd");
+
+    // SIGINT/SIGTERM are delivered through the epoll loop so shutdown is orderly
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &signals, nullptr))
+        fail("pthread_sigmask");
+    this->signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (this->signal_fd < 0)
+        fail("signalfd");
+
+    this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (this->epoll_fd < 0)
+        fail("epoll_create1");
+    for (int fd : {this->listen_fd, this->event_fd, this->signal_fd}) {
+        struct epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+            fail("epoll_ctl");
+    }
+}
+
+void SQLServer::accept() {
+    while (true) {
+        int fd = ::accept4(this->listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO)
+                continue;
+            if (errno != EMFILE && errno != ENFILE && errno != ENOBUFS && errno != ENOMEM)
+                fail("accept");
+            std::cerr << "sql server: accept: " << std::strerror(errno) << std::endl;
+            if ((errno != EMFILE && errno != ENFILE) || this->spare_fd < 0)
+                return;
+            // the connection would stay pending and wake the loop forever, so accept it on the spare and hang up
+            ::close(this->spare_fd);
+            int refused = ::accept4(this->listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (refused >= 0)
+                ::close(refused);
+            this->spare_fd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+            continue;
+        }
+        SessionPtr session = std::make_shared<Session>();
+        session->fd = fd;
+        session->running = false;
+        session->closing = false;
+        struct epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = CLIENT_EVENTS;
+        event.data.fd = fd;
+        if (epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            ::close(fd);
+            continue;
+        }
+        this->sessions[fd] = session;
+    }
+}
+
+void SQLServer::receive(SessionPtr session) {
+    char buffer[READ_SZ];
+    bool hung_up = false;
+    while (true) {
+        ssize_t n = ::read(session->fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            session->in.feed(buffer, n);
+        } else if (n == 0) {
+            hung_up = true;
+            break;
+        } else {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                hung_up = true;
+            break;
+        }
+    }
+
+    std::vector<Frame> statements;
+    try {
+        Frame frame;
+        while (session->in.next(frame)) {
+            if (frame.type != FrameType::QUERY)
+                throw WireProtocolError("expected a query frame");
+            statements.push_back(frame);
+        }
+    } catch (WireProtocolError& e) {
+        hung_up = true; // the stream cannot be resynchronized
+    }
+
+    bool close_now = false;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (Frame& statement : statements)
+            session->statements.push_back(statement);
+        if (hung_up) {
+            session->closing = true;
+            session->statements.clear();
+            close_now = !session->running;
+        } else {
+            this->schedule(session);
+        }
+    }
+    if (hung_up)
+        this->drained.notify_all();
+    if (hung_up)
+        epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, session->fd, nullptr);
+    if (close_now)
+        this->close(session);
+}
+
+void SQLServer::flush(SessionPtr session) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::size_t written = 0;
+    while (written < session->out.size()) {
+        ssize_t n = ::send(session->fd, session->out.data() + written, session->out.size() - written,
+                           MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                session->closing = true;
+                session->out.clear();
+                written = 0;
+            }
+            break;
+        }
+        written += n;
+    }
+    session->out.erase(0, written);
+    if (session->closing || session->out.size() <= MAX_PENDING_OUT)
+        this->drained.notify_all();
+    if (session->closing)
+        return;
+    this->schedule(session);
+
+    // only ask for writability while output is backed up
+    struct epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = CLIENT_EVENTS | (session->out.empty() ? 0 : EPOLLOUT);
+    event.data.fd = session->fd;
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, session->fd, &event);
+}
+
+void SQLServer::deliver() {
+    u_int64_t count;
+    while (::read(this->event_fd, &count, sizeof(count)) > 0)
+        continue;
+
+    std::deque<SessionPtr> done;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        done.swap(this->completed);
+    }
+    for (SessionPtr& session : done) {
+        if (!session->closing)
+            this->flush(session);
+        bool close_now;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            close_now = session->closing && !session->running;
+        }
+        if (close_now)
+            this->close(session);
+    }
+}
+
+void SQLServer::close(SessionPtr session) {
+    std::map<int, SessionPtr>::iterator found = this->sessions.find(session->fd);
+    if (found == this->sessions.end() || found->second != session)
+        return;
+    epoll_ctl(this->epoll_fd, EPOLL_CTL_DEL, session->fd, nullptr);
+    ::close(session->fd);
+    this->sessions.erase(found);
+}
+
+void SQLServer::schedule(SessionPtr session) {
+    if (session->running || session->closing || session->statements.empty())
+        return;
+    if (session->out.size() > MAX_PENDING_OUT)
+        return; // flush() schedules the session again once the client catches up
+    session->running = true;
+    this->ready.push_back(session);
+    this->work.notify_one();
+}
+
+void SQLServer::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->work.notify_all();
+    this->drained.notify_all();
+    for (std::thread& worker : this->workers)
+        if (worker.joinable())
+            worker.join();
+    this->workers.clear();
+    while (!this->sessions.empty()) {
+        SessionPtr session = this->sessions.begin()->second;
+        session->running = false;
+        this->close(session);
+    }
+    ::unlink(this->socket_path.c_str());
+}
+
+void SQLServer::post(SessionPtr session, std::string& frames) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (session->closing || this->stopping)
+            return;
+        if (session->out.empty())
+            session->out.swap(frames);
+        else
+            session->out.append(frames);
+        this->completed.push_back(session);
+    }
+    u_int64_t one = 1;
+    while (::write(this->event_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+        continue;
+
+    // a statement producing more than the client reads (e.g. "bench N") waits here for the backlog to drain
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->drained.wait(lock, [this, session] {
+        return session->out.size() <= MAX_PENDING_OUT || session->closing || this->stopping;
+    });
+}
+
+void SQLServer::serve() {
+    while (true) {
+        SessionPtr session;
+        Frame statement;
+        bool abandoned;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->work.wait(lock, [this] { return this->stopping || !this->ready.empty(); });
+            if (this->stopping)
+                return;
+            session = this->ready.front();
+            this->ready.pop_front();
+            abandoned = session->closing || session->statements.empty();
+            if (!abandoned) {
+                statement = session->statements.front();
+                session->statements.pop_front();
+            }
+        }
+
+        if (!abandoned) {
+            ResultWriter writer(statement.request_id, [this, session](std::string& frames) {
+                this->post(session, frames);
+            });
+            try {
+                this->handler(statement.payload, writer);
+                writer.end();
+            } catch (std::exception& e) {
+                writer.error(e.what());
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            // requeue at the back so other sessions get a turn between statements
+            session->running = false;
+            this->schedule(session);
+            this->completed.push_back(session);
+        }
+        u_int64_t one = 1;
+        while (::write(this->event_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+            continue;
+    }
+}
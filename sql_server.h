@@ -0,0 +1,145 @@
+/**
+ * @file sql_server.h - Unix domain socket server for the SQL shell.
+ * SQLServer
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "wire_protocol.h"
+
+/**
+ * @class SQLServer - serves SQL sessions over a Unix domain socket
+ *
+ * A single epoll loop owns every socket: it accepts clients, reads their
+ * QUERY frames (see wire_protocol.h), and writes back result frames. Statements
+ * are run by a fixed pool of worker threads (one per core by default) rather
+ * than a thread per connection. Clients may pipeline requests; each session has
+ * at most one statement in flight, so a session's results come back in the
+ * order its statements were sent. A session whose client is not reading its
+ * results stops running statements once MAX_PENDING_OUT bytes are waiting to
+ * be written, until the backlog drains.
+ */
+class SQLServer {
+public:
+    using Handler = std::function<void(const std::string&, ResultWriter&)>;
+    static const std::size_t MAX_PENDING_OUT = 4 * ResultWriter::FLUSH_SZ;
+
+    /**
+     * @param socket_path The filesystem path to listen on
+     * @param handler Executes one statement, writing its results
+     * @param n_workers The number of worker threads (0 for one per core)
+     */
+    SQLServer(std::string socket_path, Handler handler, unsigned n_workers = 0);
+
+    virtual ~SQLServer();
+
+    SQLServer(const SQLServer& other) = delete;
+
+    SQLServer(SQLServer&& temp) = delete;
+
+    SQLServer& operator=(const SQLServer& other) = delete;
+
+    SQLServer& operator=(SQLServer&& temp) = delete;
+
+    /**
+     * Listens for and serves clients until SIGINT or SIGTERM is received
+     */
+    virtual void run();
+
+protected:
+    struct Session {
+        int fd;
+        FrameReader in;                     // bytes read but not yet a full frame
+        std::string out;                    // result frames not yet written
+        std::deque<Frame> statements;       // QUERY frames waiting to run
+        bool running;                       // a worker owns the session
+        bool closing;                       // peer hung up
+    };
+    using SessionPtr = std::shared_ptr<Session>;
+
+    std::string socket_path;
+    Handler handler;
+    unsigned n_workers;
+    int listen_fd;
+    int epoll_fd;
+    int event_fd;  // wakes the epoll loop when workers finish statements
+    int signal_fd;
+    int spare_fd;  // held in reserve to turn away clients when out of descriptors
+    bool stopping;
+    std::map<int, SessionPtr> sessions;
+    std::deque<SessionPtr> ready;      // sessions with a statement to run
+    std::deque<SessionPtr> completed;  // sessions with new results to write
+    std::vector<std::thread> workers;
+    std::mutex mutex;  // guards ready, completed, stopping, and session queues
+    std::condition_variable work;
+    std::condition_variable drained;  // a session's pending output fell below MAX_PENDING_OUT, or it closed
+
+    /**
+     * Creates the listening socket, epoll instance, and wakeup descriptors
+     */
+    virtual void listen();
+
+    /**
+     * Accepts all pending client connections
+     */
+    virtual void accept();
+
+    /**
+     * Reads from a client and queues any complete QUERY frames
+     * @param session The client session
+     */
+    virtual void receive(SessionPtr session);
+
+    /**
+     * Writes as much pending output to a client as the socket accepts
+     * @param session The client session
+     */
+    virtual void flush(SessionPtr session);
+
+    /**
+     * Writes out results that workers have produced since the last wakeup
+     */
+    virtual void deliver();
+
+    /**
+     * Hands result frames from a worker to the epoll loop
+     * @param session The client session
+     * @param frames Encoded frames (emptied)
+     */
+    virtual void post(SessionPtr session, std::string& frames);
+
+    /**
+     * Closes a client session once no worker is using it
+     * @param session The client session
+     */
+    virtual void close(SessionPtr session);
+
+    /**
+     * Hands a session's next statement to the workers, unless a worker already
+     * owns the session, it is closing, or too much of its output is unwritten
+     * (caller holds the mutex)
+     * @param session The client session
+     */
+    virtual void schedule(SessionPtr session);
+
+    /**
+     * Stops and joins the workers, closes every session, and removes the socket
+     */
+    virtual void shutdown();
+
+    /**
+     * Worker thread body: runs queued statements until the server stops
+     */
+    virtual void serve();
+};
@@ -0,0 +1,208 @@
+/**
+ * @file statement_scheduler.cpp - Implementation of concurrent statement execution.
+ * StatementScheduler
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include "statement_scheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+/**
+ * Checks whether two lists of table names share a table
+ */
+static bool overlaps(const ColumnNames& a, const ColumnNames& b) {
+    for (auto const& table_name : a)
+        if (std::find(b.begin(), b.end(), table_name) != b.end())
+            return true;
+    return false;
+}
+
+StatementScheduler::StatementScheduler(unsigned n_threads) : threads(), jobs(), stopping(false) {
+    if (!n_threads)
+        n_threads = std::thread::hardware_concurrency();
+    if (!n_threads)
+        n_threads = 1;
+    for (unsigned i = 0; i < n_threads; i++)
+        this->threads.push_back(std::thread(&StatementScheduler::serve, this));
+}
+
+StatementScheduler::~StatementScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->work.notify_all();
+    for (std::thread& thread : this->threads)
+        thread.join();
+}
+
+bool StatementScheduler::conflicts(const Task& a, const Task& b) {
+    if (a.barrier || b.barrier)
+        return true;
+    return overlaps(a.writes, b.writes) || overlaps(a.writes, b.reads) || overlaps(a.reads, b.writes);
+}
+
+std::vector<std::string> StatementScheduler::run(const Tasks& tasks) {
+    std::size_t n = tasks.size();
+    if (n == 1)
+        return std::vector<std::string>(1, execute(tasks[0]));
+
+    // dependency graph: each task waits on every earlier task it conflicts with
+    std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+    batch->tasks = &tasks;
+    batch->results.resize(n);
+    batch->dependents.resize(n);
+    batch->waiting_on.resize(n, 0);
+    batch->finished = 0;
+    for (std::size_t later = 0; later < n; later++) {
+        for (std::size_t earlier = 0; earlier < later; earlier++) {
+            if (conflicts(tasks[earlier], tasks[later])) {
+                batch->dependents[earlier].push_back(later);
+                batch->waiting_on[later]++;
+            }
+        }
+    }
+    for (std::size_t i = 0; i < n; i++)
+        if (batch->waiting_on[i] == 0)
+            this->start(batch, i);
+
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->done.wait(lock, [&] { return batch->finished == n; });
+    return batch->results;
+}
+
+void StatementScheduler::start(std::shared_ptr<Batch> batch, std::size_t i) {
+    this->submit([this, batch, i] {
+        std::string result = execute((*batch->tasks)[i]);
+        std::vector<std::size_t> ready;
+        {
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            batch->results[i] = result;
+            for (std::size_t dependent : batch->dependents[i])
+                if (--batch->waiting_on[dependent] == 0)
+                    ready.push_back(dependent);
+            batch->finished++;
+            if (batch->finished == batch->dependents.size())
+                batch->done.notify_all();
+        }
+        for (std::size_t dependent : ready)
+            this->start(batch, dependent);
+    });
+}
+
+std::string StatementScheduler::execute(const Task& task) {
+    try {
+        return task.run();
+    } catch (std::exception& e) {
+        return std::string("Error: ") + e.what();
+    }
+}
+
+void StatementScheduler::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->jobs.push_back(job);
+    }
+    this->work.notify_one();
+}
+
+void StatementScheduler::serve() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->work.wait(lock, [this] { return this->stopping || !this->jobs.empty(); });
+            if (this->jobs.empty())
+                return;
+            job = this->jobs.front();
+            this->jobs.pop_front();
+        }
+        job();
+    }
+}
+
+bool test_statement_scheduler() {
+    StatementScheduler scheduler(4);
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<std::string> events;  // "start i" and "finish i", in the order they happened
+    auto task = [&](std::size_t i, ColumnNames reads, ColumnNames writes, bool barrier,
+                    std::function<void()> body) -> StatementScheduler::Task {
+        StatementScheduler::Task statement;
+        statement.reads = reads;
+        statement.writes = writes;
+        statement.barrier = barrier;
+        statement.run = [&, i, body]() -> std::string {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                events.push_back("start " + std::to_string(i));
+            }
+            changed.notify_all();
+            body();
+            std::lock_guard<std::mutex> lock(mutex);
+            events.push_back("finish " + std::to_string(i));
+            return std::to_string(i);
+        };
+        return statement;
+    };
+    auto position = [&](const std::string& event) {
+        return std::find(events.begin(), events.end(), event) - events.begin();
+    };
+    // waits (a bounded time) until another statement has started
+    auto await_start = [&](std::size_t other) {
+        return [&, other] {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait_for(lock, std::chrono::seconds(5), [&] {
+                return std::find(events.begin(), events.end(), "start " + std::to_string(other)) != events.end();
+            });
+        };
+    };
+    auto pause = [] { std::this_thread::sleep_for(std::chrono::milliseconds(10)); };
+
+    // statements on different tables overlap; each only finishes once the other has started
+    StatementScheduler::Tasks independent = {task(0, {"t1"}, {}, false, await_start(1)),
+                                             task(1, {"t2"}, {"t2"}, false, await_start(0))};
+    std::vector<std::string> results = scheduler.run(independent);
+    bool overlap_ok = results == std::vector<std::string>({"0", "1"}) && position("start 1") < position("finish 0") &&
+                      position("start 0") < position("finish 1");
+    std::cout << "statement overlap ok" << std::endl;
+
+    // statements writing the same table, or reading what an earlier one writes, keep their order
+    events.clear();
+    StatementScheduler::Tasks ordered = {task(0, {}, {"t1"}, false, pause), task(1, {"t1"}, {}, false, pause),
+                                         task(2, {}, {"t1"}, false, pause)};
+    results = scheduler.run(ordered);
+    bool order_ok = results == std::vector<std::string>({"0", "1", "2"}) &&
+                    position("finish 0") < position("start 1") && position("finish 1") < position("start 2");
+    std::cout << "statement order ok" << std::endl;
+
+    // a statement with unknown tables waits for everything before it, and everything after waits for it
+    events.clear();
+    StatementScheduler::Tasks barred = {task(0, {"t1"}, {}, false, pause), task(1, {}, {}, true, pause),
+                                        task(2, {"t2"}, {}, false, pause)};
+    results = scheduler.run(barred);
+    bool barrier_ok = results == std::vector<std::string>({"0", "1", "2"}) &&
+                      position("finish 0") < position("start 1") && position("finish 1") < position("start 2");
+    std::cout << "statement barrier ok" << std::endl;
+
+    // a failing statement reports its error the same way alone as in a batch
+    auto failing = [&](ColumnNames tables) -> StatementScheduler::Task {
+        StatementScheduler::Task statement = task(0, tables, {}, false, pause);
+        statement.run = []() -> std::string { throw std::runtime_error("boom"); };
+        return statement;
+    };
+    StatementScheduler::Tasks alone = {failing({"t1"})};
+    StatementScheduler::Tasks batched = {failing({"t1"}), task(1, {"t2"}, {}, false, pause)};
+    bool error_ok = scheduler.run(alone) == std::vector<std::string>({"Error: boom"}) &&
+                    scheduler.run(batched) == std::vector<std::string>({"Error: boom", "1"});
+    std::cout << "statement error ok" << std::endl;
+
+    return overlap_ok && order_ok && barrier_ok && error_ok;
+}
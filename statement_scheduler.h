@@ -0,0 +1,125 @@
+/**
+ * @file statement_scheduler.h - Concurrent execution of independent statements.
+ * StatementScheduler
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class StatementScheduler - runs a batch of statements on a worker pool
+ *
+ * Each statement declares the tables it reads and writes. Two statements
+ * conflict if they touch a common table and at least one of them writes it;
+ * a statement only starts once every earlier statement it conflicts with has
+ * finished. Statements that touch disjoint tables, or only read, run
+ * concurrently. Results are returned in submission order regardless. A
+ * statement that throws yields "Error: " and the exception's message as its
+ * output, however many statements the batch holds.
+ */
+class StatementScheduler {
+public:
+    /**
+     * One statement of a batch
+     */
+    struct Task {
+        ColumnNames reads;                 // tables the statement reads
+        ColumnNames writes;                // tables the statement modifies
+        bool barrier;                      // conflicts with every other statement
+        std::function<std::string()> run; // executes the statement, returning its output
+    };
+    using Tasks = std::vector<Task>;
+
+    /**
+     * @param n_threads The number of worker threads (0 for one per core)
+     */
+    StatementScheduler(unsigned n_threads = 0);
+
+    virtual ~StatementScheduler();
+
+    StatementScheduler(const StatementScheduler& other) = delete;
+
+    StatementScheduler(StatementScheduler&& temp) = delete;
+
+    StatementScheduler& operator=(const StatementScheduler& other) = delete;
+
+    StatementScheduler& operator=(StatementScheduler&& temp) = delete;
+
+    /**
+     * Runs a batch of statements, respecting conflicts between them
+     * @param tasks The statements, in submission order
+     * @return The output of each statement, in submission order
+     */
+    virtual std::vector<std::string> run(const Tasks& tasks);
+
+    /**
+     * Checks whether two statements must run in submission order
+     * @param a The earlier statement
+     * @param b The later statement
+     * @return True if they touch a common table and either writes it
+     */
+    static bool conflicts(const Task& a, const Task& b);
+
+protected:
+    /**
+     * The state of one run(): the dependency graph and the outputs. Jobs share
+     * it, so it outlives whichever of them finishes last.
+     */
+    struct Batch {
+        const Tasks* tasks;
+        std::vector<std::string> results;
+        std::vector<std::vector<std::size_t>> dependents;  // later tasks waiting on each task
+        std::vector<std::size_t> waiting_on;               // unfinished earlier tasks each task waits on
+        std::size_t finished;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> jobs;
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable work;
+
+    /**
+     * Queues a job for the worker pool
+     * @param job The job to run
+     */
+    virtual void submit(std::function<void()> job);
+
+    /**
+     * Submits a task of a batch whose dependencies have all finished; once it
+     * finishes, starts the dependents it was the last to hold up
+     * @param batch The batch
+     * @param i The index of the task
+     */
+    virtual void start(std::shared_ptr<Batch> batch, std::size_t i);
+
+    /**
+     * Runs one statement, turning an exception into an "Error: " output
+     * @param task The statement
+     * @return The statement's output
+     */
+    static std::string execute(const Task& task);
+
+    /**
+     * Worker thread body: runs jobs until the scheduler stops
+     */
+    virtual void serve();
+};
+
+/**
+ * Statement scheduler test function. Returns true if all tests pass.
+ */
+bool test_statement_scheduler();
@@ -359,6 +359,18 @@ public:
      */
     virtual ValueDict* project(Handle handle, const ColumnNames* column_names) = 0;
 
+    /**
+     * Get the relation's column names, in column order.
+     * @returns  list of column names
+     */
+    virtual const ColumnNames& get_column_names() const { return column_names; }
+
+    /**
+     * Get the relation's column attributes, in column order.
+     * @returns  list of column attributes
+     */
+    virtual const ColumnAttributes& get_column_attributes() const { return column_attributes; }
+
 protected:
     Identifier table_name;
     ColumnNames column_names;
@@ -0,0 +1,136 @@
+/**
+ * @file text_kernels.cpp - Implementation of the vectorized TEXT comparisons.
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include "text_kernels.h"
+#include <cstring>
+#include <sys/types.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using u32 = u_int32_t;
+
+#if defined(__AVX2__)
+
+using Lanes = __m256i;
+static const std::size_t LANES = 32;
+static const u32 ALL_LANES = 0xffffffff;
+
+static inline Lanes load(const char* bytes) { return _mm256_loadu_si256((const __m256i*)bytes); }
+
+static inline Lanes splat(char c) { return _mm256_set1_epi8(c); }
+
+static inline Lanes equal(Lanes a, Lanes b) { return _mm256_cmpeq_epi8(a, b); }
+
+static inline Lanes both(Lanes a, Lanes b) { return _mm256_and_si256(a, b); }
+
+// one bit per byte lane, set where the lane is all ones
+static inline u32 lane_mask(Lanes a) { return (u32)_mm256_movemask_epi8(a); }
+
+#elif defined(__SSE2__)
+
+using Lanes = __m128i;
+static const std::size_t LANES = 16;
+static const u32 ALL_LANES = 0xffff;
+
+static inline Lanes load(const char* bytes) { return _mm_loadu_si128((const __m128i*)bytes); }
+
+static inline Lanes splat(char c) { return _mm_set1_epi8(c); }
+
+static inline Lanes equal(Lanes a, Lanes b) { return _mm_cmpeq_epi8(a, b); }
+
+static inline Lanes both(Lanes a, Lanes b) { return _mm_and_si128(a, b); }
+
+// one bit per byte lane, set where the lane is all ones
+static inline u32 lane_mask(Lanes a) { return (u32)_mm_movemask_epi8(a); }
+
+#endif
+
+/**
+ * Compares two runs of bytes of the same length. Four blocks of lanes are
+ * compared per branch; the last block overlaps the ones before it rather than
+ * falling back to a byte at a time.
+ */
+static inline bool same_bytes(const char* a, const char* b, std::size_t size) {
+#ifdef __SSE2__
+    if (size >= LANES) {
+        std::size_t i = 0;
+        for (; i + 4 * LANES <= size; i += 4 * LANES) {
+            Lanes equal_01 = both(equal(load(a + i), load(b + i)), equal(load(a + i + LANES), load(b + i + LANES)));
+            Lanes equal_23 = both(equal(load(a + i + 2 * LANES), load(b + i + 2 * LANES)),
+                                  equal(load(a + i + 3 * LANES), load(b + i + 3 * LANES)));
+            if (lane_mask(both(equal_01, equal_23)) != ALL_LANES)
+                return false;
+        }
+        for (; i + LANES <= size; i += LANES)
+            if (lane_mask(equal(load(a + i), load(b + i))) != ALL_LANES)
+                return false;
+        return lane_mask(equal(load(a + size - LANES), load(b + size - LANES))) == ALL_LANES;
+    }
+#endif
+    return !std::memcmp(a, b, size);
+}
+
+bool text_equals(const char* text, std::size_t size, const char* pattern, std::size_t pattern_size) {
+    return size == pattern_size && same_bytes(text, pattern, size);
+}
+
+bool text_starts_with(const char* text, std::size_t size, const char* prefix, std::size_t prefix_size) {
+    return size >= prefix_size && same_bytes(text, prefix, prefix_size);
+}
+
+#ifdef __SSE2__
+/**
+ * Checks the needle at the LANES starting positions from text: candidates are
+ * the positions where both its first and its last byte match
+ */
+static inline bool block_contains(const char* text, const char* needle, std::size_t needle_size, Lanes first,
+                                  Lanes last) {
+    u32 candidates = lane_mask(both(equal(first, load(text)), equal(last, load(text + needle_size - 1))));
+    while (candidates) {
+        std::size_t lane = __builtin_ctz(candidates);
+        if (!std::memcmp(text + lane + 1, needle + 1, needle_size - 2))
+            return true;
+        candidates &= candidates - 1;
+    }
+    return false;
+}
+#endif
+
+bool text_contains(const char* text, std::size_t size, const char* needle, std::size_t needle_size) {
+    if (!needle_size)
+        return true;
+    if (needle_size > size)
+        return false;
+    if (needle_size == 1)
+        return std::memchr(text, needle[0], size) != nullptr;
+    std::size_t n_starts = size - needle_size + 1;
+#ifdef __SSE2__
+    if (n_starts >= LANES) {
+        Lanes first = splat(needle[0]), last = splat(needle[needle_size - 1]);
+        for (std::size_t i = 0; i + LANES <= n_starts; i += LANES)
+            if (block_contains(text + i, needle, needle_size, first, last))
+                return true;
+        // the last block overlaps the ones before it
+        return block_contains(text + n_starts - LANES, needle, needle_size, first, last);
+    }
+#endif
+    for (std::size_t i = 0; i < n_starts; i++)
+        if (text[i] == needle[0] && !std::memcmp(text + i + 1, needle + 1, needle_size - 1))
+            return true;
+    return false;
+}
+
+const char* text_kernel_isa() {
+#if defined(__AVX2__)
+    return "AVX2";
+#elif defined(__SSE2__)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
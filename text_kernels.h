@@ -0,0 +1,49 @@
+/**
+ * @file text_kernels.h - Vectorized comparisons of TEXT values in place.
+ *
+ * Each kernel works on the bytes of a TEXT value straight out of a marshaled
+ * record (see RecordLayout::get_text), without building a std::string. They
+ * compare 32 bytes per instruction when compiled for AVX2 (make
+ * SIMDFLAGS=-mavx2), 16 with SSE2 (any x86-64 build), and fall back to
+ * scalar code elsewhere.
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Checks whether a TEXT value equals a pattern
+ * @param text The value's bytes
+ * @param size The value's length
+ * @param pattern The pattern's bytes
+ * @param pattern_size The pattern's length
+ */
+bool text_equals(const char* text, std::size_t size, const char* pattern, std::size_t pattern_size);
+
+/**
+ * Checks whether a TEXT value starts with a prefix (LIKE 'prefix%')
+ * @param text The value's bytes
+ * @param size The value's length
+ * @param prefix The prefix's bytes
+ * @param prefix_size The prefix's length
+ */
+bool text_starts_with(const char* text, std::size_t size, const char* prefix, std::size_t prefix_size);
+
+/**
+ * Checks whether a TEXT value contains a substring (LIKE '%needle%'). Each
+ * step compares a block of positions against the needle's first and last
+ * bytes at once, and checks the whole needle only where both match.
+ * @param text The value's bytes
+ * @param size The value's length
+ * @param needle The substring's bytes
+ * @param needle_size The substring's length
+ */
+bool text_contains(const char* text, std::size_t size, const char* needle, std::size_t needle_size);
+
+/**
+ * Names the instruction set the kernels were compiled for: "AVX2", "SSE2" or "scalar"
+ */
+const char* text_kernel_isa();
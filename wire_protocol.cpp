@@ -0,0 +1,312 @@
+/**
+ * @file wire_protocol.cpp - Implementation of the binary client/server protocol.
+ * Frame
+ * FrameReader
+ * ResultWriter
+ * RowBatchReader
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+
+#include "wire_protocol.h"
+#include <cstring>
+#include <iostream>
+
+using u8 = u_int8_t;
+using u16 = u_int16_t;
+using u32 = u_int32_t;
+
+// byte offset of the row count within a ROWS payload, given its column count
+static std::size_t row_count_offset(std::size_t n_columns) {
+    return sizeof(u16) + n_columns;
+}
+
+template <typename T>
+static void append(std::string& out, T n) {
+    out.append((const char*)&n, sizeof(n));
+}
+
+template <typename T>
+static T read(const char* bytes) {
+    T n;
+    std::memcpy(&n, bytes, sizeof(n));
+    return n;
+}
+
+// Begin Frame Functions
+
+void Frame::encode(std::string& out) const {
+    append<u32>(out, this->payload.size());
+    append<u8>(out, (u8)this->type);
+    append<u32>(out, this->request_id);
+    out.append(this->payload);
+}
+
+// End Frame Functions
+
+// Begin Frame Reader Functions
+
+void FrameReader::feed(const char* data, std::size_t size) {
+    // compact once the consumed prefix dominates the buffer
+    if (this->start > 0 && this->start * 2 > this->buffer.size()) {
+        this->buffer.erase(0, this->start);
+        this->start = 0;
+    }
+    this->buffer.append(data, size);
+}
+
+bool FrameReader::next(Frame& frame) {
+    std::size_t available = this->buffer.size() - this->start;
+    if (available < Frame::HEADER_SZ)
+        return false;
+    const char* header = this->buffer.data() + this->start;
+    u32 size = read<u32>(header);
+    if (size > Frame::MAX_PAYLOAD_SZ)
+        throw WireProtocolError("frame too large");
+    if (available < Frame::HEADER_SZ + size)
+        return false;
+    u8 type = read<u8>(header + sizeof(u32));
+    if (type < (u8)FrameType::QUERY || type > (u8)FrameType::ERROR)
+        throw WireProtocolError("unknown frame type");
+    frame.type = (FrameType)type;
+    frame.request_id = read<u32>(header + sizeof(u32) + sizeof(u8));
+    frame.payload.assign(header + Frame::HEADER_SZ, size);
+    this->start += Frame::HEADER_SZ + size;
+    if (this->start == this->buffer.size()) {
+        this->buffer.clear();
+        this->start = 0;
+    }
+    return true;
+}
+
+// End Frame Reader Functions
+
+// Begin Result Writer Functions
+
+ResultWriter::ResultWriter(u_int32_t request_id, Sink sink)
+    : request_id(request_id), sink(sink), out(), batch(), schema(), layout(), batch_rows(0), row_count(0), ended(false)
+{}
+
+void ResultWriter::text(const std::string& text) {
+    this->finish_batch();
+    Frame(FrameType::TEXT, this->request_id, text).encode(this->out);
+    if (this->out.size() >= FLUSH_SZ)
+        this->flush();
+}
+
+void ResultWriter::begin_rows(const ColumnAttributes& column_attributes) {
+    this->finish_batch();
+    this->schema.clear();
+    this->layout = RecordLayout(column_attributes);
+    append<u16>(this->schema, column_attributes.size());
+    for (ColumnAttribute ca : column_attributes)
+        append<u8>(this->schema, (u8)ca.get_data_type());
+}
+
+void ResultWriter::row(const Dbt& record) {
+    if (this->schema.empty())
+        throw WireProtocolError("rows written before begin_rows");
+    u32 size = record.get_size();
+    if (this->batch_rows && this->batch.size() + sizeof(u16) + size > BATCH_SZ)
+        this->finish_batch();
+    if (this->batch.empty()) {
+        this->batch.append(this->schema);
+        append<u32>(this->batch, 0); // row count, patched in finish_batch
+    }
+    append<u16>(this->batch, size);
+    this->batch.append((const char*)record.get_data(), size);
+    this->batch_rows++;
+    this->row_count++;
+}
+
+void ResultWriter::row(const std::vector<Value>& row) {
+    if (this->schema.empty())
+        throw WireProtocolError("rows written before begin_rows");
+    std::string bytes;
+    try {
+        bytes = this->layout.marshal(row);
+    } catch (DbRelationError& e) {
+        throw WireProtocolError(e.what());
+    }
+    Dbt record((void*)bytes.data(), bytes.size());
+    this->row(record);
+}
+
+void ResultWriter::error(const std::string& message) {
+    if (this->ended) return;
+    this->batch.clear();
+    this->batch_rows = 0;
+    Frame(FrameType::ERROR, this->request_id, message).encode(this->out);
+    this->ended = true;
+    this->flush();
+}
+
+void ResultWriter::end() {
+    if (this->ended) return;
+    this->finish_batch();
+    Frame(FrameType::DONE, this->request_id).encode(this->out);
+    this->ended = true;
+    this->flush();
+}
+
+void ResultWriter::finish_batch() {
+    if (!this->batch_rows) return;
+    u16 n_columns = read<u16>(this->batch.data());
+    std::memcpy(&this->batch[row_count_offset(n_columns)], &this->batch_rows, sizeof(u32));
+    Frame frame(FrameType::ROWS, this->request_id);
+    frame.payload.swap(this->batch);
+    frame.encode(this->out);
+    this->batch.clear();
+    this->batch_rows = 0;
+    if (this->out.size() >= FLUSH_SZ)
+        this->flush();
+}
+
+void ResultWriter::flush() {
+    if (this->out.empty()) return;
+    this->sink(this->out);
+    this->out.clear();
+}
+
+// End Result Writer Functions
+
+// Begin Row Batch Reader Functions
+
+RowBatchReader::RowBatchReader(const std::string& payload)
+    : payload(payload), column_attributes(), layout(), n_rows(0), rows_read(0), offset(0)
+{
+    if (payload.size() < sizeof(u16))
+        throw WireProtocolError("truncated row batch");
+    u16 n_columns = read<u16>(payload.data());
+    std::size_t header_size = row_count_offset(n_columns) + sizeof(u32);
+    if (payload.size() < header_size)
+        throw WireProtocolError("truncated row batch");
+    for (u16 i = 0; i < n_columns; i++) {
+        u8 type = read<u8>(payload.data() + sizeof(u16) + i);
+        if (type > ColumnAttribute::DataType::TEXT)
+            throw WireProtocolError("unknown column type");
+        this->column_attributes.push_back(ColumnAttribute((ColumnAttribute::DataType)type));
+    }
+    this->layout = RecordLayout(this->column_attributes);
+    this->n_rows = read<u32>(payload.data() + row_count_offset(n_columns));
+    this->offset = header_size;
+}
+
+bool RowBatchReader::next(std::vector<Value>& row) {
+    if (this->rows_read == this->n_rows)
+        return false;
+    const char* bytes = this->payload.data();
+    std::size_t end = this->payload.size();
+    if (this->offset + sizeof(u16) > end)
+        throw WireProtocolError("truncated row");
+    u16 size = read<u16>(bytes + this->offset);
+    this->offset += sizeof(u16);
+    std::size_t row_end = this->offset + size;
+    if (row_end > end || !this->layout.check(bytes + this->offset, size))
+        throw WireProtocolError("truncated row");
+    this->layout.unmarshal(bytes + this->offset, row);
+    this->offset = row_end;
+    this->rows_read++;
+    return true;
+}
+
+// End Row Batch Reader Functions
+
+bool test_wire_protocol() {
+    // frames fed a byte at a time come out whole and in order
+    std::string stream;
+    Frame(FrameType::QUERY, 7, "select 1").encode(stream);
+    Frame(FrameType::DONE, 8).encode(stream);
+    FrameReader reader;
+    Frame frame;
+    std::vector<Frame> frames;
+    for (std::size_t i = 0; i < stream.size(); i++) {
+        reader.feed(stream.data() + i, 1);
+        while (reader.next(frame))
+            frames.push_back(frame);
+    }
+    bool split_ok = frames.size() == 2 && frames[0].type == FrameType::QUERY && frames[0].request_id == 7 &&
+                    frames[0].payload == "select 1" && frames[1].type == FrameType::DONE &&
+                    frames[1].request_id == 8 && frames[1].payload.empty();
+    std::cout << "wire split frames ok" << std::endl;
+
+    // an oversize frame is rejected from its header alone, as is an unknown frame type
+    auto rejects = [](const std::string& bytes) {
+        FrameReader bad;
+        Frame ignored;
+        bad.feed(bytes.data(), bytes.size());
+        try {
+            bad.next(ignored);
+        } catch (WireProtocolError& e) {
+            return true;
+        }
+        return false;
+    };
+    std::string oversize;
+    append<u32>(oversize, Frame::MAX_PAYLOAD_SZ + 1);
+    append<u8>(oversize, (u8)FrameType::QUERY);
+    append<u32>(oversize, 1);
+    std::string bad_type;
+    Frame(FrameType::QUERY, 1, "select 1").encode(bad_type);
+    bad_type[sizeof(u32)] = (char)((u8)FrameType::ERROR + 1);
+    bool reject_ok = rejects(oversize) && rejects(bad_type);
+    std::cout << "wire bad frames ok" << std::endl;
+
+    // rows are split into ROWS frames of at most BATCH_SZ bytes and read back intact
+    const int n_rows = 400;  // about 400KB, so several batches and more than one flush
+    std::string sent;
+    int flushes = 0;
+    ResultWriter writer(3, [&](std::string& out) {
+        sent.append(out);
+        flushes++;
+    });
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::TEXT)};
+    writer.begin_rows(column_attributes);
+    for (int i = 0; i < n_rows; i++)
+        writer.row(std::vector<Value>({Value(i), Value(std::string(1000, 'a' + i % 26))}));
+    writer.end();
+    FrameReader results;
+    results.feed(sent.data(), sent.size());
+    int batches = 0, rows_read = 0;
+    bool batch_ok = writer.get_row_count() == n_rows && flushes > 1, round_trip_ok = true, done = false;
+    std::string first_batch;
+    while (results.next(frame)) {
+        batch_ok = batch_ok && frame.request_id == 3 && !done;
+        if (frame.type == FrameType::DONE) {
+            done = true;
+            continue;
+        }
+        batch_ok = batch_ok && frame.type == FrameType::ROWS && frame.payload.size() <= ResultWriter::BATCH_SZ;
+        if (!batches++)
+            first_batch = frame.payload;
+        RowBatchReader rows(frame.payload);
+        ColumnAttributes received = rows.get_column_attributes();
+        round_trip_ok = round_trip_ok && received.size() == 2 && received[0].get_data_type() == ColumnAttribute::INT &&
+                        received[1].get_data_type() == ColumnAttribute::TEXT;
+        std::vector<Value> row;
+        while (rows.next(row)) {
+            round_trip_ok = round_trip_ok && row.size() == 2 && row[0].n == rows_read &&
+                            row[1].s == std::string(1000, 'a' + rows_read % 26);
+            rows_read++;
+        }
+    }
+    batch_ok = batch_ok && done && batches > 1;
+    round_trip_ok = round_trip_ok && rows_read == n_rows;
+    std::cout << "wire row batches ok" << std::endl;
+
+    // a batch cut short is reported rather than read past its end
+    first_batch.resize(first_batch.size() - 1);
+    bool truncated_ok = false;
+    try {
+        RowBatchReader rows(first_batch);
+        std::vector<Value> row;
+        while (rows.next(row)) {}
+    } catch (WireProtocolError& e) {
+        truncated_ok = true;
+    }
+    std::cout << "wire rows round trip ok" << std::endl;
+
+    return split_ok && reject_ok && batch_ok && round_trip_ok && truncated_ok;
+}
@@ -0,0 +1,240 @@
+/**
+ * @file wire_protocol.h - Binary protocol between the sql5300 server and its clients.
+ * Frame
+ * FrameReader
+ * ResultWriter
+ * RowBatchReader
+ *
+ * @authors Justin Thoreson & Mason Adsero
+ * @see "Seattle University, CPSC5300, Winter 2023"
+ */
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "record_layout.h"
+#include "storage_engine.h"
+
+/**
+ * Every message is a length-prefixed frame (host byte order, the protocol only
+ * runs over a local socket):
+ *     Bytes 0x00 - 0x03: payload length
+ *     Byte  0x04:        frame type
+ *     Bytes 0x05 - 0x08: request id (chosen by the client, echoed by the server)
+ *     Bytes 0x09 - ...:  payload
+ *
+ * A client may send any number of QUERY frames without waiting (pipelining).
+ * The server answers them in order: zero or more TEXT and ROWS frames, then
+ * exactly one DONE or ERROR frame with the same request id.
+ *
+ * A ROWS payload is a batch of rows packed the same way HeapTable marshals
+ * records (see RecordLayout), so the server can copy record bytes straight
+ * out of a block:
+ *     u16 column count, u8 data type per column, u32 row count,
+ *     then for each row: u16 size followed by the marshaled record.
+ */
+enum class FrameType : u_int8_t {
+    QUERY = 1,
+    TEXT = 2,
+    ROWS = 3,
+    DONE = 4,
+    ERROR = 5
+};
+
+/**
+ * @class WireProtocolError - malformed frame or batch
+ */
+class WireProtocolError : public std::runtime_error {
+public:
+    explicit WireProtocolError(std::string s) : runtime_error(s) {}
+};
+
+/**
+ * @class Frame - one decoded protocol message
+ */
+class Frame {
+public:
+    static const uint HEADER_SZ = 9;
+    static const uint MAX_PAYLOAD_SZ = 1 << 24;
+
+    FrameType type;
+    u_int32_t request_id;
+    std::string payload;
+
+    Frame() : type(FrameType::DONE), request_id(0), payload() {}
+
+    Frame(FrameType type, u_int32_t request_id, std::string payload = "")
+        : type(type), request_id(request_id), payload(payload) {}
+
+    /**
+     * Appends this frame, header and payload, to a buffer
+     * @param out The buffer to append to
+     */
+    virtual void encode(std::string& out) const;
+};
+
+/**
+ * @class FrameReader - splits a byte stream into frames
+ */
+class FrameReader {
+public:
+    FrameReader() : buffer(), start(0) {}
+
+    virtual ~FrameReader() {}
+
+    /**
+     * Adds bytes received from the peer
+     * @param data The received bytes
+     * @param size The number of received bytes
+     */
+    virtual void feed(const char* data, std::size_t size);
+
+    /**
+     * Removes the next complete frame, if any
+     * @param frame Set to the next frame
+     * @return True if a complete frame was available
+     * @throws WireProtocolError if the frame is malformed
+     */
+    virtual bool next(Frame& frame);
+
+protected:
+    std::string buffer;
+    std::size_t start;  // offset of the first unread byte in buffer
+};
+
+/**
+ * @class ResultWriter - encodes one request's results as frames
+ *
+ * Rows are gathered into ROWS frames of up to BATCH_SZ bytes; encoded frames
+ * are handed to the sink whenever FLUSH_SZ bytes have accumulated, so large
+ * results stream out instead of being built up in memory.
+ */
+class ResultWriter {
+public:
+    using Sink = std::function<void(std::string&)>;
+    static const uint BATCH_SZ = 64 * 1024;
+    static const uint FLUSH_SZ = 256 * 1024;
+
+    /**
+     * @param request_id The request the results answer
+     * @param sink Receives encoded frames (and may take ownership of their bytes)
+     */
+    ResultWriter(u_int32_t request_id, Sink sink);
+
+    virtual ~ResultWriter() {}
+
+    ResultWriter(const ResultWriter& other) = delete;
+
+    ResultWriter(ResultWriter&& temp) = delete;
+
+    ResultWriter& operator=(const ResultWriter& other) = delete;
+
+    ResultWriter& operator=(ResultWriter&& temp) = delete;
+
+    /**
+     * Sends a text result
+     * @param text The text to send
+     */
+    virtual void text(const std::string& text);
+
+    /**
+     * Starts a result set; rows added until end() or the next begin_rows() follow this schema
+     * @param column_attributes The data types of the result columns
+     */
+    virtual void begin_rows(const ColumnAttributes& column_attributes);
+
+    /**
+     * Adds a row that is already marshaled in HeapTable's record format
+     * @param record The marshaled record bytes (copied verbatim)
+     */
+    virtual void row(const Dbt& record);
+
+    /**
+     * Marshals and adds a row
+     * @param row The row's values, in column order
+     */
+    virtual void row(const std::vector<Value>& row);
+
+    /**
+     * Sends an error in place of any further results and ends the request
+     * @param message The error message
+     */
+    virtual void error(const std::string& message);
+
+    /**
+     * Ends the request, sending any batched rows and the DONE frame
+     */
+    virtual void end();
+
+    /**
+     * Retrieves the number of rows written so far
+     */
+    virtual u_int64_t get_row_count() const { return this->row_count; }
+
+protected:
+    u_int32_t request_id;
+    Sink sink;
+    std::string out;
+    std::string batch;        // ROWS payload being built
+    std::string schema;       // column count and types of the current result set
+    RecordLayout layout;      // layout of the current result set's rows
+    u_int32_t batch_rows;
+    u_int64_t row_count;
+    bool ended;
+
+    /**
+     * Closes the current ROWS frame, if it has any rows
+     */
+    virtual void finish_batch();
+
+    /**
+     * Hands accumulated frames to the sink
+     */
+    virtual void flush();
+};
+
+/**
+ * @class RowBatchReader - decodes the rows of a ROWS payload
+ */
+class RowBatchReader {
+public:
+    /**
+     * @param payload The ROWS frame payload (must outlive the reader)
+     * @throws WireProtocolError if the batch header is malformed
+     */
+    RowBatchReader(const std::string& payload);
+
+    virtual ~RowBatchReader() {}
+
+    /**
+     * Retrieves the data types of the batch's columns
+     */
+    virtual const ColumnAttributes& get_column_attributes() const { return this->column_attributes; }
+
+    /**
+     * Retrieves the number of rows in the batch
+     */
+    virtual u_int32_t size() const { return this->n_rows; }
+
+    /**
+     * Decodes the next row
+     * @param row Set to the row's values, in column order
+     * @return True if there was another row
+     * @throws WireProtocolError if the row is malformed
+     */
+    virtual bool next(std::vector<Value>& row);
+
+protected:
+    const std::string& payload;
+    ColumnAttributes column_attributes;
+    RecordLayout layout;
+    u_int32_t n_rows;
+    u_int32_t rows_read;
+    std::size_t offset;
+};
+
+/**
+ * Wire protocol test function. Returns true if all tests pass.
+ */
+bool test_wire_protocol();